@@ -1,3 +1,13 @@
 #pragma once
 
+#include "bench.h"
+
 void run_app(int argc, char** argv);
+
+// For morph_bench: in a hidden window with the GL state of the app, times
+// reps uploads (write_nodes_to_vbos) and readbacks (read_nodes_from_vbos)
+// of a zygote of each of the given sizes, adding "upload/size" and
+// "readback/size" results in ms. base_shader_path is as for run_app.
+// Returns false if there is no GL context or the buffers did not fit.
+bool time_gl_transfers(string const& base_shader_path,
+    vector<int> const& zygote_sizes, int reps, vector<BenchResult>& results);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "types.h"
+
+// The results of morph_bench, and the comparison of two runs of it
+
+// The samples of one measurement, ex. "sim/256/t4" in ns/node/iter
+struct BenchResult {
+  string name;
+  string unit;
+  vector<double> samples;
+
+  BenchResult();
+  BenchResult(string name, string unit);
+};
+
+// Writes results as JSON, with a "results" array of {name, unit,
+// samples} objects. Returns false if the file could not be written.
+bool write_bench_json(string const& path, string const& shader_path,
+    vector<BenchResult> const& results);
+
+// Reads the results written by write_bench_json. This only handles the
+// JSON that it writes. Returns false, with a warning, if the file could
+// not be read or parsed.
+bool read_bench_json(string const& path, vector<BenchResult>& results);
+
+struct WelchTest {
+  double t = 0.0;
+  double dof = 0.0;
+  // two-sided
+  double p = 1.0;
+
+  WelchTest();
+};
+
+// Welch's t-test of whether a and b have the same mean, without
+// assuming that they have the same variance. Each needs 2 samples.
+WelchTest welch_t_test(vector<double> const& a, vector<double> const& b);
+
+// Prints how each result of current compares to the same one of
+// baseline. A result is a regression if its mean is larger (all units
+// are costs) by more than min_change (a fraction) and the t-test gives
+// p < alpha. Returns the number of regressions.
+int compare_bench_results(vector<BenchResult> const& baseline,
+    vector<BenchResult> const& current, double alpha, double min_change);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.h"
+
+// Identifies the simulation that a checkpoint belongs to: the program,
+// backend, zygote size, node order, node pool size and the exact value
+// of every user uniform
+string checkpoint_key(MorphProgram const& prog, Controls const& controls);
+
+// Returns the checkpoint of key with the largest iter_num <= max_iter_num,
+// or nullptr if there is none. Marks it as recently used.
+SimCheckpoint* find_checkpoint(CheckpointCache& cache,
+    string const& key, int max_iter_num);
+
+bool has_checkpoint(CheckpointCache const& cache,
+    string const& key, int iter_num);
+
+// Snapshots the state after iter_num iterations, which must be in
+// buffers[iter_num & 1] of the given backend. Evicts the least recently
+// used checkpoints to stay within cache.budget_bytes. Does nothing if
+// the snapshot alone is over budget.
+void add_checkpoint(MorphState& m_state, string const& key,
+    int iter_num, int sim_backend);
+
+// Copies the checkpoint into buffers[cp.iter_num & 1] of its backend
+// (and the node pool, for the CPU backend) and sets m_state.num_nodes
+void restore_checkpoint(MorphState& m_state, SimCheckpoint const& cp);
+
+// Evicts checkpoints until the total size is at most budget_bytes
+void trim_checkpoints(CheckpointCache& cache, size_t budget_bytes);
+
+void clear_checkpoints(CheckpointCache& cache);
+
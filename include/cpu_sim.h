@@ -0,0 +1,76 @@
+#pragma once
+
+#include "types.h"
+
+// The user-tunable uniforms of shaders/growth.glsl. Only the x
+// component is used for single-component uniforms, as in the shader.
+struct GrowthParams {
+  vec4 fix_positions = vec4(0.0);
+  vec4 norm_src_pos = vec4(0.0);
+  vec4 init_src_dir = vec4(0.0);
+  vec4 src_heat_gen_rate = vec4(0.0);
+  vec4 heat_transfer_coeff = vec4(0.0);
+  vec4 target_spring_len = vec4(0.0);
+  vec4 spring_coeffs = vec4(0.0);
+  vec4 force_coeffs = vec4(0.0);
+  vec4 src_trans_probs = vec4(0.0);
+  vec4 cloning_coeffs = vec4(0.0);
+  vec4 cloning_interval = vec4(0.0);
+  vec4 noise_seed = vec4(0.0);
+  vec4 spawn_prob = vec4(0.0);
+
+  GrowthParams();
+  // looks up each uniform by name, warning about any that are missing
+  GrowthParams(vector<UserUnif> const& user_unifs);
+
+  // the key of the node noise, see philox.h
+  uint32_t seed() const;
+};
+
+// Computes the next state of nodes [begin, end) from cur into next.
+// This is the CPU equivalent of one transform feedback draw of
+// shaders/growth.glsl. node_ids[i] is the id of node i (its row-major
+// index, see node_order.h), or node_ids is null if they are the same.
+void run_cpu_iter(GrowthParams const& params, MorphNodes const& cur,
+    MorphNodes& next, const int* node_ids, int iter_num, int begin, int end);
+
+// Seeds cpu_state for a run from iteration 0: the zygote of
+// controls.num_zygote_samples in buffer 0, moved to controls.node_order
+// with its node ids (empty for the row-major order) and tiles, and a node
+// pool of controls.node_pool_size. Returns the zygote's triangles, in the
+// node order, in indices.
+void seed_cpu_state(CpuMorphState& cpu_state, Controls const& controls,
+    vector<GLuint>& indices);
+
+// Runs iterations [start_iter, end_iter) on the CPU, starting from the
+// state in cpu_state.buffers[start_iter & 1] (the seed data in buffer 0
+// when start_iter is 0), with the node ids in cpu_state.node_ids. The
+// node range is split across controls.num_sim_threads threads (0 for one
+// per core), and the SIMD kernels are used if enabled and supported. If
+// cpu_state.node_pool is enabled, the splice requests of each iteration
+// are carried out before the next (see node_pool.h). If
+// controls.use_active_set is set, each iteration after the first only
+// updates cpu_state.active_set.
+void run_cpu_simulation(CpuMorphState& cpu_state, GrowthParams const& params,
+    int start_iter, int end_iter, Controls const& controls);
+
+// Computes the residual of the latest result of cpu_state from prev_pos,
+// the positions (and heat) of its nodes some iterations earlier. The
+// nodes are reduced in parallel on the pool of the last
+// run_cpu_simulation.
+SimResidual compute_cpu_residual(CpuMorphState& cpu_state,
+    vector<vec4> const& prev_pos);
+
+// True if residual is within the tolerances of criteria
+bool residual_converged(SimResidual const& residual,
+    ConvergenceCriteria const& criteria);
+
+// Runs from start_iter, as run_cpu_simulation, checking the residual
+// every criteria.check_interval iterations. Stops once it converges or
+// at criteria.max_iters, and returns the iteration reached, with the
+// residual of the last check in residual.
+int run_cpu_to_convergence(CpuMorphState& cpu_state,
+    GrowthParams const& params, int start_iter,
+    ConvergenceCriteria const& criteria, Controls const& controls,
+    SimResidual& residual);
+
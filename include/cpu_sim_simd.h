@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+
+// SIMD kernels for the regular (iter_num > 0) iterations of the CPU
+// backend. They operate on the raw SoA arrays of MorphNodes, LANES nodes
+// per step, and give bit-identical results to the scalar code in
+// cpu_sim.cpp.
+
+// Raw views of the arrays used by one iteration. Every array holds
+// 4 components per node.
+struct SimdIterArgs {
+  const float* pos = nullptr;
+  const float* vel = nullptr;
+  const int* neighbors = nullptr;
+  const float* data = nullptr;
+  // the heat each node emits along each of its edges, see
+  // compute_heat_emit in growth.glsl
+  const float* heat_flux = nullptr;
+
+  float* next_pos = nullptr;
+  float* next_vel = nullptr;
+  int* next_neighbors = nullptr;
+  float* next_data = nullptr;
+  // written by the flux pass
+  float* next_heat_flux = nullptr;
+
+  // the growth.glsl uniforms used by the kernels
+  float heat_transfer_coeff = 0.0;
+  float target_spring_len = 0.0;
+  float spring_coeff_short = 0.0;
+  float spring_coeff_long = 0.0;
+  float force_coeff_src = 0.0;
+  float force_coeff_heat = 0.0;
+  bool fix_positions = false;
+  // when false, no non-source node can be randomly promoted to a source
+  // so that branch is skipped entirely
+  bool can_promote = false;
+  float src_promote_prob = 0.0;
+  // the key and counter of the node noise, see philox.h. node_ids is
+  // null if each node's id is its index.
+  uint32_t seed = 0;
+  int iter_num = 0;
+  const int* node_ids = nullptr;
+};
+
+struct SimdKernels {
+  const char* name;
+  // the number of nodes handled per call
+  int lanes;
+
+  // writes heat_flux for nodes [first, first + lanes)
+  void (*flux_block)(SimdIterArgs const& args, int first);
+  // writes the next state of nodes [first, first + lanes). The source
+  // transition of some nodes (sources, and nodes that are randomly
+  // promoted) is not vectorized; their indices are written to
+  // fixup_nodes and the count is returned. The caller must compute their
+  // next vel and data with the scalar code.
+  int (*reg_block)(SimdIterArgs const& args, int first, int* fixup_nodes);
+};
+
+// Returns the widest kernels supported by this CPU (checked via CPUID),
+// or nullptr if there are none
+SimdKernels const* get_simd_kernels();
+
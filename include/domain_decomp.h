@@ -0,0 +1,65 @@
+#pragma once
+
+#include "types.h"
+#include "cpu_sim.h"
+
+// Domain decomposition of the CPU backend across worker processes. The
+// nodes are split into contiguous index ranges, one per worker, which
+// lays out row-major zygotes as strips of rows and the other node orders
+// as compact blocks. Each worker keeps only its own nodes and a halo of
+// the nodes within two edges of them (the update of a node reads the heat
+// of its neighbors' neighbors, see compute_next_heat).
+//
+// After each iteration, every worker writes the position, heat and data
+// message of its nodes that are in another worker's halo to shared memory,
+// waits at a barrier and then reads its own halo back. The send buffers
+// are double-buffered by iteration, so one barrier per iteration is
+// enough. The result is the same as a single-process run with the scalar
+// code, in any node order and with any number of workers.
+
+// The nodes of one worker, in the index space of the whole zygote
+struct DomainPart {
+  // the nodes owned by this part, [begin, end)
+  int begin = 0;
+  int end = 0;
+  // the global index of each local node: the owned nodes, then the halo
+  // in index order
+  vector<int> local_nodes;
+  // the neighbors of each local node as local indices. A halo node's
+  // neighbors outside the part are OPEN_EDGE, as they are never read.
+  vector<ivec4> local_neighbors;
+  // the owned nodes that are in another part's halo, in index order
+  vector<int> send_nodes;
+  // for each halo node, the part that owns it and its index in that
+  // part's send_nodes
+  vector<int> halo_owners;
+  vector<int> halo_slots;
+
+  DomainPart();
+};
+
+// The timings of run_domain_simulation
+struct DomainStats {
+  double wall_ms = 0.0;
+  // per worker, the time spent updating its nodes and exchanging halos
+  // (including the wait at the barrier)
+  vector<double> compute_ms;
+  vector<double> exchange_ms;
+  // the halo nodes of all of the parts
+  int num_halo_nodes = 0;
+
+  DomainStats();
+};
+
+// Splits nodes into num_parts parts of (as near as possible) equal size
+vector<DomainPart> partition_nodes(MorphNodes const& nodes, int num_parts);
+
+// Runs iterations [start_iter, end_iter) of cpu_state as
+// run_cpu_simulation does, in num_workers forked worker processes with
+// one part each. Iteration 0 runs in the calling process, as it needs the
+// whole zygote. Returns false, with a warning, if a worker failed or
+// the node pool is enabled (the parts would have to change with the
+// topology).
+bool run_domain_simulation(CpuMorphState& cpu_state,
+    GrowthParams const& params, int start_iter, int end_iter,
+    int num_workers, DomainStats* stats = nullptr);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.h"
+
+// Frame time telemetry for the app. Each frame records the interval to
+// the next frame, the work done in it (the interval less the buffer
+// swap and the pacing sleep) and the CPU time of each FramePhase. Phases may nest, ex. the
+// uploads within the sim pipeline, in which case the inner phase's time
+// is only counted for it, so the phases of a frame add up to at most its
+// work.
+
+extern const char* FRAME_SERIES_NAMES[FRAME_SERIES_COUNT];
+
+// Starts a frame at the current time, first recording the open frame
+void begin_frame(FrameStats& stats);
+
+// Marks the end of the work of the open frame, before the pacing sleep.
+// The work of a frame without it is 0.
+void end_frame_work(FrameStats& stats);
+
+// Times the rest of the open frame as phase (or nothing, if -1), until
+// the next switch. Returns the phase that was being timed.
+int switch_frame_phase(FrameStats& stats, int phase);
+
+// Times its scope as phase, then goes back to the phase before it
+struct FramePhaseScope {
+  FrameStats& stats;
+  int prev_phase;
+
+  FramePhaseScope(FrameStats& stats, int phase);
+  ~FramePhaseScope();
+};
+
+// The distribution of one series of FrameTimes over the recorded frames
+struct FramePercentiles {
+  float p50 = 0.0f;
+  float p95 = 0.0f;
+  float p99 = 0.0f;
+  float max = 0.0f;
+  // the frames over the budget, if one was given
+  int num_over_budget = 0;
+  int num_frames = 0;
+
+  FramePercentiles();
+};
+
+// Returns the nearest-rank percentiles of series over the recorded
+// frames, and counts the frames over budget_ms if it is > 0
+FramePercentiles compute_frame_percentiles(FrameStats const& stats,
+    int series, float budget_ms);
+
+// Returns the number of recorded frames of series in each of num_buckets
+// equal buckets over [0, max_ms]. Larger times count in the last bucket.
+vector<float> frame_time_histogram(FrameStats const& stats, int series,
+    int num_buckets, float max_ms);
+
+// Writes the recorded frames to path as CSV, oldest first, with a column
+// per series in ms. Returns false, with a warning, if it could not.
+bool write_frame_stats_csv(FrameStats const& stats, string const& path);
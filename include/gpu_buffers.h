@@ -0,0 +1,34 @@
+#pragma once
+
+#include "types.h"
+
+// GL buffers whose storage is sized to what they hold rather than to the
+// largest possible zygote. A buffer starts out empty and grows
+// geometrically as needed. It keeps its handle when it grows, so the VAOs
+// that use it stay valid, and its texture buffer is re-attached to the
+// new storage.
+
+// Creates an empty buffer, returning its handle. If tex_buf is not 0, it
+// is attached to the buffer with the internal format tex_format.
+GLuint create_gpu_buffer(GpuBuffers& bufs, GLenum usage,
+    GLuint tex_buf = 0, GLenum tex_format = 0);
+
+// Grows the storage of buffer to at least num_bytes, to twice its size if
+// that is larger and within budget. The first keep_bytes bytes are copied
+// to the new storage. Returns false, with a warning, if the storage would
+// go over bufs.budget_bytes or could not be allocated, in which case the
+// buffer and its first keep_bytes bytes are unchanged if possible.
+bool reserve_gpu_buffer(GpuBuffers& bufs, GLuint buffer, size_t num_bytes,
+    size_t keep_bytes);
+
+// Grows each of the buffers as reserve_gpu_buffer does. Their total
+// growth is checked against bufs.budget_bytes first, so that none of them
+// grow if they do not all fit, and one buffer doubling its storage never
+// takes the room that the others need. Returns false, with a warning, if
+// any could not be grown. Only an allocation failure can leave some of
+// them grown.
+bool reserve_gpu_buffers(GpuBuffers& bufs,
+    vector<GpuBufferReserve> const& reserves);
+
+// Returns the size of the storage of buffer in bytes
+size_t gpu_buffer_capacity(GpuBuffers const& bufs, GLuint buffer);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+
+// GPU times of the simulation and render passes. The chrono timings of
+// the app measure when the GL commands are submitted, not when the GPU
+// runs them. Instead, each timed draw is wrapped in a GL_TIME_ELAPSED
+// query. The results of a frame are read GPU_TIMER_LATENCY or more frames
+// later, and only once GL reports them available, so that the CPU never
+// waits on the GPU. The queries are then reused.
+
+// the frames before the results of a frame are first checked
+const int GPU_TIMER_LATENCY = 2;
+// the most queries in flight. Draws past this in a frame are not timed,
+// ex. when a long run issues thousands of simulation passes at once.
+const int GPU_TIMER_MAX_QUERIES = 4096;
+
+extern const char* GPU_PASS_NAMES[GPU_PASS_COUNT];
+
+// Starts a new frame, first collecting the results of the earlier frames
+// that are available. Times no passes in the new frame if enabled is
+// false.
+void begin_gpu_timer_frame(GpuTimers& timers, bool enabled);
+
+// Times the GL commands from here to end_gpu_timer as pass. Timers do
+// not nest: this does nothing if another pass is being timed.
+void begin_gpu_timer(GpuTimers& timers, int pass);
+void end_gpu_timer(GpuTimers& timers);
+
+// The mean and max ms per frame of pass over the collected history
+void gpu_pass_stats(GpuTimers const& timers, int pass, float& mean_ms,
+    float& max_ms);
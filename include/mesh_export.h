@@ -0,0 +1,26 @@
+#pragma once
+
+#include "types.h"
+
+enum MeshFormat {
+  // binary little-endian PLY. Each vertex has its position, heat
+  // (pos.w) and an is_source flag (vel.w != 0) as properties.
+  MESH_FORMAT_PLY = 0,
+  // Wavefront OBJ. The heat and is_source flag are written as the u and
+  // v of each vertex's texture coordinate.
+  MESH_FORMAT_OBJ,
+
+  MESH_FORMAT_COUNT
+};
+
+// Returns the format for the extension of path (.ply or .obj), or -1
+int mesh_format_for_path(string const& path);
+
+// Writes the nodes as the vertices of a triangle mesh with the given
+// triangle indices, as from gen_morph_data. The file is written in
+// fixed-size chunks, so memory use does not depend on the mesh size.
+// Returns false on an IO error.
+bool export_mesh(string const& path, int format, int num_nodes,
+    vec4 const* pos, vec4 const* vel,
+    int num_indices, GLuint const* indices);
+
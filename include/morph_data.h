@@ -0,0 +1,15 @@
+#pragma once
+
+#include "types.h"
+
+// Generates the initial (zygote) plane of samples[0] x samples[1] nodes.
+// Outputs the nodes and the triangle indices, for rendering
+void gen_morph_data(ivec2 samples, MorphNodes& out_nodes,
+    vector<GLuint>& out_indices);
+
+// Writes one line per node, in the format of raw_node_str
+void write_nodes(FILE* file, MorphNodes const& node_vecs);
+
+// Writes one CSV row per node, with every float at full precision
+void write_nodes_csv(FILE* file, MorphNodes const& node_vecs);
+
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "types.h"
+
+// Reorders the zygote nodes (see NodeOrder) so that the neighbor gathers
+// of each iteration hit the cache more often. The id of a node is its
+// index in the row-major order, which the simulation uses in place of
+// its index wherever the result depends on it (the initial source and
+// the noise), so every order gives the same result.
+
+extern const char* NODE_ORDER_NAMES[NODE_ORDER_COUNT];
+
+// Returns the order with the given name, or -1
+int node_order_for_name(string const& name);
+
+// Returns the permutation new_to_old for the zygote nodes, which must be
+// in the row-major order of gen_morph_data: new index i holds the node
+// at old index new_to_old[i].
+vector<int> compute_node_order(int order, ivec2 samples,
+    MorphNodes const& nodes);
+
+// Returns the tiles of the zygote, whose nodes must be in NODE_ORDER_TILED
+NodeTiles compute_node_tiles(ivec2 samples, MorphNodes const& nodes);
+
+// Returns the index of node n within the given tile, or -1 if n is in
+// another tile (or is -1)
+inline int tile_local_index(NodeTiles const& tiles, int tile, int n) {
+  int local_index = n - tiles.tile_starts[tile];
+  return (local_index >= 0 && n < tiles.tile_starts[tile + 1]) ?
+    local_index : -1;
+}
+
+vector<int> identity_permutation(int num_nodes);
+
+vector<int> invert_permutation(vector<int> const& perm);
+
+// Returns perm resized to num_nodes, extended with the identity. Spliced
+// nodes (see node_pool.h) are their own id, so this gives the node ids of
+// a grown mesh from those of its zygote.
+vector<int> extend_permutation(vector<int> perm, int num_nodes);
+
+// Moves the nodes to their new indices, remapping the neighbor indices
+// and the triangle indices to match
+void permute_nodes(vector<int> const& new_to_old, MorphNodes& nodes,
+    vector<GLuint>& indices);
+
+// Measures of how well the neighbor gathers of an iteration hit the cache
+struct LocalityStats {
+  // the mean and max of |node index - neighbor index|
+  double mean_neighbor_dist = 0.0;
+  int max_neighbor_dist = 0;
+  // the simulated cache misses per node when reading the pos of each
+  // node and its neighbors in index order
+  double gather_misses_per_node = 0.0;
+
+  LocalityStats();
+};
+
+// Simulates an 8-way set-associative LRU cache of cache_bytes with
+// 64 byte lines
+LocalityStats measure_locality(MorphNodes const& nodes, size_t cache_bytes);
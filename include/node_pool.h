@@ -0,0 +1,46 @@
+#pragma once
+
+#include "types.h"
+
+// Dynamic node allocation for the CPU backend, so that the mesh can grow
+// from a small zygote. A source requests a new node by setting its data.w
+// to SPLICE_MSG_BASE + the slot of one of its edges (see
+// compute_source_transition). Between iterations, run_topology_pass
+// allocates a node from the pool for each request, places it halfway
+// along the edge, links it into the neighbors of the two ends and splits
+// the triangles on the edge.
+//
+// A spliced node is only linked along the edge that it split. Its other
+// two slots are OPEN_EDGE, which unlike -1 neither fixes the node in
+// place nor takes heat from it.
+
+const int SPLICE_MSG_BASE = 4;
+const int OPEN_EDGE = -2;
+
+// Sets up pool for num_nodes nodes with the given triangle indices, with
+// room for pool_size more nodes
+void init_node_pool(NodePool& pool, int num_nodes,
+    vector<GLuint> indices, int pool_size);
+
+inline bool node_pool_enabled(NodePool const& pool) {
+  return pool.capacity > 0;
+}
+
+// Returns the index of an inactive node (all OPEN_EDGE neighbors),
+// growing nodes if need be, or -1 if the pool is full
+int alloc_node(NodePool& pool, MorphNodes& nodes);
+
+// Returns node to the pool. The caller must already have unlinked it from
+// its neighbors and removed its triangles.
+void free_node(NodePool& pool, MorphNodes& nodes, int node);
+
+// Carries out and clears the splice requests in nodes, in order of node
+// id so that the result does not depend on the node order. Spliced nodes
+// are their own id, and are appended to node_ids unless it is empty.
+// Returns the number of nodes spliced.
+int run_topology_pass(NodePool& pool, MorphNodes& nodes,
+    vector<int>& node_ids);
+
+// Returns the sorted indices of the triangles added or changed since the
+// last call
+vector<int> take_changed_tris(NodePool& pool);
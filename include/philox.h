@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+
+// Philox4x32-7, a counter-based random number generator (Salmon et al.,
+// "Parallel random numbers: as easy as 1, 2, 3"). Each output is a pure
+// function of a 128-bit counter and a 64-bit key, so every node can draw
+// its own noise without any state, in any order, on any backend.
+//
+// The same integer code is in shaders/growth.glsl and in the SIMD kernels
+// (cpu_sim_simd_kernel.inl). Keep the three in sync.
+
+const uint32_t PHILOX_M0 = 0xD2511F53u;
+const uint32_t PHILOX_M1 = 0xCD9E8D57u;
+const uint32_t PHILOX_W0 = 0x9E3779B9u;
+const uint32_t PHILOX_W1 = 0xBB67AE85u;
+const int PHILOX_ROUNDS = 7;
+
+// The independent noise streams drawn by each node per iteration
+enum NoiseStream {
+  // the trans_noise of compute_source_transition
+  NOISE_STREAM_SOURCE_TRANSITION = 0,
+  // rand_neighbor_index
+  NOISE_STREAM_NEIGHBOR,
+};
+
+inline void philox_round(uint32_t ctr[4], uint32_t key[2]) {
+  uint64_t prod0 = (uint64_t) PHILOX_M0 * ctr[0];
+  uint64_t prod1 = (uint64_t) PHILOX_M1 * ctr[2];
+  uint32_t hi0 = prod0 >> 32;
+  uint32_t lo0 = (uint32_t) prod0;
+  uint32_t hi1 = prod1 >> 32;
+  uint32_t lo1 = (uint32_t) prod1;
+  ctr[0] = hi1 ^ ctr[1] ^ key[0];
+  ctr[1] = lo1;
+  ctr[2] = hi0 ^ ctr[3] ^ key[1];
+  ctr[3] = lo0;
+}
+
+// Scrambles ctr in place
+inline void philox4x32(uint32_t ctr[4], uint32_t seed) {
+  uint32_t key[2] = {seed, 0};
+  for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+    if (r > 0) {
+      key[0] += PHILOX_W0;
+      key[1] += PHILOX_W1;
+    }
+    philox_round(ctr, key);
+  }
+}
+
+// Maps the top 24 bits of x to [0, 1). Exact in float, so the GLSL and
+// C++ versions agree bit for bit.
+inline float philox_unit_float(uint32_t x) {
+  return (float) (x >> 8) * (1.0f / 16777216.0f);
+}
+
+// Returns 4 uniform values in [0, 1) for the given node, iteration and
+// stream
+inline void node_noise(uint32_t seed, uint32_t node_id, uint32_t iter_num,
+    uint32_t stream, float out_noise[4]) {
+  uint32_t ctr[4] = {node_id, iter_num, stream, 0};
+  philox4x32(ctr, seed);
+  for (int i = 0; i < 4; ++i) {
+    out_noise[i] = philox_unit_float(ctr[i]);
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "types.h"
+
+// Reads a shader file: the user-tunable uniforms listed in its header,
+// up to END_USER_UNIFS, and the GLSL text that follows. Returns false if
+// the file could not be opened.
+bool read_prog_file(string prog_filename,
+    string& out_prog_text, vector<UserUnif>& out_user_unifs);
+
+// Sets the named uniform to a comma-separated list of up to 4 floats.
+// Returns false if there is no such uniform or the value is malformed.
+bool override_user_unif(vector<UserUnif>& user_unifs,
+    string const& name, string const& value);
+
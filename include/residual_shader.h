@@ -0,0 +1,36 @@
+// The vertex shader of the residual reduction of the GL backend, see
+// GpuResidual. Vertex i reduces inputs [64 * i, 64 * (i + 1)) to one
+// partial residual: the largest displacement, the sum of the
+// displacements and the sum of the absolute heat changes. The first pass
+// compares the node positions to those at the last check, and each later
+// pass combines the partials of the pass before.
+
+// the inputs reduced by each vertex, the 64 in the shader
+const int RESIDUAL_GROUP_SIZE = 64;
+
+const char* RESIDUAL_VERTEX_SRC = R"--(
+#version 410
+
+uniform samplerBuffer in_buf;
+uniform samplerBuffer prev_pos_buf;
+uniform int num_inputs;
+uniform bool first_pass;
+
+out vec4 out_partial;
+
+void main() {
+  int begin = 64 * gl_VertexID;
+  int end = min(begin + 64, num_inputs);
+  vec4 partial = vec4(0.0);
+  for (int i = begin; i < end; ++i) {
+    vec4 v = texelFetch(in_buf, i);
+    if (first_pass) {
+      vec4 delta = v - texelFetch(prev_pos_buf, i);
+      float disp = length(delta.xyz);
+      v = vec4(disp, disp, abs(delta.w), 0.0);
+    }
+    partial = vec4(max(partial.x, v.x), partial.yz + v.yz, 0.0);
+  }
+  out_partial = partial;
+}
+)--";
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "types.h"
+#include "cpu_sim.h"
+#include "triple_buffer.h"
+
+// Runs the CPU backend on a thread of its own, so that the app can keep
+// drawing frames while a long simulation runs. The app submits what to
+// simulate as SimRequests and takes back the newest SimWorkerState each
+// frame. Both go through a TripleBuffer, so neither side waits on the
+// other; the mutex only lets the worker sleep while it has no work.
+//
+// The worker runs towards the target of the newest request in slices of
+// about SIM_WORKER_SLICE_MS, checking for a new request between them,
+// and publishes its state about every SIM_WORKER_PUBLISH_MS and once
+// the target is reached. It reseeds if the key changes or the target is
+// before the iteration it has reached, and otherwise carries on. Each
+// slice is a run_cpu_simulation call, so the active set is rebuilt
+// between them: the result matches a single run only if
+// controls.active_set_epsilon is 0.
+
+const double SIM_WORKER_SLICE_MS = 50.0;
+const double SIM_WORKER_PUBLISH_MS = 33.0;
+
+struct SimRequest {
+  // see checkpoint_key. A new key reseeds the simulation.
+  string key;
+  int target_iter = 0;
+  GrowthParams params;
+  // the simulation controls, ex. the zygote size, node order and threads
+  Controls controls;
+
+  SimRequest();
+};
+
+struct SimWorkerState {
+  // the key of the request being simulated
+  string key;
+  int iter_num = 0;
+  int target_iter = 0;
+  // in the node order of the request, as the CPU backend's result
+  MorphNodes nodes;
+  vector<GLuint> indices;
+  // see CpuMorphState::node_ids
+  vector<int> node_ids;
+  // changes whenever indices or node_ids do, ex. on a reseed or splice
+  int topology_version = 0;
+
+  SimWorkerState();
+};
+
+struct SimWorker {
+  // starts the worker thread, which waits for the first request
+  SimWorker();
+  // stops the worker after its current slice
+  ~SimWorker();
+
+  // Replaces the request being simulated. Never waits on the worker.
+  void submit(SimRequest const& request);
+
+  // Returns the newest state published since the last call, or null if
+  // there is none. It is valid until the next call.
+  SimWorkerState* take_state();
+
+private:
+  SimWorker(SimWorker const&);
+  SimWorker& operator=(SimWorker const&);
+
+  void worker_loop();
+
+  TripleBuffer<SimRequest> requests;
+  TripleBuffer<SimWorkerState> states;
+  // only for waking the worker, which never holds it while simulating
+  mutex wake_mutex;
+  condition_variable wake;
+  // set by submit until the worker takes the request
+  atomic<bool> request_pending;
+  atomic<bool> stopping;
+  thread worker;
+};
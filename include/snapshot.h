@@ -0,0 +1,88 @@
+#pragma once
+
+#include "types.h"
+
+#include <cstdint>
+
+// Binary snapshot of the simulation state, laid out so that it can be
+// mmap'd and used in place:
+//
+//   SnapshotHeader
+//   SnapshotUnif[num_unifs]
+//   pos       vec4[num_nodes]
+//   vel       vec4[num_nodes]
+//   neighbors ivec4[num_nodes]
+//   data      vec4[num_nodes]
+//   indices   GLuint[num_indices]
+//
+// Every section starts at a multiple of SNAPSHOT_ALIGNMENT bytes, given
+// by the header's offsets. All values are in the native (little-endian)
+// byte order.
+
+const char SNAPSHOT_MAGIC[8] = {'M', 'O', 'R', 'P', 'H', 'S', 'N', 'P'};
+// bump this when the layout changes
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint64_t SNAPSHOT_ALIGNMENT = 64;
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  // the number of iterations that produced the state
+  int32_t iter_num;
+  int32_t num_nodes;
+  int32_t num_indices;
+  int32_t num_unifs;
+  int32_t num_zygote_samples;
+
+  uint64_t unifs_offset;
+  uint64_t pos_offset;
+  uint64_t vel_offset;
+  uint64_t neighbors_offset;
+  uint64_t data_offset;
+  uint64_t indices_offset;
+  uint64_t file_size;
+  uint64_t reserved[5];
+};
+static_assert(sizeof(SnapshotHeader) == 128, "unexpected header size");
+
+// The value of a user uniform when the snapshot was taken
+struct SnapshotUnif {
+  char name[44];
+  int32_t num_comps;
+  float value[4];
+};
+static_assert(sizeof(SnapshotUnif) == 64, "unexpected unif size");
+
+// A read-only view of a mapped snapshot file
+struct MappedSnapshot {
+  SnapshotHeader const* header = nullptr;
+  SnapshotUnif const* unifs = nullptr;
+  vec4 const* pos = nullptr;
+  vec4 const* vel = nullptr;
+  ivec4 const* neighbors = nullptr;
+  vec4 const* data = nullptr;
+  GLuint const* indices = nullptr;
+
+  void* map_addr = nullptr;
+  size_t map_size = 0;
+
+  MappedSnapshot();
+};
+
+// Writes the state after iter_num iterations. Returns false on an IO
+// error.
+bool write_snapshot(string const& path, int iter_num,
+    int num_zygote_samples, vector<UserUnif> const& user_unifs,
+    MorphNodes const& nodes, vector<GLuint> const& indices);
+
+// Maps the file and points the MappedSnapshot at its sections, without
+// copying them. Returns false, with nothing mapped, if the file is
+// missing, truncated, not a snapshot of this version, or has a neighbor
+// or index that is not a node.
+bool map_snapshot(string const& path, MappedSnapshot& out_snapshot);
+
+void unmap_snapshot(MappedSnapshot& snapshot);
+
+// Copies the node arrays of a mapped snapshot
+MorphNodes snapshot_nodes(MappedSnapshot const& snapshot);
+
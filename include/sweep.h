@@ -0,0 +1,73 @@
+#pragma once
+
+#include "types.h"
+
+// How the sample points of a sweep are chosen
+enum SweepDesign {
+  // every combination of grid_points evenly spaced values per dim
+  SWEEP_GRID = 0,
+  // num_samples uniformly random points
+  SWEEP_RANDOM,
+  // num_samples points, with exactly one in each of the num_samples
+  // strata of every dim (Latin hypercube)
+  SWEEP_LHS,
+
+  SWEEP_DESIGN_COUNT
+};
+
+// One swept dimension: a component of a user uniform, varied over the
+// [min, max] range declared in the shader header
+struct SweepDim {
+  int unif_index = 0;
+  int comp = 0;
+
+  SweepDim();
+  SweepDim(int unif_index, int comp);
+};
+
+struct SweepConfig {
+  // the user uniforms of the program, with cur_val as the value of the
+  // components that are not swept
+  vector<UserUnif> user_unifs;
+  vector<SweepDim> dims;
+
+  int design = SWEEP_GRID;
+  int grid_points = 3;
+  int num_samples = 16;
+  unsigned int seed = 1;
+
+  int num_zygote_samples = 100;
+  int num_iters = 100;
+  // stop each run once it converges, with num_iters as the most
+  // iterations (convergence.max_iters is ignored)
+  bool run_to_convergence = false;
+  ConvergenceCriteria convergence;
+  // simulations run concurrently, one per worker thread (0 for one
+  // per core)
+  int num_workers = 0;
+  bool use_simd_kernels = true;
+
+  // the index and the per-run output go here
+  string out_dir = ".";
+  // write each run's final nodes as CSV
+  bool write_run_nodes = true;
+
+  SweepConfig();
+};
+
+// Adds the dims for spec, which is "name" for every component of the
+// uniform or "name.i" for component i. Returns false if there is no
+// such uniform or component.
+bool add_sweep_dims(SweepConfig& config, string const& spec);
+
+// Returns the sample points of the design. Each point has one value in
+// [0, 1] per dim, the position within that dim's range.
+vector<vector<float>> gen_sweep_samples(SweepConfig const& config);
+
+// Runs a simulation for every sample point and writes
+// out_dir/index.csv, with one row per run: its parameter values, sim
+// time, the iterations it ran and output file. Rows are appended as runs finish, so the index
+// of an interrupted sweep is still valid. Returns false if the index
+// could not be written.
+bool run_sweep(SweepConfig const& config);
+
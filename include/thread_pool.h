@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+using namespace std;
+
+// A fixed set of worker threads used to split a loop over [begin, end)
+// into one contiguous range per thread. The calling thread works on the
+// first range itself, so a pool with one thread never spawns any.
+struct ThreadPool {
+  // fn(range_begin, range_end, thread_index)
+  typedef function<void(int, int, int)> RangeFn;
+
+  // num_threads <= 0 uses the hardware concurrency
+  ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int num_threads() const;
+
+  // Runs fn over [begin, end) and returns once every range is done
+  void parallel_for(int begin, int end, RangeFn const& fn);
+
+private:
+  ThreadPool(ThreadPool const&);
+  ThreadPool& operator=(ThreadPool const&);
+
+  void worker_loop(int thread_index);
+  void run_range(int thread_index);
+
+  vector<thread> workers;
+  int thread_count = 1;
+
+  mutex job_mutex;
+  condition_variable job_start;
+  condition_variable job_done;
+  // incremented for every job so that workers can tell jobs apart
+  long job_generation = 0;
+  int ranges_remaining = 0;
+  bool shutting_down = false;
+
+  // the current job
+  RangeFn const* job_fn = nullptr;
+  int job_begin = 0;
+  int job_end = 0;
+};
+
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+// Scoped trace zones, written out as a Chrome trace_event JSON file that
+// chrome://tracing and ui.perfetto.dev can open. MORPH_TRACE_ZONE("name")
+// records the wall time from the macro to the end of the enclosing scope.
+//
+// The zones are only compiled in with the MORPH_TRACING CMake option.
+// Otherwise the macros are empty and cost nothing. Each thread records
+// into its own buffer, so recording takes no lock, and a full buffer
+// overwrites its oldest zones. On x86 the zones are timed with the TSC,
+// which write_trace_json converts to ns against the steady clock, as
+// reading the steady clock takes about as long as the rest of a zone.
+
+// the zones each thread keeps, a power of 2
+const int TRACE_BUFFER_EVENTS = 1 << 16;
+
+struct TraceEvent {
+  // a string literal
+  const char* name = nullptr;
+  // see trace_now_ticks
+  int64_t begin_ticks = 0;
+  int64_t end_ticks = 0;
+};
+
+// The zones of one thread. Only the thread writes events, and
+// write_trace_json only reads the ones published by num_recorded.
+struct TraceBuffer {
+  int thread_index = 0;
+  // TRACE_BUFFER_EVENTS events
+  vector<TraceEvent> events;
+  // the zones ever recorded, the next at num_recorded % TRACE_BUFFER_EVENTS
+  atomic<int64_t> num_recorded;
+  // the zones already written out, only used by write_trace_json
+  int64_t num_written = 0;
+  // false once the thread has exited, so that another can take the buffer
+  atomic<bool> in_use;
+
+  TraceBuffer();
+};
+
+// whether the zones are compiled in
+#ifdef MORPH_TRACING
+const bool TRACING_COMPILED_IN = true;
+#else
+const bool TRACING_COMPILED_IN = false;
+#endif
+
+// Writes the zones recorded since the last call to path. Call it while
+// no other thread is recording, ex. between frames. Returns false, with
+// a warning, if tracing is not compiled in or path could not be written.
+bool write_trace_json(string const& path);
+
+#ifdef MORPH_TRACING
+
+// Registers a buffer for the calling thread on its first zone, which is
+// released when the thread exits
+TraceBuffer* acquire_trace_buffer();
+
+// the buffer of this thread, or null before its first zone
+extern thread_local TraceBuffer* cur_trace_buffer;
+
+// The TSC on x86, otherwise the steady clock in ns
+inline int64_t trace_now_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline void record_trace_event(const char* name, int64_t begin_ticks,
+    int64_t end_ticks) {
+  TraceBuffer* buffer = cur_trace_buffer;
+  if (!buffer) {
+    buffer = acquire_trace_buffer();
+  }
+  int64_t n = buffer->num_recorded.load(memory_order_relaxed);
+  TraceEvent& event = buffer->events[n & (TRACE_BUFFER_EVENTS - 1)];
+  event.name = name;
+  event.begin_ticks = begin_ticks;
+  event.end_ticks = end_ticks;
+  buffer->num_recorded.store(n + 1, memory_order_release);
+}
+
+struct TraceZone {
+  const char* name;
+  int64_t begin_ticks;
+
+  explicit TraceZone(const char* name) :
+    name(name),
+    begin_ticks(trace_now_ticks())
+  {
+  }
+
+  // ends the zone before the end of its scope
+  void end() {
+    if (name) {
+      record_trace_event(name, begin_ticks, trace_now_ticks());
+      name = nullptr;
+    }
+  }
+
+  ~TraceZone() {
+    end();
+  }
+};
+
+#define MORPH_TRACE_CONCAT_(a, b) a##b
+#define MORPH_TRACE_CONCAT(a, b) MORPH_TRACE_CONCAT_(a, b)
+#define MORPH_TRACE_ZONE(name) \
+  TraceZone MORPH_TRACE_CONCAT(trace_zone_, __LINE__)(name)
+// for zones that do not match a scope
+#define MORPH_TRACE_BEGIN(zone, name) TraceZone zone(name)
+#define MORPH_TRACE_END(zone) zone.end()
+
+#else
+
+#define MORPH_TRACE_ZONE(name)
+#define MORPH_TRACE_BEGIN(zone, name)
+#define MORPH_TRACE_END(zone)
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+using namespace std;
+
+// Hands values from one writer thread to one reader thread without a
+// lock. The writer fills write_slot() and publishes it, and the reader
+// takes the newest published value into read_slot(). Neither waits on
+// the other: of the 3 slots, one is the writer's, one the reader's and
+// the third holds the newest published value until either swaps it for
+// their own. Values the reader does not take in time are overwritten.
+template <typename T>
+struct TripleBuffer {
+  TripleBuffer() :
+    write_index(0),
+    read_index(1),
+    middle(2)
+  {
+  }
+
+  // only for the writer, and only valid until the next publish
+  T& write_slot() {
+    return slots[write_index];
+  }
+
+  // Makes the write slot the newest value, and gives the writer the
+  // slot it replaced. The new write slot holds an older value.
+  void publish() {
+    write_index = middle.exchange(write_index | FRESH_BIT,
+        memory_order_acq_rel) & INDEX_MASK;
+  }
+
+  // Moves the newest value, if it was published since the last take, into
+  // the read slot. Returns false, leaving the read slot as it was, if not.
+  bool take() {
+    if (!(middle.load(memory_order_relaxed) & FRESH_BIT)) {
+      return false;
+    }
+    read_index = middle.exchange(read_index, memory_order_acq_rel) &
+      INDEX_MASK;
+    return true;
+  }
+
+  // only for the reader, and only valid until the next take
+  T& read_slot() {
+    return slots[read_index];
+  }
+
+private:
+  TripleBuffer(TripleBuffer const&);
+  TripleBuffer& operator=(TripleBuffer const&);
+
+  // set in middle while it holds a value the reader has not taken
+  static const int FRESH_BIT = 4;
+  static const int INDEX_MASK = 3;
+
+  array<T, 3> slots;
+  int write_index;
+  int read_index;
+  // the index of the third slot, and FRESH_BIT
+  atomic<int> middle;
+};
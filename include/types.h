@@ -1,6 +1,12 @@
 #pragma once
 
 #include "utils.h"
+#include "thread_pool.h"
+
+// only the app (not the core library) depends on GLFW
+struct GLFWwindow;
+// see sim_worker.h, which depends on this file
+struct SimWorker;
 
 struct Camera {
   mat4 cam_to_world = mat4(1.0);
@@ -52,6 +58,11 @@ struct RenderState {
 
   GLuint index_buffer = 0;
   int elem_count = 0;
+  // the zygote size and NodeOrder that the index buffer was
+  // generated for. -1 once spliced nodes (see node_pool.h) have changed
+  // the triangles.
+  int index_zygote_samples = -1;
+  int index_node_order = -1;
   
   RenderState();
 };
@@ -59,23 +70,30 @@ struct RenderState {
 struct MorphNode {
   vec4 pos = vec4(0.0);
   vec4 vel = vec4(0.0);
-  // in order of: {right, upper, left, lower} wrt surface normal
-  vec4 neighbors = vec4(0.0);
+  // node indices in order of: {right, upper, left, lower} wrt
+  // surface normal, -1 if there is no neighbor (the border of the
+  // zygote, which is fixed in place) or -2 for an open edge of a
+  // spliced node (see node_pool.h)
+  ivec4 neighbors = ivec4(-1);
   vec4 data = vec4(0.0);
 
   MorphNode();
-  MorphNode(vec4 pos, vec4 vel, vec4 neighbors, vec4 data);
+  MorphNode(vec4 pos, vec4 vel, ivec4 neighbors, vec4 data);
 };
 
 struct MorphNodes {
   vector<vec4> pos_vec;
   vector<vec4> vel_vec;
-  vector<vec4> neighbors_vec;
+  vector<ivec4> neighbors_vec;
   vector<vec4> data_vec;
 
+  MorphNodes();
   MorphNodes(size_t num_nodes);
   MorphNodes(vector<MorphNode> const& nodes);
   MorphNode node_at(size_t i) const;
+  size_t size() const;
+  void resize(size_t num_nodes);
+  void reserve(size_t num_nodes);
 };
 
 string raw_node_str(MorphNode const& node);
@@ -98,23 +116,272 @@ struct MorphBuffer {
   MorphBuffer();
 };
 
+// These index the CompactBuffer vbos and tex_bufs, see the compact node
+// encoding in growth.glsl
+enum CompactBuffers {
+  COMPACT_BUF_STATE = 0,
+  COMPACT_BUF_DIR_MSG,
+  COMPACT_BUF_NEIGHBORS,
+
+  COMPACT_BUF_COUNT
+};
+
+// The nodes in the compact encoding that the GL backend iterates on if
+// Controls::compact_nodes is set: 40 bytes a node rather than 64
+struct CompactBuffer {
+  GLuint vao = 0;
+  array<GLuint, COMPACT_BUF_COUNT> vbos = {0};
+  array<GLuint, COMPACT_BUF_COUNT> tex_bufs = {0};
+
+  CompactBuffer();
+};
+
 struct MorphProgram {
   string name;
   GLuint gl_handle = 0;
   array<GLint, MORPH_BUF_COUNT> unif_samplers = {0};
   GLint unif_iter_num = -1;
   GLint unif_num_nodes = -1;
+  GLint unif_flux_sampler = -1;
   vector<UserUnif> user_unifs;
 
+  // The flux pre-pass: the same source compiled with FLUX_PASS defined,
+  // or 0 if the source does not support it. flux_unif_handles holds
+  // the location of each of user_unifs in this program.
+  GLuint flux_gl_handle = 0;
+  vector<GLint> flux_unif_handles;
+
+  // The compact encoding: the source compiled for the CompactBuffers, or
+  // 0 if it does not support them. compact_gl_handle runs an iteration
+  // and compact_flux_gl_handle its flux pass, encode_gl_handle and
+  // decode_gl_handle convert the nodes between the encodings. The unif
+  // handles are as for flux_unif_handles.
+  GLuint compact_gl_handle = 0;
+  GLuint compact_flux_gl_handle = 0;
+  GLuint encode_gl_handle = 0;
+  GLuint decode_gl_handle = 0;
+  vector<GLint> compact_unif_handles;
+  vector<GLint> compact_flux_unif_handles;
+  GLint compact_unif_iter_num = -1;
+  GLint compact_unif_num_nodes = -1;
+
   MorphProgram(string name, vector<UserUnif>& user_unifs);
 };
 
+// Where the simulation is run
+enum SimBackend {
+  SIM_BACKEND_GL = 0,
+  SIM_BACKEND_CPU,
+
+  SIM_BACKEND_COUNT
+};
+
+// The order of the nodes in memory. gen_morph_data lays the zygote out
+// row-major, so the upper and lower neighbors of a node are a full row
+// apart. The other orders keep the neighbors of most nodes close by.
+// See node_order.h.
+enum NodeOrder {
+  NODE_ORDER_ROW_MAJOR = 0,
+  // Z-order curve over the zygote grid
+  NODE_ORDER_MORTON,
+  NODE_ORDER_HILBERT,
+  // reverse Cuthill-McKee, from the neighbor graph alone
+  NODE_ORDER_RCM,
+  // NODE_TILE_SIZE x NODE_TILE_SIZE tiles, see NodeTiles
+  NODE_ORDER_TILED,
+
+  NODE_ORDER_COUNT
+};
+
+const int NODE_TILE_SIZE = 16;
+
+// The tiles of a zygote in NODE_ORDER_TILED. The nodes of each tile are
+// contiguous, row-major within the tile, and the tiles are in row-major
+// order. Tiles on the right and top edges may be partial.
+struct NodeTiles {
+  ivec2 num_tiles = ivec2(0);
+  // tile t holds nodes [tile_starts[t], tile_starts[t + 1])
+  vector<int> tile_starts;
+  // the {node, neighbor slot} of every edge to a node in another tile,
+  // grouped by tile: the edges of tile t are
+  // [cross_edge_starts[t], cross_edge_starts[t + 1])
+  vector<int> cross_edge_starts;
+  vector<ivec2> cross_edges;
+
+  NodeTiles();
+  int tile_count() const;
+};
+
+// The preallocated nodes that sources can splice into the mesh, and the
+// triangles of the mesh as it grows. See node_pool.h.
+struct NodePool {
+  // the most nodes there can be, 0 if spawning is disabled. Nodes are
+  // allocated from free_nodes first, then from the end of the node arrays.
+  int capacity = 0;
+  vector<int> free_nodes;
+  // the splice requests dropped b/c the pool was full
+  int num_dropped = 0;
+
+  // the triangle indices, as from gen_morph_data, and the triangles
+  // that use each node
+  vector<GLuint> indices;
+  vector<vector<int>> node_tris;
+  // the triangles added or changed since the last take_changed_tris
+  vector<int> changed_tris;
+
+  NodePool();
+};
+
+// The nodes that the CPU backend still updates when
+// Controls::use_active_set is set. A node sleeps once an update leaves it
+// unchanged (to within Controls::active_set_epsilon), and wakes when a
+// node within two edges of it changes or it is promoted to a source. See
+// update_active_set.
+struct ActiveSet {
+  // the nodes to update in the next iteration, in index order
+  vector<int> nodes;
+  // per node, 1 if its last update changed it. Only read for nodes.
+  vector<uint8_t> changed;
+  // per node, 1 while it is being added to the next iteration's set, so
+  // that it is only added once. Cleared once the set is built.
+  vector<uint8_t> wake;
+  // the nodes each thread added to the next set
+  vector<vector<int>> thread_nodes;
+  // whether CpuMorphState::heat_flux holds the flux of every node for the
+  // SIMD kernels, so that only the flux of the set must be recomputed
+  bool heat_flux_valid = false;
+  // the node updates run and skipped by the last run_cpu_simulation
+  long num_updates = 0;
+  long num_skipped = 0;
+
+  ActiveSet();
+};
+
+// Host-side state for the CPU simulation backend. Mirrors the
+// double-buffering of MorphState::buffers.
+struct CpuMorphState {
+  array<MorphNodes, 2> buffers;
+  int result_buffer_index = 0;
+  // the row-major id of each node, see MorphState::node_ids. Empty if
+  // the nodes are in row-major order. Spliced nodes are their own id, so
+  // this may be longer than the node arrays, but not shorter.
+  vector<int> node_ids;
+  // in NODE_ORDER_TILED, each iteration is scheduled a whole tile at a
+  // time. Empty otherwise. Spliced nodes are not in any tile.
+  NodeTiles tiles;
+  NodePool node_pool;
+  // scratch space for the heat emitted by each node, used by the
+  // SIMD kernels
+  vector<vec4> heat_flux;
+  ActiveSet active_set;
+  // recreated when the requested thread count changes
+  unique_ptr<ThreadPool> pool;
+
+  CpuMorphState();
+};
+
+// The seed state of the simulation (before iteration 0) for one zygote
+// size and node order, so that reseeding does not regenerate the zygote.
+// See set_initial_sim_data.
+struct SeedCache {
+  // the zygote size and NodeOrder of the seed, -1 if there is none yet.
+  // gen_morph_data has only the one generator, gen_plane.
+  int zygote_samples = -1;
+  int node_order = -1;
+  // the seed nodes and triangle indices in the node order, and the
+  // node ids and tiles of that order
+  MorphNodes nodes;
+  vector<GLuint> indices;
+  vector<int> node_ids;
+  NodeTiles tiles;
+  // GPU copies of the nodes, which the MorphBuffer VBOs are reseeded
+  // from without an upload
+  array<GLuint, MORPH_BUF_COUNT> vbos = {0};
+
+  SeedCache();
+};
+
+// A snapshot of the simulation state after iter_num iterations
+struct SimCheckpoint {
+  // see checkpoint_key
+  string key;
+  int iter_num = 0;
+  int sim_backend = SIM_BACKEND_GL;
+  int num_nodes = 0;
+  // GL backend: copies of the MorphBuffer VBOs
+  array<GLuint, MORPH_BUF_COUNT> vbos = {0};
+  // CPU backend: a copy of the CPU buffer and node pool
+  MorphNodes nodes;
+  NodePool node_pool;
+  size_t num_bytes = 0;
+  // the CheckpointCache::use_count of the last lookup, for LRU eviction
+  uint64_t last_use = 0;
+
+  SimCheckpoint();
+};
+
+struct CheckpointCache {
+  vector<SimCheckpoint> checkpoints;
+  // the total size of the checkpoints
+  size_t num_bytes = 0;
+  size_t budget_bytes = 0;
+  uint64_t use_count = 0;
+
+  CheckpointCache();
+};
+
+// A resumable simulation. The state after iter_num iterations is in
+// buffers[iter_num & 1] of the backend (the CPU buffers for the CPU
+// backend).
+struct SimSession {
+  bool is_valid = false;
+  // the checkpoint_key of the program, uniforms and zygote size that
+  // the session was started with. The session is stale once the current
+  // key differs.
+  string key;
+  int iter_num = 0;
+
+  SimSession();
+};
+
+// How much the nodes changed over some iterations, see
+// compute_cpu_residual
+struct SimResidual {
+  // the largest and the mean distance that a node moved
+  float max_disp = 0.0f;
+  float mean_disp = 0.0f;
+  // the total absolute change in the heat of the nodes
+  float heat_change = 0.0f;
+  // the nodes that were spliced in, which are not in the above
+  int num_new_nodes = 0;
+
+  SimResidual();
+};
+
+// When a run to convergence stops, see run_cpu_to_convergence
+struct ConvergenceCriteria {
+  // the residual is measured over this many iterations at a time
+  int check_interval = 10;
+  // converged once no node moves more than disp_tol and the total heat
+  // changes by no more than heat_tol over one check_interval, and no
+  // nodes were spliced in
+  float disp_tol = 1e-4f;
+  float heat_tol = 1e-3f;
+  // the iteration to stop at if it never converges
+  int max_iters = 100000;
+
+  ConvergenceCriteria();
+};
+
 struct MorphState {
   // for double-buffering
   array<MorphBuffer, 2> buffers;
   // set to the index of the buffer that holds
   // the most recent simulation result
   int result_buffer_index = 0;
+  // the buffers that the GL backend iterates on with compact_nodes. They
+  // only hold the nodes within a run_simulation.
+  array<CompactBuffer, 2> compact_buffers;
 
   vector<MorphProgram> programs;
   int cur_prog_index = 0;
@@ -122,9 +389,39 @@ struct MorphState {
   // the number of nodes used in the most recent sim
   int num_nodes = 0;
 
+  // written by the flux pass of each iteration and read by the main
+  // pass, via the texture buffer on texture unit MORPH_BUF_COUNT
+  GLuint flux_vbo = 0;
+  GLuint flux_tex_buf = 0;
+
+  // the row-major id of each node, the permutation from
+  // compute_node_order. Also in node_id_vbo, a static attribute of
+  // both MorphBuffers.
+  vector<int> node_ids;
+  GLuint node_id_vbo = 0;
+
+  CpuMorphState cpu_state;
+  SeedCache seed_cache;
+  CheckpointCache checkpoints;
+  SimSession session;
+
   MorphState();
 };
 
+// The CPU-side phases of a frame of the app, timed by FrameStats
+enum FramePhase {
+  // the sim pipeline, less its uploads
+  FRAME_PHASE_SIM = 0,
+  // writing the seed, checkpoints and CPU results to the GPU buffers
+  FRAME_PHASE_UPLOAD,
+  // render_frame and the clear
+  FRAME_PHASE_RENDER,
+  // building and drawing the dev console, less the sim it runs
+  FRAME_PHASE_UI,
+
+  FRAME_PHASE_COUNT
+};
+
 // User controls 
 struct Controls {
   int target_fps = 30;
@@ -140,6 +437,28 @@ struct Controls {
   bool log_render_data = false;
   bool log_durations = false;
   int num_zygote_samples = 100;
+  int node_order = NODE_ORDER_ROW_MAJOR;
+  // the nodes preallocated for sources to splice into the mesh with the
+  // CPU backend, 0 to disable spawning
+  int node_pool_size = 0;
+  int sim_backend = SIM_BACKEND_GL;
+  // run the GL backend on the compact node encoding, which moves fewer
+  // bytes but rounds the heat, generation rate, source direction and
+  // messages each iteration (see growth.glsl)
+  bool compact_nodes = false;
+  // threads used by the CPU backend, 0 for one per core
+  int num_sim_threads = 0;
+  // use the SIMD kernels in the CPU backend, if the CPU supports them
+  bool use_simd_kernels = true;
+  // only update the nodes of the CPU backend that are still changing (see
+  // ActiveSet). A node is unchanged if its position and heat move by no
+  // more than active_set_epsilon. 0 gives the same result as updating
+  // every node.
+  bool use_active_set = false;
+  float active_set_epsilon = 1e-5f;
+  // run the CPU backend on a SimWorker thread, drawing its newest state
+  // each frame rather than waiting for the target iteration
+  bool background_sim = false;
   // for the simulation/animation pane
   int num_iters = 0;
   bool animating_sim = true;
@@ -147,15 +466,208 @@ struct Controls {
   int start_iter_num = 0;
   int end_iter_num = 10*1000*1000;
   int delta_iters = 0;
+  // snapshot the state every checkpoint_interval iterations so that
+  // scrubbing only reruns the iterations since the nearest one
+  bool use_checkpoints = true;
+  int checkpoint_interval = 100;
+  int checkpoint_budget_mb = 256;
+  // the most GPU memory for the node and index buffers, 0 for no limit.
+  // The GL checkpoint copies are not counted, checkpoint_budget_mb bounds
+  // them.
+  int gpu_budget_mb = 0;
+  // time the GPU passes with GpuTimers, for the dev console
+  bool time_gpu_passes = true;
+  // for the "run to convergence" button
+  ConvergenceCriteria convergence;
+  // for saving and loading binary snapshots
+  array<char, 256> snapshot_path;
+  // for exporting meshes, .ply or .obj
+  array<char, 256> mesh_path;
+  // for saving the trace zones, see trace.h
+  array<char, 256> trace_path;
+  // the ms per frame that each FramePhase should stay within
+  array<float, FRAME_PHASE_COUNT> phase_budgets_ms;
+  // for saving the frame times as CSV
+  array<char, 256> frame_stats_path;
 
   bool cam_spherical_mode = true;
 
   Controls();
 };
 
+// A GL buffer sized by the GpuBuffers that owns it
+struct GpuBuffer {
+  GLuint handle = 0;
+  GLenum usage = GL_STATIC_DRAW;
+  // the size of the storage in bytes
+  size_t capacity = 0;
+  // the texture buffer that views this buffer and its internal format,
+  // or 0. It is re-attached whenever the storage is reallocated.
+  GLuint tex_buf = 0;
+  GLenum tex_format = 0;
+
+  GpuBuffer();
+};
+
+// A buffer to grow with reserve_gpu_buffers, see reserve_gpu_buffer
+struct GpuBufferReserve {
+  GLuint buffer = 0;
+  size_t num_bytes = 0;
+  size_t keep_bytes = 0;
+
+  GpuBufferReserve(GLuint buffer, size_t num_bytes, size_t keep_bytes);
+};
+
+// Tracks the GL buffers whose storage is sized to what they hold, see
+// gpu_buffers.h
+struct GpuBuffers {
+  vector<GpuBuffer> buffers;
+  // the total storage of the buffers, now and at most
+  size_t cur_bytes = 0;
+  size_t peak_bytes = 0;
+  // the most storage the buffers may have in total, 0 for no limit
+  size_t budget_bytes = 0;
+  int num_reallocs = 0;
+
+  GpuBuffers();
+};
+
+// The GL state of the residual reduction of the GL backend. Each pass is
+// a transform feedback draw in which vertex i reduces a group of the
+// inputs to one partial residual, until one is left.
+struct GpuResidual {
+  GLuint prog = 0;
+  GLint unif_num_inputs = -1;
+  GLint unif_first_pass = -1;
+  GLuint vao = 0;
+  // the node positions at the last check, read by the first pass
+  GLuint prev_pos_vbo = 0;
+  GLuint prev_pos_tex_buf = 0;
+  // the partials written by each pass and read by the next
+  array<GLuint, 2> partial_vbos = {0};
+  array<GLuint, 2> partial_tex_bufs = {0};
+
+  GpuResidual();
+};
+
+// The GPU passes timed by GpuTimers
+enum GpuPass {
+  // the transform feedback draws of the GL backend
+  GPU_PASS_FLUX = 0,
+  GPU_PASS_SIM,
+  // the conversions to and from the compact encoding
+  GPU_PASS_CODEC,
+  GPU_PASS_RESIDUAL,
+  // the draws of render_frame
+  GPU_PASS_FACES,
+  GPU_PASS_WIREFRAME,
+  GPU_PASS_POINTS,
+
+  GPU_PASS_COUNT
+};
+
+// the frames that the GPU pass times are averaged over
+const int GPU_TIMER_HISTORY = 60;
+
+// The GL_TIME_ELAPSED queries issued in one frame
+struct GpuTimerFrame {
+  int frame_num = 0;
+  // the steady clock time at which the frame began, in ms
+  double begin_ms = 0.0;
+  // the queries and the pass that each timed
+  vector<GLuint> queries;
+  vector<int> passes;
+  // the passes that were not timed as too many queries were in flight
+  int num_untimed = 0;
+
+  GpuTimerFrame();
+};
+
+// Times the GPU passes with a ring of GL_TIME_ELAPSED queries. The
+// results of a frame are collected a few frames later, once they are
+// available, so that reading them never stalls. See gpu_timers.h.
+struct GpuTimers {
+  bool enabled = true;
+  int frame_num = 0;
+  // the queries whose results have been collected, for reuse
+  vector<GLuint> free_queries;
+  // the frames whose results have not been collected, oldest first. The
+  // last is the current frame.
+  vector<GpuTimerFrame> frames;
+  int num_in_flight = 0;
+  // the pass of the query that has begun but not ended, or -1. GL allows
+  // one GL_TIME_ELAPSED query at a time.
+  int active_pass = -1;
+  // per pass, the ms of each of the last GPU_TIMER_HISTORY collected
+  // frames. Frame f is at f % GPU_TIMER_HISTORY.
+  array<array<float, GPU_TIMER_HISTORY>, GPU_PASS_COUNT> history_ms;
+  int num_collected = 0;
+  // the num_untimed of the last collected frame
+  int last_num_untimed = 0;
+  // the frames whose results were dropped as impossible
+  int num_dropped = 0;
+
+  GpuTimers();
+};
+
+// The series of FrameTimes: the phases, then these
+const int FRAME_SERIES_WORK = FRAME_PHASE_COUNT;
+const int FRAME_SERIES_INTERVAL = FRAME_PHASE_COUNT + 1;
+const int FRAME_SERIES_COUNT = FRAME_PHASE_COUNT + 2;
+
+// the frames that FrameStats keeps
+const int FRAME_STATS_WINDOW = 600;
+
+// The times of one frame in ms
+struct FrameTimes {
+  int frame_num = 0;
+  // the phases, the work (the frame less the swap and the pacing sleep)
+  // and the interval from the start of the frame to the next
+  array<float, FRAME_SERIES_COUNT> ms;
+
+  FrameTimes();
+};
+
+// The times of the last FRAME_STATS_WINDOW frames, see frame_stats.h
+struct FrameStats {
+  // frame f is at f % FRAME_STATS_WINDOW
+  vector<FrameTimes> frames;
+  int num_frames = 0;
+  // the frame being timed, if frame_open
+  bool frame_open = false;
+  FrameTimes cur_frame;
+  double frame_begin_ms = 0.0;
+  // the phase being timed, or -1, and when it began
+  int cur_phase = -1;
+  double phase_begin_ms = 0.0;
+
+  FrameStats();
+};
+
+// The app's side of Controls::background_sim, see sim_worker.h
+struct BackgroundSim {
+  // created when background_sim is turned on and destroyed when it is
+  // turned off, which stops the thread
+  unique_ptr<SimWorker> worker;
+  // the key and target of the last request submitted
+  string key;
+  int target_iter = -1;
+  // the iteration and topology_version of the uploaded state, -1 if none
+  int iter_num = -1;
+  int topology_version = -1;
+
+  BackgroundSim();
+  ~BackgroundSim();
+};
+
 struct GraphicsState {
   RenderState render_state;
   MorphState morph_state;
+  GpuBuffers gpu_buffers;
+  GpuResidual gpu_residual;
+  GpuTimers gpu_timers;
+  FrameStats frame_stats;
+  BackgroundSim background_sim;
 
   string base_shader_path;
   GLFWwindow* window;
@@ -3,6 +3,7 @@
 #include <vector>
 #include <array>
 #include <string>
+#include <memory>
 
 #include <cstddef>
 #include <stdlib.h>
@@ -11,7 +12,6 @@
 #include <unistd.h>
 
 #include <glad/glad.h>
-#include <GLFW/glfw3.h>
 #define GLM_ENABLE_EXPERIMENTAL
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
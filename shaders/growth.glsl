@@ -9,6 +9,8 @@ force_coeffs comps 3 min 0.0 max 3.0 speed 0.01 default 0.0 0.25 0.25
 src_trans_probs comps 3 min 0.0 max 1.0 speed 0.001 default 0.05 0.45 0.0
 cloning_coeffs comps 3 min 0.0 max 1.0 speed 0.005 default 1.0 1.0 0.5
 cloning_interval comps 1 min 0.0 max 600.0 speed 0.1 default 40.0
+noise_seed comps 1 min 0.0 max 1000.0 speed 1.0 default 0.0
+spawn_prob comps 1 min 0.0 max 1.0 speed 0.001 default 0.0
 END_USER_UNIFS
 
 #version 410
@@ -28,80 +30,327 @@ uniform vec4 force_coeffs;
 uniform vec4 src_trans_probs;
 uniform vec4 cloning_coeffs;
 uniform vec4 cloning_interval;
+uniform vec4 noise_seed;
+uniform vec4 spawn_prob;
 
 // use explicit locations so that these attributes in 
 // different programs explicitly use the same attribute indices
+#ifdef COMPACT_INPUTS
+// the compact encoding (see the helpers below), decoded into pos, vel and
+// data by decode_inputs. state holds the bits of pos.xyz and the packed
+// heat and generation rate, dir_msg the packed direction and message.
+layout (location = 0) in uvec4 in_state;
+layout (location = 1) in uvec2 in_dir_msg;
+#else
 layout (location = 0) in vec4 pos;
 layout (location = 1) in vec4 vel;
-// right, up, left, down
-layout (location = 2) in vec4 neighbors;
+#endif
+// right, up, left, down. -1 is the border of the zygote, -2 an open edge
+// of a spliced node (see node_pool.h)
+layout (location = 2) in ivec4 neighbors;
+#ifndef COMPACT_INPUTS
 layout (location = 3) in vec4 data;
-
+#endif
+// the row-major index of this node, which differs from gl_VertexID if
+// the nodes were reordered (see node_order.h). Constant over the sim.
+layout (location = 4) in int node_id;
+
+#ifdef COMPACT_INPUTS
+uniform usamplerBuffer state_buf;
+uniform usamplerBuffer dir_msg_buf;
+#else
 uniform samplerBuffer pos_buf;
 uniform samplerBuffer vel_buf;
-uniform samplerBuffer neighbors_buf;
+#endif
+uniform isamplerBuffer neighbors_buf;
+#ifndef COMPACT_INPUTS
 uniform samplerBuffer data_buf;
-
+#endif
+// the heat each node emits along each of its edges, written by the
+// flux pass (this file compiled with FLUX_PASS defined)
+uniform samplerBuffer flux_buf;
+
+#ifdef COMPACT_OUTPUTS
+flat out uvec4 out_state;
+flat out uvec2 out_dir_msg;
+#else
 out vec4 out_pos;
 out vec4 out_vel;
-out vec4 out_neighbors;
 out vec4 out_data;
+#endif
+flat out ivec4 out_neighbors;
+#ifdef FLUX_PASS
+out vec4 out_flux;
+#endif
+
+#ifdef COMPACT_INPUTS
+vec4 pos;
+vec4 vel;
+vec4 data;
+#endif
+
+// the position of each neighbor, fetched once per invocation by
+// gather_neighbors. Undefined for missing neighbors.
+vec4 n_pos[4];
 
 const float pi = 3.141592;
 
+// a source sets data.w to SPLICE_MSG_BASE + i to request that a new node
+// be spliced into its edge i. Only the CPU backend acts on it.
+const int SPLICE_MSG_BASE = 4;
+
 // Noise functions
 
-vec2 hash2(vec2 p) { p=vec2(dot(p,vec2(127.1,311.7)),dot(p,vec2(269.5,183.3))); return fract(sin(p)*18.5453); }
-vec3 hash3(float n) { return fract(sin(vec3(n,n+1.0,n+2.0))*vec3(338.5453123,278.1459123,191.1234)); }
-float hash(vec2 p) {
-	return fract(dot(hash2(p),vec2(1.0,0.0)));
+// Philox4x32-7, a counter-based generator. Mirrors include/philox.h, keep
+// the two in sync.
+const uint PHILOX_M0 = 0xD2511F53u;
+const uint PHILOX_M1 = 0xCD9E8D57u;
+const uint PHILOX_W0 = 0x9E3779B9u;
+const uint PHILOX_W1 = 0xBB67AE85u;
+const int PHILOX_ROUNDS = 7;
+
+// see NoiseStream
+const uint NOISE_STREAM_SOURCE_TRANSITION = 0u;
+const uint NOISE_STREAM_NEIGHBOR = 1u;
+
+uvec4 philox4x32(uvec4 ctr, uint seed) {
+  uvec2 key = uvec2(seed, 0u);
+  for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+    if (r > 0) {
+      key += uvec2(PHILOX_W0, PHILOX_W1);
+    }
+    uint hi0, lo0, hi1, lo1;
+    umulExtended(PHILOX_M0, ctr.x, hi0, lo0);
+    umulExtended(PHILOX_M1, ctr.z, hi1, lo1);
+    ctr = uvec4(hi1 ^ ctr.y ^ key.x, lo1, hi0 ^ ctr.w ^ key.y, lo0);
+  }
+  return ctr;
+}
+
+// 4 uniform values in [0, 1) for this node, iteration and stream
+vec4 node_noise(uint stream) {
+  uint seed = uint(max(noise_seed.x, 0.0));
+  uvec4 ctr = philox4x32(
+      uvec4(uint(node_id), uint(iter_num), stream, 0u), seed);
+  // the top 24 bits, which convert to float exactly
+  return vec4(ctr >> 8u) * (1.0 / 16777216.0);
+}
+
+// The compact node encoding of the GL backend (see Controls::compact_nodes):
+// 40 bytes a node rather than 64. The position and neighbors keep their
+// full width, the heat and generation rate are halves, the direction of a
+// source is octahedral-encoded and the data message is packed into one
+// word. GLSL 4.10 has no packHalf2x16, so the halves are converted by hand.
+// A decoded node encodes to the same bits, so a run does not depend on
+// where it is split.
+
+const int DIR_OCT_BITS = 16;
+const int MSG_OCT_BITS = 9;
+
+// rounds to the nearest even and saturates to +-65504
+uint float_to_half(float f) {
+  uint x = floatBitsToUint(f);
+  uint sign = (x >> 16u) & 0x8000u;
+  uint abs_x = x & 0x7fffffffu;
+  if (abs_x > 0x7f800000u) {
+    return sign | 0x7e00u;
+  }
+  if (abs_x >= 0x477fe000u) {
+    return sign | 0x7bffu;
+  }
+  if (abs_x >= 0x38800000u) {
+    uint rounded = abs_x + 0xfffu + ((abs_x >> 13u) & 1u);
+    return sign | ((rounded - 0x38000000u) >> 13u);
+  }
+  if (abs_x < 0x33000000u) {
+    return sign;
+  }
+  uint mant = (abs_x & 0x7fffffu) | 0x800000u;
+  uint shift = 126u - (abs_x >> 23u);
+  uint h = mant >> shift;
+  uint rem = mant & ((1u << shift) - 1u);
+  uint half_way = 1u << (shift - 1u);
+  if (rem > half_way || (rem == half_way && (h & 1u) != 0u)) {
+    ++h;
+  }
+  return sign | h;
 }
-vec3 hash3(vec3 p) {
-	p=vec3(dot(p,vec3(127.1,311.7,732.1)),dot(p,vec3(269.5,183.3,23.1)),dot(p,vec3(893.1,21.4,781.2))); return fract(sin(p)*18.5453);	
+
+float half_to_float(uint h) {
+  uint exp = h & 0x7c00u;
+  float subnormal = float(h & 0x3ffu) * (1.0 / 16777216.0);
+  uint x = ((h & 0x7fffu) << 13u) + 0x38000000u;
+  x += exp == 0x7c00u ? 0x38000000u : 0u;
+  float f = exp == 0u ? subnormal : uintBitsToFloat(x);
+  return uintBitsToFloat(floatBitsToUint(f) | ((h & 0x8000u) << 16u));
+}
+
+uint pack_snorm(float v, int bits) {
+  float scale = float((1 << (bits - 1)) - 1);
+  // round half away from zero, as roundf
+  float r = clamp(v, -1.0, 1.0) * scale;
+  int q = int(sign(r) * floor(abs(r) + 0.5));
+  return uint(q) & ((1u << uint(bits)) - 1u);
 }
-float hash3to1(vec3 p) {
-	return fract(dot(hash3(p),vec3(32.32,321.3,123.2)));
+
+float unpack_snorm(uint q, int bits) {
+  float scale = float((1 << (bits - 1)) - 1);
+  int v = int(q << uint(32 - bits)) >> (32 - bits);
+  return max(float(v) / scale, -1.0);
+}
+
+vec2 sign_not_zero(vec2 v) {
+  return vec2(v.x < 0.0 ? -1.0 : 1.0, v.y < 0.0 ? -1.0 : 1.0);
+}
+
+uint pack_oct(vec3 dir, int bits) {
+  float l1 = abs(dir.x) + abs(dir.y) + abs(dir.z);
+  vec2 e = vec2(0.0);
+  if (l1 > 0.0) {
+    vec3 p = dir / l1;
+    e = p.xy;
+    if (p.z < 0.0) {
+      e = (1.0 - abs(p.yx)) * sign_not_zero(p.xy);
+    }
+  }
+  return pack_snorm(e.x, bits) | (pack_snorm(e.y, bits) << uint(bits));
+}
+
+vec3 unpack_oct(uint q, int bits) {
+  uint mask = (1u << uint(bits)) - 1u;
+  vec2 e = vec2(unpack_snorm(q & mask, bits),
+      unpack_snorm((q >> uint(bits)) & mask, bits));
+  vec3 p = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  if (p.z < 0.0) {
+    p.xy = (1.0 - abs(e.yx)) * sign_not_zero(e);
+  }
+  return normalize(p);
+}
+
+uint pack_heat_rate(float heat, float rate) {
+  return float_to_half(heat) | (float_to_half(rate) << 16u);
+}
+
+uint pack_message(vec4 msg) {
+  int w = clamp(int(msg.w), -1, 14);
+  uint word = uint(w + 1);
+  if (w >= 0 && w < 4) {
+    uint len_bits = min((float_to_half(length(msg.xyz)) + 16u) >> 5u, 0x3dfu);
+    word |= pack_oct(msg.xyz, MSG_OCT_BITS) << 4u;
+    word |= len_bits << 22u;
+  }
+  return word;
+}
+
+vec4 unpack_message(uint word) {
+  int w = int(word & 0xfu) - 1;
+  if (w < 0 || w >= 4) {
+    return vec4(-1.0, -1.0, -1.0, float(w));
+  }
+  vec3 dir = unpack_oct((word >> 4u) & 0x3ffffu, MSG_OCT_BITS);
+  float len = half_to_float((word >> 22u) << 5u);
+  return vec4(len * dir, float(w));
+}
+
+vec4 unpack_vel(uint heat_rate, uint dir) {
+  float rate = half_to_float(heat_rate >> 16u);
+  if (rate == 0.0) {
+    return vec4(0.0);
+  }
+  return vec4(unpack_oct(dir, DIR_OCT_BITS), rate);
+}
+
+// Bits 0-3 of a packed message are data.w + 1, see pack_message
+int unpack_msg_slot(uint word) {
+  return int(word & 0xfu) - 1;
+}
+
+// the position and heat of node i
+vec4 fetch_pos(int i) {
+#ifdef COMPACT_INPUTS
+  uvec4 state = texelFetch(state_buf, i);
+  return vec4(uintBitsToFloat(state.xyz), half_to_float(state.w & 0xffffu));
+#else
+  return texelFetch(pos_buf, i);
+#endif
+}
+
+// the slot of the message of node i, data.w
+int fetch_msg_slot(int i) {
+#ifdef COMPACT_INPUTS
+  return unpack_msg_slot(texelFetch(dir_msg_buf, i).y);
+#else
+  return int(texelFetch(data_buf, i).w);
+#endif
+}
+
+// the message of node i, data
+vec4 fetch_data(int i) {
+#ifdef COMPACT_INPUTS
+  return unpack_message(texelFetch(dir_msg_buf, i).y);
+#else
+  return texelFetch(data_buf, i);
+#endif
+}
+
+#ifdef COMPACT_INPUTS
+void decode_inputs() {
+  pos = vec4(uintBitsToFloat(in_state.xyz),
+      half_to_float(in_state.w & 0xffffu));
+  vel = unpack_vel(in_state.w, in_dir_msg.x);
+  data = unpack_message(in_dir_msg.y);
+}
+#endif
+
+// Writes the next state of this node, in the encoding of the outputs.
+// The neighbors never change on the GL backend.
+void write_node(vec4 next_pos, vec4 next_vel, vec4 next_data) {
+#ifdef COMPACT_OUTPUTS
+  out_state = uvec4(floatBitsToUint(next_pos.xyz),
+      pack_heat_rate(next_pos.w, next_vel.w));
+  out_dir_msg = uvec2(pack_oct(next_vel.xyz, DIR_OCT_BITS),
+      pack_message(next_data));
+#else
+  out_pos = next_pos;
+  out_vel = next_vel;
+  out_data = next_data;
+#endif
+  out_neighbors = neighbors;
 }
 
 void run_init_iter_test2() {
   int side_len = int(sqrt(num_nodes));
   int target_src_id = int(num_nodes * norm_src_pos.x + 0.25 * side_len);
   int target_src_id_b = int(num_nodes * norm_src_pos.x + 0.75 * side_len);
-  if (gl_VertexID == target_src_id) {
-    out_vel = vec4(vec3(0.0,1.0,0.0), src_heat_gen_rate.x);
-  } else if(gl_VertexID == target_src_id_b) {
-    out_vel = vec4(vec3(0.0,-1.0,0.0), src_heat_gen_rate.x);
-  } else {
-    out_vel = vec4(0.0);
+  vec4 next_vel = vec4(0.0);
+  if (node_id == target_src_id) {
+    next_vel = vec4(vec3(0.0,1.0,0.0), src_heat_gen_rate.x);
+  } else if(node_id == target_src_id_b) {
+    next_vel = vec4(vec3(0.0,-1.0,0.0), src_heat_gen_rate.x);
   }
-  out_pos = vec4(pos.xyz, 0.0);
-  out_neighbors = neighbors;
-  out_data = vec4(-1.0);
+  write_node(vec4(pos.xyz, 0.0), next_vel, vec4(-1.0));
 }
 
 void run_init_iter() {
   int side_len = int(sqrt(num_nodes));
   int target_src_id = int(num_nodes * norm_src_pos.x + 0.5 * side_len);
-  if (gl_VertexID == target_src_id) {
-    out_vel = vec4(normalize(init_src_dir.xyz), src_heat_gen_rate.x);
-  } else {
-    out_vel = vec4(0.0);
+  vec4 next_vel = vec4(0.0);
+  if (node_id == target_src_id) {
+    next_vel = vec4(normalize(init_src_dir.xyz), src_heat_gen_rate.x);
   }
-  out_pos = vec4(pos.xyz, 0.0);
-  out_neighbors = neighbors;
-  out_data = vec4(-1.0);
+  write_node(vec4(pos.xyz, 0.0), next_vel, vec4(-1.0));
 }
 
-vec4 compute_heat_emit(float cur_heat, vec4 node_neighbors) { 
+vec4 compute_heat_emit(float cur_heat, ivec4 node_neighbors) { 
   float alpha = heat_transfer_coeff.x;
   vec4 out_heats = vec4(0.0);
   for (int i = 0; i < 4; ++i) {
-    int n_index = int(node_neighbors[i]);
-    if (n_index == -1.0) {
+    int n_index = node_neighbors[i];
+    if (n_index == -1) {
       // treat exterior as 0-heat neighbor
       out_heats[i] = alpha * cur_heat;
-    } else {
-      float n_heat = texelFetch(pos_buf, n_index).w;
+    } else if (n_index >= 0) {
+      float n_heat = fetch_pos(n_index).w;
       if (n_heat < cur_heat) {
         out_heats[i] = alpha * (cur_heat - n_heat);
       }
@@ -116,28 +365,35 @@ vec4 compute_heat_emit(float cur_heat, vec4 node_neighbors) {
   return out_heats;  
 }
 
+void gather_neighbors() {
+  for (int i = 0; i < 4; ++i) {
+    int n_index = neighbors[i];
+    if (n_index >= 0) {
+      n_pos[i] = fetch_pos(n_index);
+    }
+  }
+}
+
 // Conserves heat and enforces a min heat of 0
 // Note: this strategy works so long as compute_heat_emit conserves
-// heat, which is nice.
+// heat, which is nice. Both ends of an edge read the emitted heat from
+// the same flux_buf texel, so it is conserved exactly.
 // Mental model: at every frame transition you send out heat to neighbors
 // and simultaneously receive heat from them.
 float compute_next_heat() {
-  vec4 my_out_heats = compute_heat_emit(pos.w, neighbors);
+  vec4 my_out_heats = texelFetch(flux_buf, gl_VertexID);
   float total_heat_out = dot(my_out_heats, vec4(1.0));
 
   float total_heat_in = 0.0;
   for (int i = 0; i < 4; ++i) {
-    int n_index = int(neighbors[i]);
-    if (n_index != -1.0) {
-      float other_heat = texelFetch(pos_buf, n_index).w;
-      if (pos.w < other_heat) {
+    int n_index = neighbors[i];
+    if (n_index >= 0) {
+      if (pos.w < n_pos[i].w) {
         // the heat in from this neighbor is the heat that it emits along
-        // the edge pointing to this node
-        vec4 other_neighbors = texelFetch(neighbors_buf, n_index);
-        vec4 other_out_heats = compute_heat_emit(other_heat, other_neighbors);
+        // the edge pointing to this node.
         // i is the index of edge a<->b according to a, and (i + 2) % 4 is
         // the index of edge a<->b according to b
-        total_heat_in += other_out_heats[(i + 2) % 4];
+        total_heat_in += texelFetch(flux_buf, n_index)[(i + 2) % 4];
       }
     }
   }
@@ -145,14 +401,14 @@ float compute_next_heat() {
   return pos.w - total_heat_out + total_heat_in;
 }
 
-vec3 node_normal(vec3 node_pos, vec4 node_neighbors) {
+vec3 node_normal(vec3 node_pos) {
   vec3 nor = vec3(0.0,1.0,0.0);
   for (int i = 0; i < 4; ++i) {
-    int i_a = int(node_neighbors[i]);
-    int i_b = int(node_neighbors[(i + 1) % 4]);
-    if (i_a != -1 && i_b != -1) {
-      vec3 p_a = texelFetch(pos_buf, i_a).xyz;
-      vec3 p_b = texelFetch(pos_buf, i_b).xyz;
+    int i_a = neighbors[i];
+    int i_b = neighbors[(i + 1) % 4];
+    if (i_a >= 0 && i_b >= 0) {
+      vec3 p_a = n_pos[i].xyz;
+      vec3 p_b = n_pos[(i + 1) % 4].xyz;
       // TODO - why is this the 'up' direction, seems like the negative
       // sign should be unneccessary
       nor = normalize(-cross(p_a - node_pos, p_b - node_pos));
@@ -162,11 +418,11 @@ vec3 node_normal(vec3 node_pos, vec4 node_neighbors) {
   return nor;
 }
 
-int rand_neighbor_index(vec3 node_pos, vec4 node_neighbors) {
-  int n_index = clamp(int(4.0 * hash3(iter_num * node_pos).x), 0, 3);
+int rand_neighbor_index(ivec4 node_neighbors) {
+  int n_index = clamp(int(4.0 * node_noise(NOISE_STREAM_NEIGHBOR).x), 0, 3);
   // incr n_index until we find a valid neighbor
   for (int i = 0; i < 4; ++i) {
-    if (node_neighbors[n_index] == -1.0) {
+    if (node_neighbors[n_index] < 0) {
       n_index = (n_index + 1) % 4;
     }
   }
@@ -175,14 +431,13 @@ int rand_neighbor_index(vec3 node_pos, vec4 node_neighbors) {
 
 // Return the index of the neighbor that is furthest in the target direction
 // Note: target_dir must be normalized
-int directed_neighbor(vec3 node_pos, vec4 node_neighbors, vec3 target_dir) {
+int directed_neighbor(vec3 node_pos, vec3 target_dir) {
   int out_index = -1;
   float largest_dot = -2.0;
   for (int i = 0; i < 4; ++i) {
-    int n_index = int(node_neighbors[i]);
-    if (n_index != -1) {
-      vec3 n_pos = texelFetch(pos_buf, n_index).xyz;
-      float d = dot(n_pos - node_pos, target_dir);
+    int n_index = neighbors[i];
+    if (n_index >= 0) {
+      float d = dot(n_pos[i].xyz - node_pos, target_dir);
       if (out_index == -1 || d > largest_dot) {
         out_index = i;
         largest_dot = d;
@@ -196,16 +451,16 @@ void compute_source_transition(out vec4 out_vel, out vec4 out_data) {
   vec4 next_vel = vel;
   vec4 next_data = vec4(-1.0);
 
-  vec3 trans_noise = hash3(pos.xyz * iter_num);
+  vec3 trans_noise = node_noise(NOISE_STREAM_SOURCE_TRANSITION).xyz;
   if (vel.w == 0.0) {
     // check if a neighbor has requested to be cloned
     bool did_promote = false;
     for (int i = 0; i < 4; ++i) {
-      int n_index = int(neighbors[i]);
-      if (n_index != -1) {
-        vec4 n_data = texelFetch(data_buf, n_index);
-        if (int(n_data.w) == (i + 2) % 4) {
+      int n_index = neighbors[i];
+      if (n_index >= 0) {
+        if (fetch_msg_slot(n_index) == (i + 2) % 4) {
           // neighbor has requested that this node be its clone
+          vec4 n_data = fetch_data(n_index);
           float gen_amt = length(n_data.xyz);
           next_vel = vec4(normalize(n_data.xyz), gen_amt);
           next_data = vec4(-1.0);
@@ -216,7 +471,7 @@ void compute_source_transition(out vec4 out_vel, out vec4 out_data) {
 
     // promote this node to a src with some probability
     if (!did_promote && trans_noise.z < src_trans_probs.z) {
-      vec3 nor = node_normal(pos.xyz, neighbors);
+      vec3 nor = node_normal(pos.xyz);
       next_vel = vec4(nor, src_heat_gen_rate.x);
       next_data = vec4(-1.0);
     }
@@ -238,8 +493,8 @@ void compute_source_transition(out vec4 out_vel, out vec4 out_data) {
       vec3 clone_dir = normalize(vel.xyz + tangent_vec);
 
       float clone_gen_amt = cloning_coeffs.y * vel.w;
-      //int target_n = rand_neighbor_index(pos.xyz, neighbors);
-      int target_n = directed_neighbor(pos.xyz, neighbors, clone_dir);
+      //int target_n = rand_neighbor_index(neighbors);
+      int target_n = directed_neighbor(pos.xyz, clone_dir);
       next_vel = vec4(my_dir, cloning_coeffs.x * vel.w);
       next_data = vec4(clone_gen_amt * clone_dir, target_n);
       is_cloning = true;
@@ -250,14 +505,26 @@ void compute_source_transition(out vec4 out_vel, out vec4 out_data) {
     if (!is_cloning && trans_noise.y < src_trans_probs.y) {
       // Note that neighbor could be a src, in which case
       // we effectively eliminate a src.
-      //int target_n = rand_neighbor_index(pos.xyz, neighbors);
-      int target_n = directed_neighbor(pos.xyz, neighbors, vel.xyz);
+      //int target_n = rand_neighbor_index(neighbors);
+      int target_n = directed_neighbor(pos.xyz, vel.xyz);
       next_vel = vec4(0.0);
       next_data = vec4(vel.w * vel.xyz, target_n);
       is_walking = true;
     }
 
-    if (!is_cloning && !is_walking) {
+    // splice a new node into the edge behind this source, so that the
+    // mesh grows rather than only stretching
+    bool is_spawning = false;
+    if (!is_cloning && !is_walking && trans_noise.x < spawn_prob.x) {
+      int target_n = directed_neighbor(pos.xyz, -vel.xyz);
+      if (target_n != -1) {
+        next_vel = vel;
+        next_data = vec4(-1.0, -1.0, -1.0, SPLICE_MSG_BASE + target_n);
+        is_spawning = true;
+      }
+    }
+
+    if (!is_cloning && !is_walking && !is_spawning) {
       // no msg for neighbors
       next_vel = vel;
       next_data = vec4(-1.0);
@@ -274,21 +541,20 @@ vec3 compute_next_pos() {
   vec3 delta_heat = vec3(0.0);
   float largest_delta = 0.0;
   for (int i = 0; i < 4; ++i) {
-    int n_i = int(neighbors[i]);
-    if (n_i != -1) {
-      vec4 n_pos = texelFetch(pos_buf, n_i);
-      vec3 delta_pos = n_pos.xyz - pos.xyz;
+    int n_i = neighbors[i];
+    if (n_i >= 0) {
+      vec3 delta_pos = n_pos[i].xyz - pos.xyz;
       float spring_len = length(delta_pos);
       float spring_factor = spring_len < target_spring_len.x ?
         spring_coeffs.x : spring_coeffs.y;
       force += spring_factor * normalize(delta_pos) *
         (spring_len - target_spring_len.x);
 
-      if (n_pos.w - pos.w > largest_delta) {
-        delta_heat = normalize(n_pos.xyz - pos.xyz);      
-        largest_delta = n_pos.w - pos.w;
+      if (n_pos[i].w - pos.w > largest_delta) {
+        delta_heat = normalize(n_pos[i].xyz - pos.xyz);      
+        largest_delta = n_pos[i].w - pos.w;
       }
-    } else {
+    } else if (n_i == -1) {
       is_fixed = true;
     }
   }
@@ -310,6 +576,7 @@ vec3 compute_next_pos() {
 }
 
 void run_reg_iter() {
+  gather_neighbors();
   vec3 next_pos = compute_next_pos();
   float next_heat = compute_next_heat();
   vec4 next_vel = vec4(0.0);
@@ -320,17 +587,24 @@ void run_reg_iter() {
     next_pos = pos.xyz;
   }
 
-  out_pos = vec4(next_pos, next_heat);
-  out_vel = next_vel;
-  out_neighbors = neighbors;
-  out_data = next_data;
+  write_node(vec4(next_pos, next_heat), next_vel, next_data);
 }
 
 void main() {
+#ifdef COMPACT_INPUTS
+  decode_inputs();
+#endif
+#if defined(FLUX_PASS)
+  out_flux = compute_heat_emit(pos.w, neighbors);
+#elif defined(CODEC_PASS)
+  // converts the node between the encodings of the inputs and outputs
+  write_node(pos, vel, data);
+#else
   if (iter_num == 0) {
     run_init_iter();
   } else {
     run_reg_iter();
   }
+#endif
 }
 
@@ -12,29 +12,29 @@ uniform vec4 point_size;
 
 layout (location = 0) in vec4 vs_pos;
 layout (location = 1) in vec4 vs_vel;
-layout (location = 2) in vec4 vs_neighbors;
+layout (location = 2) in ivec4 vs_neighbors;
 layout (location = 3) in vec4 vs_data;
 
 uniform samplerBuffer pos_buf;
 uniform samplerBuffer vel_buf;
-uniform samplerBuffer neighbors_buf;
+uniform isamplerBuffer neighbors_buf;
 uniform samplerBuffer data_buf;
 
 out vec4 fs_pos;
 out vec4 fs_vel;
-out vec4 fs_neighbors;
+flat out ivec4 fs_neighbors;
 out vec4 fs_data;
 
 out vec3 fs_nor;
 out vec3 fs_col;
 
-vec3 avg_node_normal(vec3 node_pos, vec4 node_neighbors) {
+vec3 avg_node_normal(vec3 node_pos, ivec4 node_neighbors) {
   vec3 avg_nor = vec3(0.0);
   int num_nors = 0;
   for (int i = 0; i < 4; ++i) {
-    int i_a = int(node_neighbors[i]);
-    int i_b = int(node_neighbors[(i + 1) % 4]);
-    if (i_a != -1 && i_b != -1) {
+    int i_a = node_neighbors[i];
+    int i_b = node_neighbors[(i + 1) % 4];
+    if (i_a >= 0 && i_b >= 0) {
       vec3 p_a = texelFetch(pos_buf, i_a).xyz;
       vec3 p_b = texelFetch(pos_buf, i_b).xyz;
       // TODO - why is this the 'up' direction, seems like the negative
@@ -43,7 +43,8 @@ vec3 avg_node_normal(vec3 node_pos, vec4 node_neighbors) {
       num_nors += 1;
     }
   }
-  return avg_nor / num_nors;
+  // spliced nodes may have no pair of adjacent neighbors
+  return num_nors > 0 ? avg_nor / num_nors : vec3(0.0, 1.0, 0.0);
 }
 
 void main() {
@@ -2,11 +2,29 @@
 #include "utils.h"
 #include "types.h"
 #include "dummy_morph_shaders.h"
+#include "residual_shader.h"
+#include "cpu_sim.h"
+#include "checkpoint_cache.h"
+#include "prog_file.h"
+#include "morph_data.h"
+#include "snapshot.h"
+#include "mesh_export.h"
+#include "node_order.h"
+#include "node_pool.h"
+#include "gpu_buffers.h"
+#include "gpu_timers.h"
+#include "trace.h"
+#include "frame_stats.h"
+#include "sim_worker.h"
+#include <GLFW/glfw3.h>
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
 #include <chrono>
+#include <cfloat>
+#include <climits>
+#include <csignal>
 #include <thread>
 #include <utility>
 #include <tuple>
@@ -18,12 +36,8 @@
 using namespace std;
 using namespace glm;
 
-// Size in bytes of the buffers
-// TODO - check later to make sure this is reasonable
-const GLsizeiptr RENDER_INDEX_BUFFER_SIZE = (GLsizeiptr) 1e8;
-
-// The maximum # of morph nodes
-const int MAX_NUM_MORPH_NODES = (int) (1e8 / (float) sizeof(MorphNode));
+// The attribute location of the static node ids, after the MorphBuffers
+const GLuint NODE_ID_LOCATION = MORPH_BUF_COUNT;
 
 // NOTE: you must put the names of your morph and render shaders here
 const vector<string> morph_shader_files = {
@@ -37,8 +51,25 @@ void glfw_error_callback(int error_code, const char* error_msg) {
   printf("GLFW error: %d, %s", error_code, error_msg);
 }
 
-GLuint setup_program(string prog_name,
-    const GLchar* vertex_src, const GLchar* frag_src, bool is_morph_prog) {
+const vector<const char*> morph_varyings = {
+  "out_pos",
+  "out_vel",
+  "out_neighbors",
+  "out_data"
+};
+const vector<const char*> flux_varyings = {
+  "out_flux"
+};
+// in the order of CompactBuffers
+const vector<const char*> compact_varyings = {
+  "out_state",
+  "out_dir_msg",
+  "out_neighbors"
+};
+
+// tf_varyings are the transform feedback outputs, if any
+GLuint setup_program(string prog_name, const GLchar* vertex_src,
+    const GLchar* frag_src, vector<const char*> const& tf_varyings) {
   GLuint program = glCreateProgram();
 
   GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
@@ -54,15 +85,9 @@ GLuint setup_program(string prog_name,
   glAttachShader(program, fragment_shader);
 
   log_gl_errors("before varyings, setup program");
-  if (is_morph_prog) {
-    vector<const char*> varyings = {
-      "out_pos",
-      "out_vel",
-      "out_neighbors",
-      "out_data"
-    };
-    glTransformFeedbackVaryings(program, varyings.size(),
-        varyings.data(), GL_SEPARATE_ATTRIBS);
+  if (!tf_varyings.empty()) {
+    glTransformFeedbackVaryings(program, tf_varyings.size(),
+        tf_varyings.data(), GL_SEPARATE_ATTRIBS);
   }
 
   glLinkProgram(program);
@@ -86,11 +111,116 @@ void setup_user_uniforms(const char* prog_name, GLuint prog, vector<UserUnif>& u
   }
 }
 
+// Returns src with "#define name" inserted after the #version line,
+// which must come first
+string add_shader_define(string const& src, const char* name) {
+  size_t insert_pos = 0;
+  size_t version_pos = src.find("#version");
+  if (version_pos != string::npos) {
+    insert_pos = src.find('\n', version_pos);
+    insert_pos = insert_pos == string::npos ? src.size() : insert_pos + 1;
+  }
+  return src.substr(0, insert_pos) + "#define " + name + "\n" +
+    src.substr(insert_pos);
+}
+
+// Returns the location of each of user_unifs in program, -1 for the ones
+// that it does not use
+vector<GLint> get_user_unif_handles(GLuint program,
+    vector<UserUnif> const& user_unifs) {
+  vector<GLint> handles;
+  for (UserUnif const& user_unif : user_unifs) {
+    handles.push_back(glGetUniformLocation(program, user_unif.name.c_str()));
+  }
+  return handles;
+}
+
+void setup_flux_program(MorphProgram& prog, const char* vertex_src) {
+  if (!strstr(vertex_src, "FLUX_PASS")) {
+    printf("%s: WARNING no flux pass\n", prog.name.c_str());
+    return;
+  }
+  string flux_src = add_shader_define(vertex_src, "FLUX_PASS");
+  prog.flux_gl_handle = setup_program(prog.name + " (flux pass)",
+      flux_src.c_str(), MORPH_DUMMY_FRAGMENT_SRC, flux_varyings);
+
+  // the flux pass uses a subset of the uniforms, so missing ones are fine
+  glUseProgram(prog.flux_gl_handle);
+  prog.flux_unif_handles = get_user_unif_handles(
+      prog.flux_gl_handle, prog.user_unifs);
+  vector<const char*> unif_sampler_names = {
+    "pos_buf", "vel_buf", "neighbors_buf", "data_buf"
+  };
+  for (int i = 0; i < unif_sampler_names.size(); ++i) {
+    GLint sampler = glGetUniformLocation(
+        prog.flux_gl_handle, unif_sampler_names[i]);
+    if (sampler != -1) {
+      glUniform1i(sampler, i);
+    }
+  }
+}
+
+// Points the samplers of a compact program at the CompactBuffer texture
+// units, and flux_buf at the one after the MorphBuffer ones
+void setup_compact_samplers(GLuint program) {
+  vector<const char*> unif_sampler_names = {
+    "state_buf", "dir_msg_buf", "neighbors_buf"
+  };
+  for (int i = 0; i < unif_sampler_names.size(); ++i) {
+    GLint sampler = glGetUniformLocation(program, unif_sampler_names[i]);
+    if (sampler != -1) {
+      glUniform1i(sampler, i);
+    }
+  }
+  GLint flux_sampler = glGetUniformLocation(program, "flux_buf");
+  if (flux_sampler != -1) {
+    glUniform1i(flux_sampler, MORPH_BUF_COUNT);
+  }
+}
+
+// Sets up the programs of the compact node encoding, if the source
+// supports it: COMPACT_INPUTS and COMPACT_OUTPUTS select the encoding of
+// the attributes and of the transform feedback outputs.
+void setup_compact_programs(MorphProgram& prog, const char* vertex_src) {
+  if (!strstr(vertex_src, "COMPACT_INPUTS") || prog.flux_gl_handle == 0) {
+    return;
+  }
+  string in_src = add_shader_define(vertex_src, "COMPACT_INPUTS");
+  string sim_src = add_shader_define(in_src, "COMPACT_OUTPUTS");
+  string flux_src = add_shader_define(in_src, "FLUX_PASS");
+  string encode_src = add_shader_define(
+      add_shader_define(vertex_src, "COMPACT_OUTPUTS"), "CODEC_PASS");
+  string decode_src = add_shader_define(in_src, "CODEC_PASS");
+  prog.compact_gl_handle = setup_program(prog.name + " (compact)",
+      sim_src.c_str(), MORPH_DUMMY_FRAGMENT_SRC, compact_varyings);
+  prog.compact_flux_gl_handle = setup_program(
+      prog.name + " (compact flux pass)", flux_src.c_str(),
+      MORPH_DUMMY_FRAGMENT_SRC, flux_varyings);
+  prog.encode_gl_handle = setup_program(prog.name + " (encode)",
+      encode_src.c_str(), MORPH_DUMMY_FRAGMENT_SRC, compact_varyings);
+  prog.decode_gl_handle = setup_program(prog.name + " (decode)",
+      decode_src.c_str(), MORPH_DUMMY_FRAGMENT_SRC, morph_varyings);
+
+  glUseProgram(prog.compact_gl_handle);
+  prog.compact_unif_handles = get_user_unif_handles(
+      prog.compact_gl_handle, prog.user_unifs);
+  prog.compact_unif_iter_num = glGetUniformLocation(
+      prog.compact_gl_handle, "iter_num");
+  prog.compact_unif_num_nodes = glGetUniformLocation(
+      prog.compact_gl_handle, "num_nodes");
+  setup_compact_samplers(prog.compact_gl_handle);
+
+  glUseProgram(prog.compact_flux_gl_handle);
+  prog.compact_flux_unif_handles = get_user_unif_handles(
+      prog.compact_flux_gl_handle, prog.user_unifs);
+  setup_compact_samplers(prog.compact_flux_gl_handle);
+}
+
 void add_morph_program(MorphState& m_state, const char* prog_name,
     const char* vertex_src, vector<UserUnif>& user_unifs) {
   MorphProgram prog(prog_name, user_unifs);
   prog.gl_handle = setup_program(
-      prog_name, vertex_src, MORPH_DUMMY_FRAGMENT_SRC, true);
+      prog_name, vertex_src, MORPH_DUMMY_FRAGMENT_SRC, morph_varyings);
   
   // Note: we do not need to get the input attribute locations
   // b/c they are explicit in each program
@@ -127,6 +257,15 @@ void add_morph_program(MorphState& m_state, const char* prog_name,
           unif_sampler_names[i]);
     }
   }  
+  // the flux texture buffer is bound after the MorphBuffer ones
+  prog.unif_flux_sampler = glGetUniformLocation(
+      prog.gl_handle, "flux_buf");
+  if (prog.unif_flux_sampler != -1) {
+    glUniform1i(prog.unif_flux_sampler, MORPH_BUF_COUNT);
+  }
+
+  setup_flux_program(prog, vertex_src);
+  setup_compact_programs(prog, vertex_src);
 
   // add the program or replace it if it already exists
   bool existing_prog = false;
@@ -146,7 +285,7 @@ void set_render_program(RenderState& r_state, const char* prog_name,
     const char* vertex_src, const char* frag_src, vector<UserUnif>& user_unifs) {
   RenderProgram prog(prog_name, user_unifs);
   prog.gl_handle = setup_program(
-      prog_name, vertex_src, frag_src, false);
+      prog_name, vertex_src, frag_src, {});
 
   // setup uniforms
   glUseProgram(prog.gl_handle);
@@ -170,55 +309,6 @@ void set_render_program(RenderState& r_state, const char* prog_name,
   r_state.prog = prog;
 }
 
-void read_prog_file(string prog_filename,
-    string& out_prog_text, vector<UserUnif>& out_user_unifs) {
-  FILE* prog_file = fopen(prog_filename.c_str(), "r");
-  if (!prog_file) {
-    printf("WARNING shader file not found at the path:\n%s\n", prog_filename.c_str());
-  }
-  // read user defined uniforms from the file header
-  vector<UserUnif> user_unifs;
-  while (true) {
-    array<char, 100> unif_name;
-    int num_comps = 0;
-    float min = 0.0;
-    float max = 1.0;
-    float drag_speed = 1.0;
-    vec4 def_val(0.0);
-
-    int num_read = fscanf(prog_file, "%s", unif_name.data());
-    assert(num_read == 1);
-    if (strcmp(unif_name.data(), "END_USER_UNIFS") == 0) {
-      break;    
-    }
-    num_read = fscanf(prog_file,
-        " comps %d min %f max %f speed %f default ",
-        &num_comps, &min, &max, &drag_speed);
-    assert(num_read == 4);
-    for (int i = 0; i < num_comps; ++i) {
-      num_read = fscanf(prog_file, "%f", &def_val[i]);
-      assert(num_read == 1);
-    }
-    UserUnif unif(unif_name.data(), num_comps,
-        min, max, drag_speed, def_val, def_val);
-    user_unifs.push_back(unif);
-  }
-  // read the GLSL text
-  long start_pos = ftell(prog_file);
-  fseek(prog_file, 0, SEEK_END);
-  long glsl_len = ftell(prog_file) - start_pos;
-  fseek(prog_file, start_pos, SEEK_SET);
-  array<char, 100000> prog_buf;
-  assert(glsl_len < prog_buf.size());
-  int bytes_read = fread(prog_buf.data(), 1, glsl_len, prog_file);
-  fclose(prog_file);
-  assert(bytes_read == glsl_len);
-  prog_buf[glsl_len] = '\0';
-
-  out_prog_text = string(prog_buf.data());
-  out_user_unifs = user_unifs;
-}
-
 void load_render_program(GraphicsState& g_state) {
   // Note that the user must specify all tunable unifs in the vertex
   // source file. The ones in the fragment file will be disregarded.
@@ -251,6 +341,9 @@ void load_morph_program(GraphicsState& g_state, string prog_name) {
 void reload_current_programs(GraphicsState& g_state) {
   // reload the current morph program and the render program
   MorphState& m_state = g_state.morph_state;
+  // the program text may have changed, which the keys do not capture
+  clear_checkpoints(m_state.checkpoints);
+  m_state.session.is_valid = false;
   MorphProgram& cur_prog = m_state.programs[m_state.cur_prog_index];
   load_morph_program(g_state, cur_prog.name);
 
@@ -258,6 +351,8 @@ void reload_current_programs(GraphicsState& g_state) {
 }
 
 void load_all_morph_programs(GraphicsState& g_state) {
+  clear_checkpoints(g_state.morph_state.checkpoints);
+  g_state.morph_state.session.is_valid = false;
   g_state.morph_state.programs.clear();
   for (string prog_name : morph_shader_files) {
     load_morph_program(g_state, prog_name);    
@@ -281,15 +376,20 @@ void init_morph_state(GraphicsState& g_state) {
     vector<tuple<int, int, GLenum, bool>> vbo_params = {
       {sizeof(vec4), 4, GL_FLOAT, false},
       {sizeof(vec4), 4, GL_FLOAT, false},
+      {sizeof(ivec4), 4, GL_INT, true},
       {sizeof(vec4), 4, GL_FLOAT, false},
-      {sizeof(vec4), 4, GL_FLOAT, false},
     };
-    glGenBuffers(m_buf.vbos.size(), m_buf.vbos.data());
+    // the buffers start out empty, see reserve_morph_nodes, and each is
+    // viewed by a texture buffer
+    glGenTextures(m_buf.tex_bufs.size(), m_buf.tex_bufs.data());
+    vector<GLenum> internal_formats = {
+      GL_RGBA32F, GL_RGBA32F, GL_RGBA32I, GL_RGBA32F
+    };
     for (int i = 0; i < m_buf.vbos.size(); ++i) {
       auto& params = vbo_params[i];
+      m_buf.vbos[i] = create_gpu_buffer(g_state.gpu_buffers, GL_DYNAMIC_COPY,
+          m_buf.tex_bufs[i], internal_formats[i]);
       glBindBuffer(GL_ARRAY_BUFFER, m_buf.vbos[i]);
-      glBufferData(GL_ARRAY_BUFFER,
-          MAX_NUM_MORPH_NODES * get<0>(params), nullptr, GL_DYNAMIC_COPY);
 
       // Note that we only need to setup these attributes once for each VAO
       // b/c their locations are explicitly the same in each program
@@ -302,17 +402,73 @@ void init_morph_state(GraphicsState& g_state) {
       }
       glEnableVertexAttribArray(i);
     }
+  }
 
-    // setup texture buffers
-    glGenTextures(m_buf.tex_bufs.size(), m_buf.tex_bufs.data());
-    vector<GLenum> internal_formats = {
-      GL_RGBA32F, GL_RGBA32F, GL_RGBA32F, GL_RGBA32F
+  // the flux buffer is only read within an iteration, so one is shared
+  // by both MorphBuffers
+  glGenTextures(1, &m_state.flux_tex_buf);
+  m_state.flux_vbo = create_gpu_buffer(g_state.gpu_buffers, GL_DYNAMIC_COPY,
+      m_state.flux_tex_buf, GL_RGBA32F);
+
+  // the compact buffers have integer attributes at the locations of
+  // pos, vel and neighbors, see growth.glsl
+  for (CompactBuffer& c_buf : m_state.compact_buffers) {
+    glGenVertexArrays(1, &c_buf.vao);
+    glBindVertexArray(c_buf.vao);
+    // each tuple is {components per element, component type, internal
+    // format}
+    vector<tuple<int, GLenum, GLenum>> vbo_params = {
+      {4, GL_UNSIGNED_INT, GL_RGBA32UI},
+      {2, GL_UNSIGNED_INT, GL_RG32UI},
+      {4, GL_INT, GL_RGBA32I},
     };
-    for (int i = 0; i < m_buf.tex_bufs.size(); ++i) {
-      glBindTexture(GL_TEXTURE_BUFFER, m_buf.tex_bufs[i]);
-      glTexBuffer(GL_TEXTURE_BUFFER, internal_formats[i], m_buf.vbos[i]);
+    glGenTextures(c_buf.tex_bufs.size(), c_buf.tex_bufs.data());
+    for (int i = 0; i < c_buf.vbos.size(); ++i) {
+      auto& params = vbo_params[i];
+      c_buf.vbos[i] = create_gpu_buffer(g_state.gpu_buffers, GL_DYNAMIC_COPY,
+          c_buf.tex_bufs[i], get<2>(params));
+      glBindBuffer(GL_ARRAY_BUFFER, c_buf.vbos[i]);
+      glVertexAttribIPointer(i, get<0>(params), get<1>(params), 0, nullptr);
+      glEnableVertexAttribArray(i);
     }
   }
+
+  // the node ids never change, so one buffer is an attribute of both
+  m_state.node_id_vbo = create_gpu_buffer(g_state.gpu_buffers,
+      GL_STATIC_DRAW);
+  vector<GLuint> vaos = {
+    m_state.buffers[0].vao, m_state.buffers[1].vao,
+    m_state.compact_buffers[0].vao, m_state.compact_buffers[1].vao
+  };
+  for (GLuint vao : vaos) {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_state.node_id_vbo);
+    glVertexAttribIPointer(NODE_ID_LOCATION, 1, GL_INT, 0, nullptr);
+    glEnableVertexAttribArray(NODE_ID_LOCATION);
+  }
+}
+
+void init_gpu_residual(GraphicsState& g_state) {
+  GpuResidual& res = g_state.gpu_residual;
+  res.prog = setup_program("residual reduction", RESIDUAL_VERTEX_SRC,
+      MORPH_DUMMY_FRAGMENT_SRC, {"out_partial"});
+  glUseProgram(res.prog);
+  glUniform1i(glGetUniformLocation(res.prog, "in_buf"), 0);
+  glUniform1i(glGetUniformLocation(res.prog, "prev_pos_buf"), 1);
+  res.unif_num_inputs = glGetUniformLocation(res.prog, "num_inputs");
+  res.unif_first_pass = glGetUniformLocation(res.prog, "first_pass");
+
+  // the passes read their inputs from texture buffers, so the VAO has no
+  // attributes
+  glGenVertexArrays(1, &res.vao);
+  glGenTextures(1, &res.prev_pos_tex_buf);
+  res.prev_pos_vbo = create_gpu_buffer(g_state.gpu_buffers, GL_DYNAMIC_COPY,
+      res.prev_pos_tex_buf, GL_RGBA32F);
+  glGenTextures(res.partial_tex_bufs.size(), res.partial_tex_bufs.data());
+  for (int i = 0; i < res.partial_vbos.size(); ++i) {
+    res.partial_vbos[i] = create_gpu_buffer(g_state.gpu_buffers,
+        GL_DYNAMIC_COPY, res.partial_tex_bufs[i], GL_RGBA32F);
+  }
 }
 
 void init_render_state(GraphicsState& g_state) {
@@ -323,10 +479,9 @@ void init_render_state(GraphicsState& g_state) {
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_PROGRAM_POINT_SIZE);
   
-  glGenBuffers(1, &r_state.index_buffer);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r_state.index_buffer);
-  // TODO - check this later (may not want static draw)
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, RENDER_INDEX_BUFFER_SIZE, nullptr, GL_STATIC_DRAW);
+  // the buffer starts out empty, see reserve_index_data
+  r_state.index_buffer = create_gpu_buffer(g_state.gpu_buffers,
+      GL_STATIC_DRAW);
 }
 
 void setup_opengl(GraphicsState& state) {
@@ -334,6 +489,7 @@ void setup_opengl(GraphicsState& state) {
   
   init_render_state(state);
   init_morph_state(state);
+  init_gpu_residual(state);
 
   log_gl_errors("done setup_opengl");
 }
@@ -344,7 +500,7 @@ void write_nodes_to_vbos(MorphBuffer& m_buf, MorphNodes& node_vecs) {
   vector<pair<int, GLvoid*>> data_params = {
     {sizeof(vec4), node_vecs.pos_vec.data()},
     {sizeof(vec4), node_vecs.vel_vec.data()},
-    {sizeof(vec4), node_vecs.neighbors_vec.data()},
+    {sizeof(ivec4), node_vecs.neighbors_vec.data()},
     {sizeof(vec4), node_vecs.data_vec.data()},
   };
   int num_nodes = node_vecs.pos_vec.size();
@@ -364,7 +520,7 @@ MorphNodes read_nodes_from_vbos(MorphState& m_state) {
   vector<pair<int, GLvoid*>> data_params = {
     {sizeof(vec4), node_vecs.pos_vec.data()},
     {sizeof(vec4), node_vecs.vel_vec.data()},
-    {sizeof(vec4), node_vecs.neighbors_vec.data()},
+    {sizeof(ivec4), node_vecs.neighbors_vec.data()},
     {sizeof(vec4), node_vecs.data_vec.data()},
   };
   glBindVertexArray(target_buf.vao);
@@ -377,193 +533,998 @@ MorphNodes read_nodes_from_vbos(MorphState& m_state) {
 }
 
 void log_nodes(MorphNodes& node_vecs) {
-  printf("%lu nodes:\n", node_vecs.pos_vec.size()); 
-  for (int i = 0; i < node_vecs.pos_vec.size(); ++i) {
-    MorphNode node = node_vecs.node_at(i);
-    printf("%4d %s\n", i, raw_node_str(node).c_str());
+  write_nodes(stdout, node_vecs);
+}
+
+// Grows the node-sized buffers to hold num_nodes nodes, keeping the
+// current nodes and node ids. Returns false if they could not be grown.
+bool reserve_morph_nodes(GraphicsState& g_state, int num_nodes) {
+  GpuBuffers& bufs = g_state.gpu_buffers;
+  MorphState& m_state = g_state.morph_state;
+  bufs.budget_bytes = (size_t) std::max(g_state.controls.gpu_budget_mb, 0) << 20;
+  size_t num_bytes = num_nodes * sizeof(vec4);
+  size_t keep_bytes = m_state.num_nodes * sizeof(vec4);
+  vector<GpuBufferReserve> reserves;
+  for (MorphBuffer& m_buf : m_state.buffers) {
+    for (GLuint vbo : m_buf.vbos) {
+      reserves.push_back(GpuBufferReserve(vbo, num_bytes, keep_bytes));
+    }
+  }
+  // the flux is only read within an iteration
+  reserves.push_back(GpuBufferReserve(m_state.flux_vbo, num_bytes, 0));
+  reserves.push_back(GpuBufferReserve(m_state.node_id_vbo,
+        num_nodes * sizeof(GLint), m_state.node_ids.size() * sizeof(GLint)));
+  return reserve_gpu_buffers(bufs, reserves);
+}
+
+// Grows the CompactBuffers to hold the current nodes. Returns false if
+// they could not be grown.
+bool reserve_compact_nodes(GraphicsState& g_state) {
+  GpuBuffers& bufs = g_state.gpu_buffers;
+  MorphState& m_state = g_state.morph_state;
+  bufs.budget_bytes = (size_t) std::max(g_state.controls.gpu_budget_mb, 0) << 20;
+  // the bytes of each CompactBuffers element
+  array<size_t, COMPACT_BUF_COUNT> elem_sizes = {
+    sizeof(uvec4), sizeof(uvec2), sizeof(ivec4)
+  };
+  vector<GpuBufferReserve> reserves;
+  for (CompactBuffer& c_buf : m_state.compact_buffers) {
+    for (int i = 0; i < COMPACT_BUF_COUNT; ++i) {
+      // they only hold nodes within a run_simulation
+      reserves.push_back(GpuBufferReserve(c_buf.vbos[i],
+            m_state.num_nodes * elem_sizes[i], 0));
+    }
   }
-  printf("\n\n");
+  return reserve_gpu_buffers(bufs, reserves);
+}
+
+// Times reps uploads and readbacks of nodes through buffer 0, which are
+// synchronous, in ms each. Returns false if the nodes did not fit.
+bool time_node_transfers(GraphicsState& g_state, MorphNodes& nodes,
+    int reps, vector<double>& upload_ms, vector<double>& readback_ms) {
+  MorphState& m_state = g_state.morph_state;
+  if (!reserve_morph_nodes(g_state, nodes.size())) {
+    return false;
+  }
+  m_state.num_nodes = nodes.size();
+  m_state.result_buffer_index = 0;
+  auto to_ms = [](chrono::steady_clock::duration d) {
+    return chrono::duration<double, milli>(d).count();
+  };
+  for (int r = 0; r < reps; ++r) {
+    auto start_time = chrono::steady_clock::now();
+    write_nodes_to_vbos(m_state.buffers[0], nodes);
+    // so that the upload is not deferred past the timer
+    glFinish();
+    upload_ms.push_back(to_ms(chrono::steady_clock::now() - start_time));
+
+    start_time = chrono::steady_clock::now();
+    MorphNodes read_nodes = read_nodes_from_vbos(m_state);
+    readback_ms.push_back(to_ms(chrono::steady_clock::now() - start_time));
+  }
+  log_gl_errors("time node transfers");
+  return true;
+}
+
+// Grows the element buffer to hold num_indices indices, keeping the
+// current ones. Returns false if it could not be grown.
+bool reserve_index_data(GraphicsState& g_state, int num_indices) {
+  GpuBuffers& bufs = g_state.gpu_buffers;
+  RenderState& r_state = g_state.render_state;
+  bufs.budget_bytes = (size_t) std::max(g_state.controls.gpu_budget_mb, 0) << 20;
+  return reserve_gpu_buffer(bufs, r_state.index_buffer,
+      num_indices * sizeof(GLuint), r_state.elem_count * sizeof(GLuint));
 }
 
 // write the index data to the GL element buffer
-void write_index_data(GraphicsState& g_state, vector<GLuint>& indices) {
+bool write_index_data(GraphicsState& g_state, vector<GLuint>& indices) {
+  MORPH_TRACE_ZONE("write_index_data");
   RenderState& r_state = g_state.render_state;
   size_t index_data_len = indices.size() * sizeof(GLuint);
-  assert(index_data_len <= RENDER_INDEX_BUFFER_SIZE);
+  if (!reserve_index_data(g_state, indices.size())) {
+    return false;
+  }
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r_state.index_buffer);
   glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, index_data_len, indices.data());
   r_state.elem_count = indices.size();
+  return true;
 }
 
-vec3 gen_sphere(vec2 unit) {
-  float v_angle = unit[1] * M_PI;
-  float h_angle = unit[0] * 2.0 * M_PI;
-  return vec3(
-      sin(v_angle) * cos(h_angle),
-      sin(v_angle) * sin(h_angle),
-      cos(v_angle));
+// Writes the given triangles of the node pool to the GL element buffer,
+// a run of consecutive triangles at a time. Returns false if the buffer
+// could not be grown to hold them.
+bool write_changed_tris(GraphicsState& g_state, NodePool const& pool,
+    vector<int> const& tris) {
+  RenderState& r_state = g_state.render_state;
+  if (!reserve_index_data(g_state, pool.indices.size())) {
+    return false;
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r_state.index_buffer);
+  for (int i = 0; i < tris.size();) {
+    int run_len = 1;
+    while (i + run_len < tris.size() && tris[i + run_len] == tris[i] + run_len) {
+      ++run_len;
+    }
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 3 * tris[i] * sizeof(GLuint),
+        3 * run_len * sizeof(GLuint), &pool.indices[3 * tris[i]]);
+    i += run_len;
+  }
+  r_state.elem_count = pool.indices.size();
+  if (!tris.empty()) {
+    r_state.index_zygote_samples = -1;
+  }
+  return true;
 }
 
-vec3 gen_square(vec2 unit) {
-  return vec3(unit, 0);
+// Sets up the node pool of the CPU backend for the given nodes and index
+// data, or disables it if controls.node_pool_size is 0
+void init_cpu_node_pool(GraphicsState& g_state, int num_nodes,
+    GLuint const* indices, int num_indices) {
+  Controls& controls = g_state.controls;
+  NodePool& pool = g_state.morph_state.cpu_state.node_pool;
+  pool = NodePool();
+  if (controls.sim_backend != SIM_BACKEND_CPU ||
+      controls.node_pool_size <= 0) {
+    return;
+  }
+  int pool_size = controls.node_pool_size;
+  size_t budget = (size_t) std::max(controls.gpu_budget_mb, 0) << 20;
+  if (budget > 0) {
+    // each node is in 8 morph VBOs, the flux VBO and the node id VBO,
+    // and each spliced node adds at most 2 triangles
+    size_t node_bytes = 9 * sizeof(vec4) + sizeof(GLint);
+    size_t budget_nodes = (budget - std::min(budget,
+          num_indices * sizeof(GLuint))) / (node_bytes + 6 * sizeof(GLuint));
+    int max_pool_size = std::max((int) std::min(budget_nodes,
+          (size_t) INT_MAX / 2) - num_nodes, 0);
+    if (pool_size > max_pool_size) {
+      printf("node pool size limited to %d by the GPU budget\n",
+          max_pool_size);
+      pool_size = max_pool_size;
+    }
+  }
+  init_node_pool(pool, num_nodes,
+      vector<GLuint>(indices, indices + num_indices), pool_size);
 }
 
-vec3 gen_plane(vec2 unit) {
-  vec2 plane_pos = 10.0f * (unit - 0.5f);
-  return vec3(plane_pos[0], 0.0f, plane_pos[1]);
+// Sets the row-major id of each node, for both backends
+void set_node_ids(GraphicsState& g_state, vector<int> node_ids) {
+  MorphState& m_state = g_state.morph_state;
+  glBindBuffer(GL_ARRAY_BUFFER, m_state.node_id_vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0,
+      node_ids.size() * sizeof(GLint), node_ids.data());
+  // the CPU backend skips the lookup for the row-major order
+  if (g_state.controls.node_order == NODE_ORDER_ROW_MAJOR) {
+    m_state.cpu_state.node_ids.clear();
+  } else {
+    m_state.cpu_state.node_ids = node_ids;
+  }
+  m_state.node_ids = std::move(node_ids);
+  // set by apply_node_order for the tiled order
+  m_state.cpu_state.tiles = NodeTiles();
 }
 
-// Helper for gen_morph_data
-// returns -1 if the coord is outside the plane
-int coord_to_index(ivec2 coord, ivec2 samples) {
-  if ((0 <= coord[0] && coord[0] < samples[0]) &&
-      (0 <= coord[1] && coord[1] < samples[1])) {
-    return coord[0] % samples[0] + samples[0] * (coord[1] % samples[1]);
-  } else {
-    return -1;
-  }
-}
-
-// Outputs the nodes and the triangle indices, for rendering
-void gen_morph_data(ivec2 samples, vector<MorphNode>& out_nodes, vector<GLuint>& out_indices) {
-  vector<MorphNode> vertex_nodes;
-  vector<GLuint> indices;
-  vertex_nodes.reserve(samples[0] * samples[1]);
-  indices.reserve(6 * (samples[0] - 1) * (samples[1] - 1));
-  for (int y = 0; y < samples[1]; ++y) {
-    for (int x = 0; x < samples[0]; ++x) {
-      ivec2 coord(x, y);
-      vec3 pos = gen_plane(vec2(coord) / vec2(samples - 1));
-
-      int upper_neighbor = coord_to_index(coord + ivec2(0, 1), samples);
-      int lower_neighbor = coord_to_index(coord + ivec2(0, -1), samples);
-      int right_neighbor = coord_to_index(coord + ivec2(1, 0), samples);
-      int left_neighbor = coord_to_index(coord + ivec2(-1, 0), samples);
-      vec4 neighbors(
-          (float) right_neighbor, (float) upper_neighbor,
-          (float) left_neighbor, (float) lower_neighbor);
-
-      MorphNode vert_node(vec4(pos, 0.0), vec4(0.0), neighbors, vec4(0.0));
-      vertex_nodes.push_back(vert_node);
-
-      // if this is the lower-left vert of a valid face, add the indices for
-      // the two triangles that make up the quad
-      if (right_neighbor != -1 && upper_neighbor != -1) {
-        int my_index = coord_to_index(coord, samples);
-        int opposite_neighbor = coord_to_index(coord + ivec2(1, 1), samples);
-        assert(opposite_neighbor != -1);
-        vector<GLuint> new_indices = {
-          (GLuint) my_index, (GLuint) right_neighbor, (GLuint) opposite_neighbor,
-          (GLuint) my_index, (GLuint) opposite_neighbor, (GLuint) upper_neighbor
-        };
-        indices.insert(indices.end(), new_indices.begin(), new_indices.end());
-      }
+// Moves nodes and indices from the row-major order to controls.node_order,
+// and writes the index data and the node ids
+void apply_node_order(GraphicsState& g_state, MorphNodes& node_vecs,
+    vector<GLuint>& indices) {
+  Controls& controls = g_state.controls;
+  ivec2 zygote_samples(controls.num_zygote_samples);
+  vector<int> node_ids = compute_node_order(controls.node_order,
+      zygote_samples, node_vecs);
+  if (controls.node_order != NODE_ORDER_ROW_MAJOR) {
+    permute_nodes(node_ids, node_vecs, indices);
+  }
+  write_index_data(g_state, indices);
+  g_state.render_state.index_zygote_samples = controls.num_zygote_samples;
+  g_state.render_state.index_node_order = controls.node_order;
+  set_node_ids(g_state, std::move(node_ids));
+  if (controls.node_order == NODE_ORDER_TILED) {
+    g_state.morph_state.cpu_state.tiles =
+      compute_node_tiles(zygote_samples, node_vecs);
+  }
+}
+
+// Moves nodes and indices from the current order back to the row-major
+// order, for export
+void restore_row_major_order(MorphState const& m_state,
+    MorphNodes& node_vecs, vector<GLuint>& indices) {
+  if (!m_state.node_ids.empty()) {
+    // the spliced nodes, if any, follow the zygote
+    vector<int> node_ids = extend_permutation(m_state.node_ids,
+        node_vecs.size());
+    permute_nodes(invert_permutation(node_ids), node_vecs, indices);
+  }
+}
+
+// Generates the seed state of the current zygote size and node order
+// into the seed cache, unless it already holds it. Returns false if the
+// GPU copies could not be allocated.
+bool update_seed_cache(GraphicsState& g_state) {
+  Controls& controls = g_state.controls;
+  SeedCache& cache = g_state.morph_state.seed_cache;
+  if (cache.zygote_samples == controls.num_zygote_samples &&
+      cache.node_order == controls.node_order) {
+    return true;
+  }
+  cache.zygote_samples = -1;
+  // the node pool is set up for each run by init_cpu_node_pool, within
+  // the GPU budget
+  Controls seed_controls = controls;
+  seed_controls.node_pool_size = 0;
+  CpuMorphState seed;
+  seed_cpu_state(seed, seed_controls, cache.indices);
+  cache.nodes = std::move(seed.buffers[0]);
+  // the GL backend reads the ids of the row-major order, too
+  cache.node_ids = extend_permutation(std::move(seed.node_ids),
+      cache.nodes.size());
+  cache.tiles = std::move(seed.tiles);
+
+  // each pair is {element size, data pointer}
+  vector<pair<int, GLvoid*>> data_params = {
+    {sizeof(vec4), cache.nodes.pos_vec.data()},
+    {sizeof(vec4), cache.nodes.vel_vec.data()},
+    {sizeof(ivec4), cache.nodes.neighbors_vec.data()},
+    {sizeof(vec4), cache.nodes.data_vec.data()},
+  };
+  GpuBuffers& bufs = g_state.gpu_buffers;
+  bufs.budget_bytes = (size_t) std::max(controls.gpu_budget_mb, 0) << 20;
+  vector<GpuBufferReserve> reserves;
+  for (int i = 0; i < cache.vbos.size(); ++i) {
+    if (cache.vbos[i] == 0) {
+      cache.vbos[i] = create_gpu_buffer(bufs, GL_STATIC_DRAW);
     }
+    reserves.push_back(GpuBufferReserve(cache.vbos[i],
+          data_params[i].first * cache.nodes.size(), 0));
+  }
+  if (!reserve_gpu_buffers(bufs, reserves)) {
+    return false;
   }
-  out_nodes = std::move(vertex_nodes);
-  out_indices = std::move(indices);
+  for (int i = 0; i < cache.vbos.size(); ++i) {
+    size_t num_bytes = data_params[i].first * cache.nodes.size();
+    glBindBuffer(GL_ARRAY_BUFFER, cache.vbos[i]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, num_bytes, data_params[i].second);
+  }
+  cache.zygote_samples = controls.num_zygote_samples;
+  cache.node_order = controls.node_order;
+  log_gl_errors("update seed cache");
+  return true;
 }
 
-void set_initial_sim_data(GraphicsState& g_state) {
-  log_gl_errors("start set_initial_sim_data");
+// Writes the index data, node ids and tiles of the seed cache, unless
+// the index buffer already holds the seed's triangles. Returns false if
+// the buffers could not be grown.
+bool write_seed_topology(GraphicsState& g_state) {
+  RenderState& r_state = g_state.render_state;
+  MorphState& m_state = g_state.morph_state;
+  SeedCache& cache = m_state.seed_cache;
+  if (!reserve_morph_nodes(g_state, cache.nodes.size())) {
+    return false;
+  }
+  if (r_state.index_zygote_samples == cache.zygote_samples &&
+      r_state.index_node_order == cache.node_order) {
+    return true;
+  }
+  if (!write_index_data(g_state, cache.indices)) {
+    return false;
+  }
+  r_state.index_zygote_samples = cache.zygote_samples;
+  r_state.index_node_order = cache.node_order;
+  set_node_ids(g_state, cache.node_ids);
+  m_state.cpu_state.tiles = cache.tiles;
+  return true;
+}
 
-  MorphBuffer& m_buf = g_state.morph_state.buffers[0];
+// Reseeds buffer 0 (and the CPU buffer 0 for the CPU backend) from the
+// seed cache, regenerating the seed only if the zygote size or node
+// order changed. Returns false if the GPU buffers could not hold it.
+bool set_initial_sim_data(GraphicsState& g_state) {
+  MORPH_TRACE_ZONE("set_initial_sim_data");
+  log_gl_errors("start set_initial_sim_data");
 
-  ivec2 zygote_samples(g_state.controls.num_zygote_samples);
-  vector<MorphNode> nodes;
-  vector<GLuint> indices;
-  gen_morph_data(zygote_samples, nodes, indices);
-  MorphNodes node_vecs(nodes);
-  write_index_data(g_state, indices);
+  MorphState& m_state = g_state.morph_state;
+  SeedCache& cache = m_state.seed_cache;
+  if (!update_seed_cache(g_state) || !write_seed_topology(g_state)) {
+    return false;
+  }
 
   // debug logging
   if (g_state.controls.log_render_data) {
-    printf("\n\nindex data (%lu):\n", indices.size());
-    for (int i = 0; i < indices.size(); i += 3) {
-      ivec3 face(indices[i], indices[i + 1], indices[i + 2]);
+    printf("\n\nindex data (%lu):\n", cache.indices.size());
+    for (int i = 0; i < cache.indices.size(); i += 3) {
+      ivec3 face(cache.indices[i], cache.indices[i + 1], cache.indices[i + 2]);
       printf("%4d %s\n", i, to_string(face).c_str());
     }
   }
   if (g_state.controls.log_input_nodes) {
     printf("input nodes:\n");
-    log_nodes(node_vecs);
+    log_nodes(cache.nodes);
   }
 
-  assert(nodes.size() < MAX_NUM_MORPH_NODES);
-  g_state.morph_state.num_nodes = nodes.size();
+  int num_nodes = cache.nodes.size();
+  m_state.num_nodes = num_nodes;
 
-  write_nodes_to_vbos(m_buf, node_vecs);
+  // a copy on the GPU, rather than an upload
+  MorphBuffer& m_buf = m_state.buffers[0];
+  size_t elem_size = sizeof(vec4);
+  for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    glBindBuffer(GL_COPY_READ_BUFFER, cache.vbos[i]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buf.vbos[i]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        0, 0, num_nodes * elem_size);
+  }
+  init_cpu_node_pool(g_state, num_nodes,
+      cache.indices.data(), cache.indices.size());
+  if (g_state.controls.sim_backend == SIM_BACKEND_CPU) {
+    m_state.cpu_state.buffers[0] = cache.nodes;
+  }
   
   log_gl_errors("done set_initial_sim_data");
+  return true;
 }
 
-void run_simulation(GraphicsState& g_state, int num_iters) {
+// Runs the simulation with the CPU backend and uploads the result to
+// buffer 0 so that it can be rendered as usual
+void run_cpu_backend_simulation(GraphicsState& g_state,
+    int start_iter, int end_iter) {
   MorphState& m_state = g_state.morph_state;
-
+  CpuMorphState& cpu_state = m_state.cpu_state;
   MorphProgram& m_prog = m_state.programs[m_state.cur_prog_index];
 
-  glUseProgram(m_prog.gl_handle);
-  glValidateProgram(m_prog.gl_handle);
-  log_program_info_logs(m_prog.name + ", validate program log",
-      m_prog.gl_handle);
+  GrowthParams params(m_prog.user_unifs);
+  run_cpu_simulation(cpu_state, params, start_iter, end_iter,
+      g_state.controls);
+}
+
+// Uploads the result of the CPU backend to buffer 0 for rendering,
+// along with any triangles changed by spliced nodes. Returns false if the
+// GPU buffers could not be grown to hold it.
+bool write_cpu_result_to_vbos(GraphicsState& g_state) {
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_UPLOAD);
+  MorphState& m_state = g_state.morph_state;
+  CpuMorphState& cpu_state = m_state.cpu_state;
+  MorphNodes& result = cpu_state.buffers[cpu_state.result_buffer_index];
+  if (!reserve_morph_nodes(g_state, result.size())) {
+    return false;
+  }
+  write_nodes_to_vbos(m_state.buffers[0], result);
+  m_state.num_nodes = result.size();
+  m_state.result_buffer_index = 0;
+  if (node_pool_enabled(cpu_state.node_pool) &&
+      !write_changed_tris(g_state, cpu_state.node_pool,
+        take_changed_tris(cpu_state.node_pool))) {
+    return false;
+  }
+
+  log_gl_errors("done cpu simulation");
+  return true;
+}
+
+// Converts the nodes between the encodings with program, the encode or
+// decode program of a MorphProgram, reading them through vao and writing
+// them to out_vbos
+void run_codec_pass(GraphicsState& g_state, GLuint program, GLuint vao,
+    GLuint const* out_vbos, int num_vbos) {
+  glUseProgram(program);
+  glBindVertexArray(vao);
+  for (int i = 0; i < num_vbos; ++i) {
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, i, out_vbos[i]);
+  }
+  begin_gpu_timer(g_state.gpu_timers, GPU_PASS_CODEC);
+  glBeginTransformFeedback(GL_POINTS);
+  glDrawArrays(GL_POINTS, 0, g_state.morph_state.num_nodes);
+  glEndTransformFeedback();
+  end_gpu_timer(g_state.gpu_timers);
+}
+
+// Whether the GL backend runs on the CompactBuffers, growing them if so.
+// It falls back to the MorphBuffers if they do not fit.
+bool use_compact_nodes(GraphicsState& g_state, MorphProgram const& m_prog) {
+  if (!g_state.controls.compact_nodes || m_prog.compact_gl_handle == 0) {
+    return false;
+  }
+  if (!reserve_compact_nodes(g_state)) {
+    printf("compact nodes: WARNING no room for the buffers, "
+        "using the full encoding\n");
+    return false;
+  }
+  return true;
+}
+
+// Runs iterations [start_iter, end_iter), starting from the state in
+// buffers[start_iter & 1] (the initial data in buffer 0 when start_iter
+// is 0). The CPU backend leaves its result in the CPU buffers.
+// With controls.compact_nodes the GL backend encodes the state into the
+// CompactBuffers, iterates on them and decodes the result, so that the
+// rest of the app only sees the MorphBuffers.
+void run_simulation(GraphicsState& g_state, int start_iter, int end_iter) {
+  MORPH_TRACE_ZONE("run_simulation");
+  MorphState& m_state = g_state.morph_state;
+  if (g_state.controls.sim_backend == SIM_BACKEND_CPU) {
+    run_cpu_backend_simulation(g_state, start_iter, end_iter);
+    return;
+  }
+
+  MorphProgram& m_prog = m_state.programs[m_state.cur_prog_index];
+  bool compact = start_iter < end_iter && use_compact_nodes(g_state, m_prog);
+  GLuint sim_prog = compact ? m_prog.compact_gl_handle : m_prog.gl_handle;
+  GLuint flux_prog = compact ?
+    m_prog.compact_flux_gl_handle : m_prog.flux_gl_handle;
+  GLint unif_iter_num = compact ?
+    m_prog.compact_unif_iter_num : m_prog.unif_iter_num;
+  GLint unif_num_nodes = compact ?
+    m_prog.compact_unif_num_nodes : m_prog.unif_num_nodes;
+  vector<GLint> const& flux_unif_handles = compact ?
+    m_prog.compact_flux_unif_handles : m_prog.flux_unif_handles;
+
+  glUseProgram(sim_prog);
+  glValidateProgram(sim_prog);
+  log_program_info_logs(m_prog.name + ", validate program log", sim_prog);
 
   glEnable(GL_RASTERIZER_DISCARD);
 
   // Set uniforms
-  for (UserUnif& user_unif : m_prog.user_unifs) {
-    glUniform4fv(user_unif.gl_handle, 1, &user_unif.cur_val[0]);
+  for (int i = 0; i < m_prog.user_unifs.size(); ++i) {
+    GLint handle = compact ? m_prog.compact_unif_handles[i] :
+      m_prog.user_unifs[i].gl_handle;
+    glUniform4fv(handle, 1, &m_prog.user_unifs[i].cur_val[0]);
+  }
+  glUniform1i(unif_num_nodes, m_state.num_nodes);
+
+  bool use_flux_pass = flux_prog != 0;
+  if (use_flux_pass) {
+    glUseProgram(flux_prog);
+    for (int i = 0; i < m_prog.user_unifs.size(); ++i) {
+      glUniform4fv(flux_unif_handles[i], 1,
+          &m_prog.user_unifs[i].cur_val[0]);
+    }
   }
-  glUniform1i(m_prog.unif_num_nodes, m_state.num_nodes);
+  glActiveTexture(GL_TEXTURE0 + MORPH_BUF_COUNT);
+  glBindTexture(GL_TEXTURE_BUFFER, m_state.flux_tex_buf);
+
+  if (compact) {
+    int buf_index = start_iter & 1;
+    run_codec_pass(g_state, m_prog.encode_gl_handle,
+        m_state.buffers[buf_index].vao,
+        m_state.compact_buffers[buf_index].vbos.data(), COMPACT_BUF_COUNT);
+  }
+  glUseProgram(sim_prog);
 
   // perform double-buffered iterations
-  // assume the initial data is in buffer 0
-  for (int i = 0; i < num_iters; ++i) {
-    MorphBuffer& cur_buf = m_state.buffers[i & 1];
-    MorphBuffer& next_buf = m_state.buffers[(i + 1) & 1];
+  for (int i = start_iter; i < end_iter; ++i) {
+    // the vao and texture buffers of the current state, and the vbos
+    // that the next one is written to
+    GLuint cur_vao = 0;
+    GLuint const* cur_tex_bufs = nullptr;
+    GLuint const* next_vbos = nullptr;
+    int num_bufs = 0;
+    if (compact) {
+      CompactBuffer& cur_buf = m_state.compact_buffers[i & 1];
+      cur_vao = cur_buf.vao;
+      cur_tex_bufs = cur_buf.tex_bufs.data();
+      next_vbos = m_state.compact_buffers[(i + 1) & 1].vbos.data();
+      num_bufs = COMPACT_BUF_COUNT;
+    } else {
+      MorphBuffer& cur_buf = m_state.buffers[i & 1];
+      cur_vao = cur_buf.vao;
+      cur_tex_bufs = cur_buf.tex_bufs.data();
+      next_vbos = m_state.buffers[(i + 1) & 1].vbos.data();
+      num_bufs = MORPH_BUF_COUNT;
+    }
 
     // set uniforms
-    glUniform1i(m_prog.unif_iter_num, i);
+    glUniform1i(unif_iter_num, i);
 
     // setup texture buffers and transform feedback buffers
     // TODO - is this necessary every iteration, or just once?
-    glBindVertexArray(cur_buf.vao);
-    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+    glBindVertexArray(cur_vao);
+    for (int i = 0; i < num_bufs; ++i) {
       glActiveTexture(GL_TEXTURE0 + i);
-      glBindTexture(GL_TEXTURE_BUFFER, cur_buf.tex_bufs[i]);
+      glBindTexture(GL_TEXTURE_BUFFER, cur_tex_bufs[i]);
+    }
+
+    // the flux pass computes the heat each node emits along each of its
+    // edges once, rather than once per hotter neighbor in the main pass.
+    // The init iteration does not use it.
+    if (use_flux_pass && i > 0) {
+      glUseProgram(flux_prog);
+      glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, m_state.flux_vbo);
+      begin_gpu_timer(g_state.gpu_timers, GPU_PASS_FLUX);
+      glBeginTransformFeedback(GL_POINTS);
+      glDrawArrays(GL_POINTS, 0, m_state.num_nodes);
+      glEndTransformFeedback();
+      end_gpu_timer(g_state.gpu_timers);
+      glUseProgram(sim_prog);
+    }
 
-      glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, i, next_buf.vbos[i]);
+    for (int i = 0; i < num_bufs; ++i) {
+      glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, i, next_vbos[i]);
     }
 
+    begin_gpu_timer(g_state.gpu_timers, GPU_PASS_SIM);
     glBeginTransformFeedback(GL_POINTS);
     glDrawArrays(GL_POINTS, 0, m_state.num_nodes);
     glEndTransformFeedback();
+    end_gpu_timer(g_state.gpu_timers);
   }
   // store the index of the most recently written buffer
-  m_state.result_buffer_index = num_iters % 2;
+  m_state.result_buffer_index = end_iter % 2;
+
+  if (compact) {
+    int buf_index = end_iter & 1;
+    run_codec_pass(g_state, m_prog.decode_gl_handle,
+        m_state.compact_buffers[buf_index].vao,
+        m_state.buffers[buf_index].vbos.data(), MORPH_BUF_COUNT);
+  }
 
   glDisable(GL_RASTERIZER_DISCARD);
 
   log_gl_errors("done simulation");
 }
 
+// Copies the checkpoint into the sim buffers, writing the index data
+// and node ids if they are for a different zygote or order. Returns
+// false if the GPU buffers could not hold it.
+bool restore_sim_checkpoint(GraphicsState& g_state, SimCheckpoint const& cp) {
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_UPLOAD);
+  RenderState& r_state = g_state.render_state;
+  if (!update_seed_cache(g_state) || !write_seed_topology(g_state)) {
+    return false;
+  }
+  restore_checkpoint(g_state.morph_state, cp);
+  // the triangles of the checkpoint replace all of the index data
+  NodePool& pool = g_state.morph_state.cpu_state.node_pool;
+  if (cp.sim_backend == SIM_BACKEND_CPU && node_pool_enabled(pool)) {
+    if (!write_index_data(g_state, pool.indices)) {
+      return false;
+    }
+    r_state.index_zygote_samples = -1;
+    pool.changed_tris.clear();
+  }
+  return true;
+}
+
+// Runs iterations [start_iter, end_iter), adding a checkpoint (if
+// key is not empty) at every multiple of controls.checkpoint_interval
+void run_checkpointed_simulation(GraphicsState& g_state, string const& key,
+    int start_iter, int end_iter) {
+  Controls& controls = g_state.controls;
+  MorphState& m_state = g_state.morph_state;
+  int interval = controls.checkpoint_interval;
+  if (key.empty() || interval <= 0) {
+    run_simulation(g_state, start_iter, end_iter);
+    return;
+  }
+  int iter_num = start_iter;
+  while (true) {
+    if (iter_num % interval == 0 &&
+        !has_checkpoint(m_state.checkpoints, key, iter_num)) {
+      add_checkpoint(m_state, key, iter_num, controls.sim_backend);
+    }
+    if (iter_num >= end_iter) {
+      break;
+    }
+    int next_iter_num = std::min(end_iter, (iter_num / interval + 1) * interval);
+    run_simulation(g_state, iter_num, next_iter_num);
+    iter_num = next_iter_num;
+  }
+}
+
+string current_sim_key(GraphicsState const& g_state) {
+  MorphState const& m_state = g_state.morph_state;
+  return checkpoint_key(m_state.programs[m_state.cur_prog_index],
+      g_state.controls);
+}
+
+// True if the session must be reset before stepping it, b/c it was
+// never started or the program, a uniform or the zygote size changed
+bool sim_session_is_stale(GraphicsState const& g_state) {
+  SimSession const& session = g_state.morph_state.session;
+  return !session.is_valid || session.key != current_sim_key(g_state);
+}
+
+// Reseeds the simulation and restarts the session at iteration 0.
+// Returns false, leaving the session invalid, if the seed did not fit.
+bool reset_sim_session(GraphicsState& g_state) {
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_UPLOAD);
+  SimSession& session = g_state.morph_state.session;
+  session.is_valid = false;
+  if (!set_initial_sim_data(g_state)) {
+    return false;
+  }
+  session.is_valid = true;
+  session.key = current_sim_key(g_state);
+  session.iter_num = 0;
+  return true;
+}
+
+// Runs num_iters more iterations of a non-stale session, adding
+// checkpoints along the way if enabled
+void step_sim_session(GraphicsState& g_state, int num_iters) {
+  SimSession& session = g_state.morph_state.session;
+  assert(session.is_valid && num_iters >= 0);
+  string checkpoint_key = g_state.controls.use_checkpoints ?
+    session.key : "";
+  run_checkpointed_simulation(g_state, checkpoint_key,
+      session.iter_num, session.iter_num + num_iters);
+  session.iter_num += num_iters;
+}
+
+// Copies the node positions of the latest GL result, which the next
+// compute_gl_residual measures from. Returns false if the copy did not
+// fit in the GPU budget.
+bool save_gl_residual_positions(GraphicsState& g_state) {
+  MorphState& m_state = g_state.morph_state;
+  GpuResidual& res = g_state.gpu_residual;
+  size_t num_bytes = m_state.num_nodes * sizeof(vec4);
+  if (!reserve_gpu_buffer(g_state.gpu_buffers, res.prev_pos_vbo,
+        num_bytes, 0)) {
+    return false;
+  }
+  if (num_bytes > 0) {
+    MorphBuffer& result = m_state.buffers[m_state.result_buffer_index];
+    glBindBuffer(GL_COPY_READ_BUFFER, result.vbos[BUF_POS]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, res.prev_pos_vbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+        0, 0, num_bytes);
+  }
+  log_gl_errors("save residual positions");
+  return true;
+}
+
+// Computes the residual of the latest GL result from the positions saved
+// by save_gl_residual_positions. The nodes are reduced on the GPU, one
+// pass per RESIDUAL_GROUP_SIZE times fewer partials, and only the final
+// partial is read back. Returns false if the partials did not fit in the
+// GPU budget.
+bool compute_gl_residual(GraphicsState& g_state, SimResidual& residual) {
+  MorphState& m_state = g_state.morph_state;
+  GpuResidual& res = g_state.gpu_residual;
+  residual = SimResidual();
+  int num_nodes = m_state.num_nodes;
+  if (num_nodes == 0) {
+    return true;
+  }
+  int max_partials = (num_nodes + RESIDUAL_GROUP_SIZE - 1) /
+    RESIDUAL_GROUP_SIZE;
+  for (GLuint partial_vbo : res.partial_vbos) {
+    if (!reserve_gpu_buffer(g_state.gpu_buffers, partial_vbo,
+          max_partials * sizeof(vec4), 0)) {
+      return false;
+    }
+  }
+
+  glUseProgram(res.prog);
+  glBindVertexArray(res.vao);
+  glEnable(GL_RASTERIZER_DISCARD);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, res.prev_pos_tex_buf);
+  // each pass writes one partial buffer while reading the other
+  GLuint in_tex_buf = m_state.buffers[m_state.result_buffer_index]
+    .tex_bufs[BUF_POS];
+  int num_inputs = num_nodes;
+  int out_index = 0;
+  bool first_pass = true;
+  while (first_pass || num_inputs > 1) {
+    int num_partials = (num_inputs + RESIDUAL_GROUP_SIZE - 1) /
+      RESIDUAL_GROUP_SIZE;
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, in_tex_buf);
+    glUniform1i(res.unif_num_inputs, num_inputs);
+    glUniform1i(res.unif_first_pass, first_pass);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0,
+        res.partial_vbos[out_index]);
+    begin_gpu_timer(g_state.gpu_timers, GPU_PASS_RESIDUAL);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, num_partials);
+    glEndTransformFeedback();
+    end_gpu_timer(g_state.gpu_timers);
+
+    in_tex_buf = res.partial_tex_bufs[out_index];
+    out_index = 1 - out_index;
+    num_inputs = num_partials;
+    first_pass = false;
+  }
+  glDisable(GL_RASTERIZER_DISCARD);
+
+  vec4 total(0.0f);
+  glBindBuffer(GL_COPY_READ_BUFFER, res.partial_vbos[1 - out_index]);
+  glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(vec4), &total[0]);
+  residual.max_disp = total.x;
+  residual.mean_disp = total.y / num_nodes;
+  residual.heat_change = total.z;
+  log_gl_errors("compute residual");
+  return true;
+}
+
+// read the index data from the GL element buffer
+vector<GLuint> read_index_data(GraphicsState& g_state) {
+  RenderState& r_state = g_state.render_state;
+  vector<GLuint> indices(r_state.elem_count);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r_state.index_buffer);
+  glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0,
+      indices.size() * sizeof(GLuint), indices.data());
+  return indices;
+}
+
+// Writes the most recent result, the index data and the uniforms
+void save_snapshot(GraphicsState& g_state, string const& path) {
+  MorphState& m_state = g_state.morph_state;
+  MorphProgram& m_prog = m_state.programs[m_state.cur_prog_index];
+
+  MorphNodes node_vecs = read_nodes_from_vbos(m_state);
+  vector<GLuint> indices = read_index_data(g_state);
+  restore_row_major_order(m_state, node_vecs, indices);
+  // the background simulation draws whichever iteration it has reached
+  BackgroundSim const& bg = g_state.background_sim;
+  int iter_num = m_state.session.is_valid ?
+    m_state.session.iter_num : g_state.controls.num_iters;
+  if (bg.worker && bg.iter_num >= 0) {
+    iter_num = bg.iter_num;
+  }
+  if (write_snapshot(path, iter_num, g_state.controls.num_zygote_samples,
+      m_prog.user_unifs, node_vecs, indices)) {
+    printf("saved snapshot of iter %d to %s\n", iter_num, path.c_str());
+  }
+}
+
+// Exports the most recent result as a mesh, in the format given by the
+// extension of path
+void export_result_mesh(GraphicsState& g_state, string const& path) {
+  int format = mesh_format_for_path(path);
+  if (format == -1) {
+    printf("unknown mesh format, use .ply or .obj: %s\n", path.c_str());
+    return;
+  }
+  MorphNodes node_vecs = read_nodes_from_vbos(g_state.morph_state);
+  vector<GLuint> indices = read_index_data(g_state);
+  restore_row_major_order(g_state.morph_state, node_vecs, indices);
+  if (export_mesh(path, format, node_vecs.pos_vec.size(),
+        node_vecs.pos_vec.data(), node_vecs.vel_vec.data(),
+        indices.size(), indices.data())) {
+    printf("exported mesh to %s\n", path.c_str());
+  }
+}
+
+// Loads a snapshot and its uniform values, and pauses the animation.
+// The simulation session resumes from the snapshot's iteration.
+void load_snapshot(GraphicsState& g_state, string const& path) {
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_UPLOAD);
+  MorphState& m_state = g_state.morph_state;
+  Controls& controls = g_state.controls;
+  MappedSnapshot snapshot;
+  if (!map_snapshot(path, snapshot)) {
+    return;
+  }
+  SnapshotHeader const& header = *snapshot.header;
+  int num_zygote_nodes = header.num_zygote_samples *
+    header.num_zygote_samples;
+  if (header.num_nodes < num_zygote_nodes) {
+    printf("snapshot %s is not of a zygote\n", path.c_str());
+    unmap_snapshot(snapshot);
+    return;
+  }
+  // grow the buffers before changing any state, so that a failure
+  // leaves the current result as it was
+  if (!reserve_morph_nodes(g_state, header.num_nodes) ||
+      !reserve_index_data(g_state, header.num_indices)) {
+    printf("snapshot %s is too large\n", path.c_str());
+    unmap_snapshot(snapshot);
+    return;
+  }
+  controls.num_zygote_samples = header.num_zygote_samples;
+  // the node orders are only defined for the zygote grid
+  bool is_grown = header.num_nodes > num_zygote_nodes;
+  if (is_grown && controls.node_order != NODE_ORDER_ROW_MAJOR) {
+    printf("snapshot has spliced nodes, loading in the row-major order\n");
+  }
+
+  int iter_num = header.iter_num;
+  MorphBuffer& m_buf = m_state.buffers[iter_num & 1];
+  if (controls.node_order == NODE_ORDER_ROW_MAJOR || is_grown) {
+    // snapshots are in the row-major order, so the arrays are uploaded
+    // straight from the mapping
+    vector<const GLvoid*> arrays = {
+      snapshot.pos, snapshot.vel, snapshot.neighbors, snapshot.data
+    };
+    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+      glBindBuffer(GL_ARRAY_BUFFER, m_buf.vbos[i]);
+      glBufferSubData(GL_ARRAY_BUFFER, 0,
+          header.num_nodes * sizeof(vec4), arrays[i]);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_state.render_state.index_buffer);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0,
+        header.num_indices * sizeof(GLuint), snapshot.indices);
+    g_state.render_state.elem_count = header.num_indices;
+    g_state.render_state.index_zygote_samples = is_grown ?
+      -1 : header.num_zygote_samples;
+    g_state.render_state.index_node_order = NODE_ORDER_ROW_MAJOR;
+    set_node_ids(g_state, identity_permutation(header.num_nodes));
+    init_cpu_node_pool(g_state, header.num_nodes,
+        snapshot.indices, header.num_indices);
+    if (controls.sim_backend == SIM_BACKEND_CPU) {
+      m_state.cpu_state.buffers[iter_num & 1] = snapshot_nodes(snapshot);
+    }
+  } else {
+    MorphNodes node_vecs = snapshot_nodes(snapshot);
+    vector<GLuint> indices(snapshot.indices,
+        snapshot.indices + header.num_indices);
+    apply_node_order(g_state, node_vecs, indices);
+    write_nodes_to_vbos(m_buf, node_vecs);
+    init_cpu_node_pool(g_state, node_vecs.size(),
+        indices.data(), indices.size());
+    if (controls.sim_backend == SIM_BACKEND_CPU) {
+      m_state.cpu_state.buffers[iter_num & 1] = std::move(node_vecs);
+    }
+  }
+  m_state.num_nodes = header.num_nodes;
+  m_state.result_buffer_index = iter_num & 1;
+
+  MorphProgram& m_prog = m_state.programs[m_state.cur_prog_index];
+  for (int i = 0; i < header.num_unifs; ++i) {
+    SnapshotUnif const& unif = snapshot.unifs[i];
+    for (UserUnif& user_unif : m_prog.user_unifs) {
+      if (user_unif.name == unif.name) {
+        user_unif.cur_val = vec4(unif.value[0], unif.value[1],
+            unif.value[2], unif.value[3]);
+      }
+    }
+  }
+  controls.num_iters = iter_num;
+  controls.animating_sim = false;
+
+  SimSession& session = m_state.session;
+  session.is_valid = true;
+  session.key = current_sim_key(g_state);
+  session.iter_num = iter_num;
+
+  unmap_snapshot(snapshot);
+  log_gl_errors("load snapshot");
+  printf("loaded snapshot of iter %d from %s\n", iter_num, path.c_str());
+}
+
+// Starts the SimWorker when controls.background_sim is turned on, and
+// stops it when it is turned off or the backend is not the CPU. The
+// foreground simulation reseeds after it.
+void update_background_sim(GraphicsState& g_state) {
+  Controls& controls = g_state.controls;
+  BackgroundSim& bg = g_state.background_sim;
+  bool enabled = controls.background_sim &&
+    controls.sim_backend == SIM_BACKEND_CPU;
+  if (enabled == (bg.worker != nullptr)) {
+    return;
+  }
+  bg.worker.reset(enabled ? new SimWorker() : nullptr);
+  bg.key.clear();
+  bg.target_iter = -1;
+  bg.iter_num = -1;
+  bg.topology_version = -1;
+  g_state.morph_state.session.is_valid = false;
+}
+
+// Submits the current program, uniforms, controls and target iteration
+// to the SimWorker, unless they are what it was last given
+void submit_background_sim(GraphicsState& g_state) {
+  Controls& controls = g_state.controls;
+  BackgroundSim& bg = g_state.background_sim;
+  string key = current_sim_key(g_state);
+  if (key == bg.key && controls.num_iters == bg.target_iter) {
+    return;
+  }
+  MorphState& m_state = g_state.morph_state;
+  MorphProgram& m_prog = m_state.programs[m_state.cur_prog_index];
+  SimRequest request;
+  request.key = key;
+  request.target_iter = controls.num_iters;
+  request.params = GrowthParams(m_prog.user_unifs);
+  request.controls = controls;
+  bg.worker->submit(request);
+  bg.key = key;
+  bg.target_iter = controls.num_iters;
+}
+
+// Uploads the newest state of the SimWorker to buffer 0 for rendering,
+// if it published one since the last call. Returns false if the GPU
+// buffers could not be grown to hold it.
+bool upload_background_sim_state(GraphicsState& g_state) {
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_UPLOAD);
+  BackgroundSim& bg = g_state.background_sim;
+  MorphState& m_state = g_state.morph_state;
+  SimWorkerState* state = bg.worker->take_state();
+  if (!state) {
+    return true;
+  }
+  if (!reserve_morph_nodes(g_state, state->nodes.size())) {
+    return false;
+  }
+  write_nodes_to_vbos(m_state.buffers[0], state->nodes);
+  m_state.num_nodes = state->nodes.size();
+  m_state.result_buffer_index = 0;
+  if (state->topology_version != bg.topology_version) {
+    if (!write_index_data(g_state, state->indices)) {
+      return false;
+    }
+    m_state.node_ids = state->node_ids;
+    bg.topology_version = state->topology_version;
+    // so that the foreground simulation rewrites its own
+    g_state.render_state.index_zygote_samples = -1;
+  }
+  bg.iter_num = state->iter_num;
+  // the CPU buffers no longer hold what is drawn
+  m_state.session.is_valid = false;
+  log_gl_errors("upload background sim state");
+  return true;
+}
+
 void run_simulation_pipeline(GraphicsState& g_state) {
+  if (g_state.background_sim.worker) {
+    submit_background_sim(g_state);
+    return;
+  }
+  MORPH_TRACE_ZONE("run_simulation_pipeline");
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_SIM);
   log_gl_errors("starting sim pipeline\n");
+  Controls& controls = g_state.controls;
+  MorphState& m_state = g_state.morph_state;
+  SimSession& session = m_state.session;
+  int target_iter = controls.num_iters;
+
+  // continue the session if it is still valid and not past the target.
+  // Otherwise, or if a checkpoint is closer, resume from the nearest
+  // earlier checkpoint, if there is one.
+  if (sim_session_is_stale(g_state) || session.iter_num > target_iter) {
+    session.is_valid = false;
+  }
+  SimCheckpoint* checkpoint = nullptr;
+  if (controls.use_checkpoints) {
+    m_state.checkpoints.budget_bytes =
+      (size_t) std::max(controls.checkpoint_budget_mb, 0) << 20;
+    trim_checkpoints(m_state.checkpoints, m_state.checkpoints.budget_bytes);
+    checkpoint = find_checkpoint(m_state.checkpoints,
+        current_sim_key(g_state), target_iter);
+    if (session.is_valid && checkpoint &&
+        checkpoint->iter_num <= session.iter_num) {
+      checkpoint = nullptr;
+    }
+  }
 
   auto start_init_data = chrono::steady_clock::now();
-  set_initial_sim_data(g_state);
+  bool init_ok = true;
+  if (checkpoint) {
+    init_ok = restore_sim_checkpoint(g_state, *checkpoint);
+    session.is_valid = init_ok;
+    session.key = checkpoint->key;
+    session.iter_num = checkpoint->iter_num;
+  } else if (!session.is_valid) {
+    init_ok = reset_sim_session(g_state);
+  }
+  if (!init_ok) {
+    printf("simulation stopped, the GPU buffers are too small for it\n");
+    controls.animating_sim = false;
+    return;
+  }
+  int start_iter = session.iter_num;
   auto end_init_data = chrono::steady_clock::now();
   auto init_data_duration =
     chrono::duration_cast<chrono::milliseconds>(end_init_data - start_init_data);
 
   auto start_sim = chrono::steady_clock::now();
-  run_simulation(g_state, g_state.controls.num_iters);
+  step_sim_session(g_state, target_iter - session.iter_num);
+  if (controls.sim_backend == SIM_BACKEND_CPU &&
+      !write_cpu_result_to_vbos(g_state)) {
+    printf("simulation stopped, the GPU buffers are too small for it\n");
+    controls.animating_sim = false;
+    session.is_valid = false;
+    return;
+  }
   auto end_sim = chrono::steady_clock::now();
   auto sim_duration =
     chrono::duration_cast<chrono::milliseconds>(end_sim - start_sim);
 
   if (g_state.controls.log_durations) {
-    printf("init data: %dms\nsim: %dms\n",
-        (int) init_data_duration.count(), (int) sim_duration.count());
+    printf("init data: %dms\nsim: %dms (from iter %d)\n",
+        (int) init_data_duration.count(), (int) sim_duration.count(),
+        start_iter);
   }
   if (g_state.controls.log_output_nodes) {
     MorphNodes node_vecs = read_nodes_from_vbos(g_state.morph_state);
@@ -574,7 +1535,79 @@ void run_simulation_pipeline(GraphicsState& g_state) {
   log_gl_errors("ending sim pipeline\n");
 }
 
+// Runs the simulation to controls.num_iters, then on until the residual
+// of each controls.convergence.check_interval iterations is within
+// tolerance (or its max_iters is reached), and moves controls.num_iters
+// to the iteration reached. The GL backend reduces the residual on the
+// GPU and the CPU backend on its thread pool.
+void run_to_convergence(GraphicsState& g_state) {
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_SIM);
+  Controls& controls = g_state.controls;
+  MorphState& m_state = g_state.morph_state;
+  SimSession& session = m_state.session;
+  if (g_state.background_sim.worker) {
+    printf("run to convergence needs the background simulation off\n");
+    return;
+  }
+  run_simulation_pipeline(g_state);
+  if (!session.is_valid) {
+    return;
+  }
+  // so that the animation does not move on from the iteration reached
+  controls.animating_sim = false;
+
+  ConvergenceCriteria const& criteria = controls.convergence;
+  if (session.iter_num >= criteria.max_iters) {
+    // no check would run, so there is no residual to report
+    printf("run to convergence: iter %d already reaches max iters %d\n",
+        session.iter_num, criteria.max_iters);
+    return;
+  }
+  int check_interval = std::max(criteria.check_interval, 1);
+  bool use_cpu = controls.sim_backend == SIM_BACKEND_CPU;
+  CpuMorphState& cpu_state = m_state.cpu_state;
+  vector<vec4> prev_pos;
+  SimResidual residual;
+  bool converged = false;
+  bool buffers_ok = true;
+  while (session.iter_num < criteria.max_iters) {
+    if (use_cpu) {
+      prev_pos = cpu_state.buffers[session.iter_num & 1].pos_vec;
+    } else if (!save_gl_residual_positions(g_state)) {
+      buffers_ok = false;
+      break;
+    }
+    step_sim_session(g_state,
+        std::min(check_interval, criteria.max_iters - session.iter_num));
+    if (use_cpu) {
+      residual = compute_cpu_residual(cpu_state, prev_pos);
+    } else if (!compute_gl_residual(g_state, residual)) {
+      buffers_ok = false;
+      break;
+    }
+    if (residual_converged(residual, criteria)) {
+      converged = true;
+      break;
+    }
+  }
+  controls.num_iters = session.iter_num;
+  if (use_cpu && !write_cpu_result_to_vbos(g_state)) {
+    buffers_ok = false;
+    session.is_valid = false;
+  }
+  if (!buffers_ok) {
+    printf("run to convergence stopped, the GPU buffers are too small "
+        "for it\n");
+    return;
+  }
+  printf("%s at iter %d: max disp %g, mean disp %g, heat change %g\n",
+      converged ? "converged" : "did not converge", session.iter_num,
+      residual.max_disp, residual.mean_disp, residual.heat_change);
+}
+
 void render_frame(GraphicsState& g_state) {
+  MORPH_TRACE_ZONE("render_frame");
+  FramePhaseScope phase(g_state.frame_stats, FRAME_PHASE_RENDER);
   RenderState& r_state = g_state.render_state;
   MorphState& m_state = g_state.morph_state;
 
@@ -605,7 +1638,9 @@ void render_frame(GraphicsState& g_state) {
   if (g_state.controls.render_faces && r_state.elem_count > 0) {
     glUniform1i(r_state.prog.unif_debug_render, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r_state.index_buffer);
+    begin_gpu_timer(g_state.gpu_timers, GPU_PASS_FACES);
     glDrawElements(GL_TRIANGLES, r_state.elem_count, GL_UNSIGNED_INT, nullptr);
+    end_gpu_timer(g_state.gpu_timers);
   }
   vec3 debug_col(1.0,0.0,0.0);
   if (g_state.controls.render_wireframe && r_state.elem_count > 0) {
@@ -613,13 +1648,17 @@ void render_frame(GraphicsState& g_state) {
     glUniform3fv(r_state.prog.unif_debug_color, 1, &debug_col[0]);
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r_state.index_buffer);
+    begin_gpu_timer(g_state.gpu_timers, GPU_PASS_WIREFRAME);
     glDrawElements(GL_TRIANGLES, r_state.elem_count, GL_UNSIGNED_INT, nullptr);
+    end_gpu_timer(g_state.gpu_timers);
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
   }
   if (g_state.controls.render_points && m_state.num_nodes > 0) {
     glUniform1i(r_state.prog.unif_debug_render, 1);
     glUniform3fv(r_state.prog.unif_debug_color, 1, &debug_col[0]);
+    begin_gpu_timer(g_state.gpu_timers, GPU_PASS_POINTS);
     glDrawArrays(GL_POINTS, 0, m_state.num_nodes);
+    end_gpu_timer(g_state.gpu_timers);
   }
 
   log_gl_errors("done render_frame");
@@ -745,6 +1784,49 @@ void gen_user_uniforms_ui(vector<UserUnif>& user_unifs) {
   }
 }
 
+bool time_gl_transfers(string const& base_shader_path,
+    vector<int> const& zygote_sizes, int reps, vector<BenchResult>& results) {
+  glfwSetErrorCallback(glfw_error_callback);
+  if (!glfwInit()) {
+    return false;
+  }
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+  GLFWwindow* window = glfwCreateWindow(64, 64, "morph_bench", NULL, NULL);
+  if (!window) {
+    glfwTerminate();
+    return false;
+  }
+  glfwMakeContextCurrent(window);
+  gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+
+  bool ok = true;
+  {
+    GraphicsState g_state(window, base_shader_path);
+    setup_opengl(g_state);
+    for (int size : zygote_sizes) {
+      MorphNodes nodes;
+      vector<GLuint> indices;
+      gen_morph_data(ivec2(size), nodes, indices);
+      BenchResult upload("upload/" + to_string(size), "ms");
+      BenchResult readback("readback/" + to_string(size), "ms");
+      if (!time_node_transfers(g_state, nodes, reps, upload.samples,
+            readback.samples)) {
+        ok = false;
+        break;
+      }
+      results.push_back(upload);
+      results.push_back(readback);
+    }
+  }
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return ok;
+}
+
 void run_app(int argc, char** argv) {
   signal(SIGSEGV, handle_segfault);
 
@@ -802,27 +1884,21 @@ void run_app(int argc, char** argv) {
   bool show_dev_console = true;
   // for maintaining the fps
   auto start_of_frame = chrono::steady_clock::now();
-  // for logging the fps
-  int fps_stat = 0;
-  int frame_counter = 0;
-  auto start_of_sec = start_of_frame;
+  FrameStats& frame_stats = g_state.frame_stats;
 
   while (!glfwWindowShouldClose(window)) {
     std::this_thread::sleep_until(start_of_frame);
+    MORPH_TRACE_ZONE("frame");
     auto cur_time = chrono::steady_clock::now();
     int frame_dur_millis = (int) (1000.0f / g_state.controls.target_fps);
     start_of_frame = cur_time + chrono::milliseconds(frame_dur_millis);
 
-    // for logging the fps
-    frame_counter += 1;
-    if (start_of_sec < cur_time) {
-      start_of_sec = cur_time + chrono::seconds(1);
-      fps_stat = frame_counter;
-      frame_counter = 0;
-    }
+    begin_frame(frame_stats);
 
     glfwPollEvents();
     update_camera(window, g_state.controls, g_state.camera);
+    begin_gpu_timer_frame(g_state.gpu_timers,
+        g_state.controls.time_gpu_passes);
 
     // the screen appears black on mojave until a resize occurs
     if (requires_mac_mojave_fix) {
@@ -830,16 +1906,79 @@ void run_app(int argc, char** argv) {
       glfwSetWindowSize(window, target_width, target_height + 1);
     }
     
+    // the UI runs the simulation, so the zone includes it
+    MORPH_TRACE_BEGIN(imgui_zone, "imgui");
+    switch_frame_phase(frame_stats, FRAME_PHASE_UI);
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
     ImGui::Begin("dev console", &show_dev_console);
     ImGui::DragInt("target fps", &g_state.controls.target_fps, 1.0f, 0, 100);
-    ImGui::Text("current fps: %d", fps_stat);
 
     Controls& controls = g_state.controls;
 
+    // the frame times, in place of a frames per second count, so that
+    // the stutters of a full re-simulation show
+    float frame_budget_ms = controls.target_fps > 0 ?
+      1000.0f / controls.target_fps : 0.0f;
+    FramePercentiles frame_pcts = compute_frame_percentiles(frame_stats,
+        FRAME_SERIES_INTERVAL, frame_budget_ms);
+    if (frame_pcts.num_frames > 0) {
+      ImGui::Text("fps: %.1f (median frame), %d of the last %d frames late",
+          1000.0f / std::max(frame_pcts.p50, 1e-3f),
+          frame_pcts.num_over_budget, frame_pcts.num_frames);
+      // up to 4 frame budgets, with longer frames in the last bucket
+      float hist_max_ms = frame_budget_ms > 0.0f ?
+        4.0f * frame_budget_ms : std::max(frame_pcts.max, 1.0f);
+      vector<float> hist = frame_time_histogram(frame_stats,
+          FRAME_SERIES_INTERVAL, 32, hist_max_ms);
+      char hist_label[64];
+      snprintf(hist_label, sizeof(hist_label), "0 to %.0fms", hist_max_ms);
+      ImGui::PlotHistogram("frame times", hist.data(), hist.size(), 0,
+          hist_label, 0.0f, FLT_MAX, ImVec2(0, 50));
+      ImGui::Text("%-7s %7s %7s %7s %7s %7s", "ms", "p50", "p95", "p99",
+          "max", "over");
+      for (int series = FRAME_SERIES_COUNT - 1; series >= 0; --series) {
+        float budget_ms = series < FRAME_PHASE_COUNT ?
+          controls.phase_budgets_ms[series] :
+          series == FRAME_SERIES_INTERVAL ? frame_budget_ms : 0.0f;
+        FramePercentiles pcts = compute_frame_percentiles(frame_stats,
+            series, budget_ms);
+        ImGui::Text("%-7s %7.2f %7.2f %7.2f %7.2f %7d",
+            FRAME_SERIES_NAMES[series], pcts.p50, pcts.p95, pcts.p99,
+            pcts.max, pcts.num_over_budget);
+      }
+    }
+    ImGui::DragFloat4("budgets (ms): sim, upload, render, ui",
+        controls.phase_budgets_ms.data(), 0.1f, 0.0f, 1000.0f, "%.1f");
+    ImGui::InputText("frame times path", controls.frame_stats_path.data(),
+        controls.frame_stats_path.size());
+    if (ImGui::Button("save frame times")) {
+      write_frame_stats_csv(frame_stats, controls.frame_stats_path.data());
+    }
+
+    ImGui::Checkbox("GPU pass times", &controls.time_gpu_passes);
+    GpuTimers const& gpu_timers = g_state.gpu_timers;
+    if (controls.time_gpu_passes && gpu_timers.num_collected > 0) {
+      ImGui::Text("ms per frame, mean (max) of the last %d frames:",
+          std::min(gpu_timers.num_collected, GPU_TIMER_HISTORY));
+      for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+        float mean_ms = 0.0f;
+        float max_ms = 0.0f;
+        gpu_pass_stats(gpu_timers, pass, mean_ms, max_ms);
+        ImGui::Text("%s: %.3f (%.3f)", GPU_PASS_NAMES[pass], mean_ms, max_ms);
+      }
+      if (gpu_timers.last_num_untimed > 0) {
+        ImGui::Text("%d passes of a recent frame were not timed",
+            gpu_timers.last_num_untimed);
+      }
+      if (gpu_timers.num_dropped > 0) {
+        ImGui::Text("%d frames dropped with bogus times",
+            gpu_timers.num_dropped);
+      }
+    }
+
     ImGui::Separator();
     ImGui::Text("camera:");
     ImGui::Text("eye: %s", vec3_str(g_state.camera.pos()).c_str());
@@ -879,13 +2018,73 @@ void run_app(int argc, char** argv) {
     ImGui::Text("init data:");
     ImGui::InputInt("AxA samples", &controls.num_zygote_samples);
     controls.num_zygote_samples = std::max(controls.num_zygote_samples, 0);
+    ImGui::Combo("node order", &controls.node_order,
+        NODE_ORDER_NAMES, NODE_ORDER_COUNT);
     
     ImGui::Text("simulation:"); 
+    vector<const char*> backend_names = {"GL (transform feedback)", "CPU"};
+    ImGui::Combo("backend", &controls.sim_backend,
+        backend_names.data(), backend_names.size());
+    if (controls.sim_backend == SIM_BACKEND_GL) {
+      ImGui::Checkbox("compact nodes (lossy)", &controls.compact_nodes);
+    }
+    if (controls.sim_backend == SIM_BACKEND_CPU) {
+      ImGui::InputInt("CPU threads (0 = all)", &controls.num_sim_threads);
+      controls.num_sim_threads = std::max(controls.num_sim_threads, 0);
+      ImGui::Checkbox("SIMD kernels", &controls.use_simd_kernels);
+      ImGui::Checkbox("active set", &controls.use_active_set);
+      if (controls.use_active_set) {
+        ImGui::InputFloat("active set epsilon", &controls.active_set_epsilon,
+            0.0f, 0.0f, "%g");
+        controls.active_set_epsilon = std::max(controls.active_set_epsilon,
+            0.0f);
+        ActiveSet const& active_set = m_state.cpu_state.active_set;
+        long num_node_iters = active_set.num_updates + active_set.num_skipped;
+        if (num_node_iters > 0) {
+          ImGui::Text("%.1f%% of node updates skipped in the last step",
+              100.0 * active_set.num_skipped / num_node_iters);
+        }
+      }
+      ImGui::Checkbox("background thread", &controls.background_sim);
+      BackgroundSim const& bg = g_state.background_sim;
+      if (bg.worker && bg.iter_num >= 0) {
+        ImGui::Text("drawing iter %d of %d", bg.iter_num, bg.target_iter);
+      }
+      ImGui::InputInt("node pool size", &controls.node_pool_size);
+      controls.node_pool_size = std::max(controls.node_pool_size, 0);
+      NodePool const& pool = m_state.cpu_state.node_pool;
+      if (node_pool_enabled(pool)) {
+        ImGui::Text("%d of %d nodes used, %d splices dropped",
+            m_state.num_nodes, pool.capacity, pool.num_dropped);
+      }
+    } else if (controls.node_pool_size > 0) {
+      ImGui::Text("spawning nodes needs the CPU backend");
+    }
+    update_background_sim(g_state);
+    ImGui::InputInt("GPU budget (MB, 0 = none)", &controls.gpu_budget_mb);
+    controls.gpu_budget_mb = std::max(controls.gpu_budget_mb, 0);
+    GpuBuffers const& gpu_bufs = g_state.gpu_buffers;
+    ImGui::Text("GPU buffers: %.1fMB, peak %.1fMB, %d reallocs",
+        gpu_bufs.cur_bytes / (float) (1 << 20),
+        gpu_bufs.peak_bytes / (float) (1 << 20), gpu_bufs.num_reallocs);
     int max_iter_num = 1*1000*1000*1000;
     ImGui::DragInt("iter num", &controls.num_iters, 0.2f, 0, max_iter_num);
     if (ImGui::Button("run once")) {
+      // rerun rather than continue the current session
+      g_state.morph_state.session.is_valid = false;
       run_simulation_pipeline(g_state);  
     }
+    ConvergenceCriteria& convergence = controls.convergence;
+    ImGui::InputInt("check interval", &convergence.check_interval);
+    convergence.check_interval = std::max(convergence.check_interval, 1);
+    ImGui::InputFloat("max disp tolerance", &convergence.disp_tol,
+        0.0f, 0.0f, "%g");
+    ImGui::InputFloat("heat change tolerance", &convergence.heat_tol,
+        0.0f, 0.0f, "%g");
+    ImGui::InputInt("max iters", &convergence.max_iters);
+    if (ImGui::Button("run to convergence")) {
+      run_to_convergence(g_state);
+    }
     ImGui::Text("animation:");
     string anim_btn_text(controls.animating_sim ? "PAUSE" : "PLAY");
     if (ImGui::Button(anim_btn_text.c_str())) {
@@ -895,6 +2094,19 @@ void run_app(int argc, char** argv) {
     ImGui::DragInt("end iter", &controls.end_iter_num, 10.0f, controls.start_iter_num, max_iter_num);
     ImGui::DragInt("delta iters per frame", &controls.delta_iters, 0.2f, -10, 10);
     ImGui::Checkbox("loop at end", &controls.loop_at_end);
+    ImGui::Checkbox("checkpoints", &controls.use_checkpoints);
+    if (controls.use_checkpoints) {
+      ImGui::InputInt("checkpoint interval", &controls.checkpoint_interval);
+      controls.checkpoint_interval = std::max(controls.checkpoint_interval, 1);
+      ImGui::InputInt("checkpoint budget (MB)",
+          &controls.checkpoint_budget_mb);
+      CheckpointCache& cache = g_state.morph_state.checkpoints;
+      ImGui::Text("%d checkpoints, %.1fMB", (int) cache.checkpoints.size(),
+          cache.num_bytes / (1024.0 * 1024.0));
+    }
+    if (ImGui::Button("clear checkpoints")) {
+      clear_checkpoints(g_state.morph_state.checkpoints);
+    }
     
     // run the animation
     if (controls.animating_sim) {
@@ -906,6 +2118,33 @@ void run_app(int argc, char** argv) {
       }
       run_simulation_pipeline(g_state);
     }
+    // the background simulation follows the controls even when paused,
+    // and is drawn whenever it has a new state
+    if (g_state.background_sim.worker) {
+      submit_background_sim(g_state);
+      if (!upload_background_sim_state(g_state)) {
+        printf("background simulation stopped, the GPU buffers are too "
+            "small for it\n");
+        controls.background_sim = false;
+      }
+    }
+
+    ImGui::Text("snapshot:");
+    ImGui::InputText("path", controls.snapshot_path.data(),
+        controls.snapshot_path.size());
+    if (ImGui::Button("save snapshot")) {
+      save_snapshot(g_state, controls.snapshot_path.data());
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("load snapshot")) {
+      load_snapshot(g_state, controls.snapshot_path.data());
+    }
+    ImGui::Text("mesh export:");
+    ImGui::InputText("mesh path (.ply/.obj)", controls.mesh_path.data(),
+        controls.mesh_path.size());
+    if (ImGui::Button("export mesh")) {
+      export_result_mesh(g_state, controls.mesh_path.data());
+    }
 
     ImGui::Separator();
     ImGui::Text("debug");
@@ -914,6 +2153,13 @@ void run_app(int argc, char** argv) {
     ImGui::Checkbox("log output nodes", &controls.log_output_nodes);
     ImGui::Checkbox("log render data", &controls.log_render_data);
     ImGui::Checkbox("log durations", &controls.log_durations);
+    if (TRACING_COMPILED_IN) {
+      ImGui::InputText("trace path", controls.trace_path.data(),
+          controls.trace_path.size());
+      if (ImGui::Button("save trace")) {
+        write_trace_json(controls.trace_path.data());
+      }
+    }
     // do not log while animating, the IO becomes a bottleneck
     if (controls.animating_sim) {
       controls.log_input_nodes = false;
@@ -929,6 +2175,8 @@ void run_app(int argc, char** argv) {
     ImGui::End();
 
     ImGui::Render();
+    MORPH_TRACE_END(imgui_zone);
+    switch_frame_phase(frame_stats, FRAME_PHASE_RENDER);
     int fb_width = 0;
     int fb_height = 0;
     glfwGetFramebufferSize(window, &fb_width, &fb_height);
@@ -942,9 +2190,14 @@ void run_app(int argc, char** argv) {
     g_state.render_state.fb_height = fb_height;
     render_frame(g_state);
 
+    switch_frame_phase(frame_stats, FRAME_PHASE_UI);
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    // the swap may wait for vsync, so it is not counted as work
+    end_frame_work(frame_stats);
     
+    MORPH_TRACE_BEGIN(swap_zone, "glfwSwapBuffers");
     glfwSwapBuffers(window);
+    MORPH_TRACE_END(swap_zone);
   }
 
   ImGui_ImplOpenGL3_Shutdown();
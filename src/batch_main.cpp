@@ -0,0 +1,364 @@
+// Headless driver: runs a morph program on the CPU backend and writes
+// the final state to disk. Does not depend on GLFW, ImGui, or a GL
+// context.
+
+#include "types.h"
+#include "cpu_sim.h"
+#include "prog_file.h"
+#include "morph_data.h"
+#include "snapshot.h"
+#include "mesh_export.h"
+#include "node_order.h"
+#include "node_pool.h"
+#include "domain_decomp.h"
+#include "trace.h"
+
+#include <chrono>
+#include <cstring>
+
+const char* BATCH_USAGE_STRING = R"--(usage:
+
+morph_batch shader_file [options]
+
+options:
+  -n samples       the zygote is samples x samples nodes (default 100)
+  -i iters         the number of iterations to run (default 100)
+  -t threads       CPU threads, 0 for one per core (default 0)
+  -u name=x[,y..]  override the value of a user uniform
+  -r order         the order of the nodes in memory: row-major, morton,
+                   hilbert, rcm or tiled (default row-major). The output
+                   is always in row-major order
+  -p pool_size     preallocate pool_size nodes for sources to splice into
+                   the mesh (the spawn_prob uniform), 0 to disable
+                   spawning (default 0)
+  -a epsilon       only update the nodes near one that moved or changed
+                   heat by more than epsilon in the last iteration (the
+                   active set). 0 gives the same result as without -a
+  -o file          the output file (default morph_nodes.csv). A name
+                   ending in .snap writes a binary snapshot instead, and
+                   .ply or .obj a mesh
+  --converge d[,h] run until no node moves more than d and the total
+                   heat changes by no more than h (default 1e-3) over
+                   a check interval, with -i as the most iterations
+  --check k        the iterations between convergence checks (default 10)
+  --procs n        split the zygote across n worker processes, which
+                   exchange halos through shared memory. Always scalar,
+                   and not with -p, -a or --converge
+  --scaling n      print a strong and weak scaling report of --procs
+                   for 1 up to n workers, instead of writing any output
+  --no-simd        do not use the SIMD kernels
+  --locality       report the simulated cache misses of the neighbor
+                   gathers in the chosen order
+  --trace file     write the trace zones to file as a Chrome trace, if
+                   built with MORPH_TRACING
+
+ex. morph_batch ../shaders/growth.glsl -n 200 -i 600 -u cloning_interval=60
+)--";
+
+struct BatchArgs {
+  string prog_filename;
+  string out_filename = "morph_nodes.csv";
+  // empty for no trace
+  string trace_filename;
+  int num_zygote_samples = 100;
+  int num_iters = 100;
+  int num_threads = 0;
+  bool use_simd_kernels = true;
+  // negative if -a was not given
+  float active_set_epsilon = -1.0f;
+  int node_order = NODE_ORDER_ROW_MAJOR;
+  int node_pool_size = 0;
+  bool report_locality = false;
+  bool run_to_convergence = false;
+  ConvergenceCriteria convergence;
+  // 0 to run in this process
+  int num_procs = 0;
+  int max_scaling_procs = 0;
+  // {name, value} pairs from -u
+  vector<pair<string, string>> unif_overrides;
+};
+
+// Returns false if the args are invalid
+bool parse_batch_args(int argc, char** argv, BatchArgs& args) {
+  if (argc < 2) {
+    return false;
+  }
+  args.prog_filename = argv[1];
+  for (int i = 2; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "--no-simd") {
+      args.use_simd_kernels = false;
+      continue;
+    } else if (arg == "--locality") {
+      args.report_locality = true;
+      continue;
+    }
+    if (i + 1 == argc) {
+      printf("missing value for %s\n", arg.c_str());
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "-n") {
+      args.num_zygote_samples = atoi(value);
+    } else if (arg == "-i") {
+      args.num_iters = atoi(value);
+    } else if (arg == "-t") {
+      args.num_threads = atoi(value);
+    } else if (arg == "-r") {
+      args.node_order = node_order_for_name(value);
+      if (args.node_order == -1) {
+        printf("unknown node order: %s\n", value);
+        return false;
+      }
+    } else if (arg == "-p") {
+      args.node_pool_size = atoi(value);
+    } else if (arg == "-a") {
+      args.active_set_epsilon = atof(value);
+      if (args.active_set_epsilon < 0.0f) {
+        printf("the active set epsilon must be >= 0\n");
+        return false;
+      }
+    } else if (arg == "-o") {
+      args.out_filename = value;
+    } else if (arg == "--trace") {
+      args.trace_filename = value;
+    } else if (arg == "--converge") {
+      args.run_to_convergence = true;
+      ConvergenceCriteria& convergence = args.convergence;
+      if (sscanf(value, "%f,%f", &convergence.disp_tol,
+            &convergence.heat_tol) < 1) {
+        printf("expected disp_tol[,heat_tol], got: %s\n", value);
+        return false;
+      }
+    } else if (arg == "--check") {
+      args.convergence.check_interval = atoi(value);
+    } else if (arg == "--procs") {
+      args.num_procs = atoi(value);
+    } else if (arg == "--scaling") {
+      args.max_scaling_procs = atoi(value);
+    } else if (arg == "-u") {
+      const char* eq = strchr(value, '=');
+      if (!eq) {
+        printf("expected name=value, got: %s\n", value);
+        return false;
+      }
+      args.unif_overrides.push_back(
+          make_pair(string(value, eq - value), string(eq + 1)));
+    } else {
+      printf("unknown option: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  if (args.num_procs > 0 && (args.node_pool_size > 0 ||
+        args.active_set_epsilon >= 0.0f ||
+        args.run_to_convergence)) {
+    printf("--procs does not work with -p, -a or --converge\n");
+    return false;
+  }
+  return args.num_zygote_samples >= 2 && args.num_iters >= 0 &&
+    args.node_pool_size >= 0 && args.convergence.check_interval >= 1 &&
+    args.num_procs >= 0 && args.max_scaling_procs >= 0;
+}
+
+// Times run_domain_simulation with 1 up to max_procs workers (in powers
+// of 2), on a row-major zygote of num_samples x num_samples nodes for
+// strong scaling, and of num_samples * sqrt(workers) a side for weak
+// scaling
+void print_scaling_report(GrowthParams const& params, int num_samples,
+    int num_iters, int max_procs) {
+  vector<int> procs_counts;
+  for (int procs = 1; procs < max_procs; procs *= 2) {
+    procs_counts.push_back(procs);
+  }
+  procs_counts.push_back(max_procs);
+
+  for (int weak = 0; weak < 2; ++weak) {
+    printf("%s scaling, %d iters:\n"
+        "procs  nodes     halo    wall_ms  speedup  efficiency  exchange\n",
+        weak ? "weak" : "strong", num_iters);
+    double base_ms = 0.0;
+    for (int procs : procs_counts) {
+      int samples = weak ?
+        (int) roundf(num_samples * sqrtf((float) procs)) : num_samples;
+      CpuMorphState cpu_state;
+      vector<GLuint> indices;
+      gen_morph_data(ivec2(samples), cpu_state.buffers[0], indices);
+      DomainStats stats;
+      if (!run_domain_simulation(cpu_state, params, 0, num_iters, procs,
+            &stats)) {
+        return;
+      }
+      double compute_ms = 0.0;
+      double exchange_ms = 0.0;
+      for (int p = 0; p < procs; ++p) {
+        compute_ms += stats.compute_ms[p];
+        exchange_ms += stats.exchange_ms[p];
+      }
+      if (procs == 1) {
+        base_ms = stats.wall_ms;
+      }
+      // for weak scaling the work grows with the workers, so the ideal
+      // is the time of one worker
+      double speedup = base_ms / stats.wall_ms * (weak ? procs : 1);
+      printf("%5d  %-8d  %-6d  %7.1f  %7.2f  %10.2f  %7.1f%%\n",
+          procs, samples * samples, stats.num_halo_nodes, stats.wall_ms,
+          speedup, speedup / procs,
+          100.0 * exchange_ms / std::max(compute_ms + exchange_ms, 1e-9));
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  auto start_time = chrono::steady_clock::now();
+
+  BatchArgs args;
+  if (!parse_batch_args(argc, argv, args)) {
+    printf("%s", BATCH_USAGE_STRING);
+    return 1;
+  }
+
+  string prog_text;
+  vector<UserUnif> user_unifs;
+  if (!read_prog_file(args.prog_filename, prog_text, user_unifs)) {
+    return 1;
+  }
+  for (auto const& unif_override : args.unif_overrides) {
+    if (!override_user_unif(user_unifs,
+          unif_override.first, unif_override.second)) {
+      return 1;
+    }
+  }
+  GrowthParams params(user_unifs);
+  if (args.max_scaling_procs > 0) {
+    print_scaling_report(params, args.num_zygote_samples, args.num_iters,
+        args.max_scaling_procs);
+    return 0;
+  }
+
+  Controls controls;
+  controls.sim_backend = SIM_BACKEND_CPU;
+  controls.num_zygote_samples = args.num_zygote_samples;
+  controls.node_order = args.node_order;
+  controls.num_iters = args.num_iters;
+  controls.num_sim_threads = args.num_threads;
+  controls.use_simd_kernels = args.use_simd_kernels;
+  controls.node_pool_size = args.node_pool_size;
+  controls.use_active_set = args.active_set_epsilon >= 0.0f;
+  if (controls.use_active_set) {
+    controls.active_set_epsilon = args.active_set_epsilon;
+  }
+
+  CpuMorphState cpu_state;
+  vector<GLuint> indices;
+  seed_cpu_state(cpu_state, controls, indices);
+  int num_zygote_nodes = cpu_state.buffers[0].size();
+  NodePool& node_pool = cpu_state.node_pool;
+  auto init_time = chrono::steady_clock::now();
+
+  int num_iters = args.num_iters;
+  if (args.run_to_convergence) {
+    ConvergenceCriteria convergence = args.convergence;
+    convergence.max_iters = args.num_iters;
+    SimResidual residual;
+    num_iters = run_cpu_to_convergence(cpu_state, params, 0, convergence,
+        controls, residual);
+    if (num_iters == 0) {
+      // no check ran, so there is no residual to report
+      printf("--converge ran no iterations, as -i is 0\n");
+    } else {
+      printf("%s at iter %d: max disp %g, mean disp %g, heat change %g\n",
+          residual_converged(residual, convergence) ?
+            "converged" : "did not converge", num_iters, residual.max_disp,
+          residual.mean_disp, residual.heat_change);
+    }
+  } else if (args.num_procs > 0) {
+    DomainStats stats;
+    if (!run_domain_simulation(cpu_state, params, 0, num_iters,
+          args.num_procs, &stats)) {
+      return 1;
+    }
+    printf("%d workers, %d halo nodes\n", args.num_procs,
+        stats.num_halo_nodes);
+  } else {
+    run_cpu_simulation(cpu_state, params, 0, num_iters, controls);
+  }
+  auto sim_time = chrono::steady_clock::now();
+
+  MorphNodes& result = cpu_state.buffers[cpu_state.result_buffer_index];
+  if (args.report_locality) {
+    LocalityStats l1_stats = measure_locality(result, 32 << 10);
+    LocalityStats l2_stats = measure_locality(result, 1 << 20);
+    printf("order %s: mean neighbor dist %.1f, max %d\n"
+        "gather misses per node: %.3f (32KB cache), %.3f (1MB cache)\n",
+        NODE_ORDER_NAMES[args.node_order], l1_stats.mean_neighbor_dist,
+        l1_stats.max_neighbor_dist, l1_stats.gather_misses_per_node,
+        l2_stats.gather_misses_per_node);
+    NodeTiles const& tiles = cpu_state.tiles;
+    if (tiles.tile_count() > 0) {
+      int num_edges = 0;
+      for (ivec4 const& n : result.neighbors_vec) {
+        num_edges += (n[0] >= 0) + (n[1] >= 0) + (n[2] >= 0) + (n[3] >= 0);
+      }
+      printf("%d tiles, %lu of %d edges cross tiles (%.1f per tile)\n",
+          tiles.tile_count(), tiles.cross_edges.size(), num_edges,
+          tiles.cross_edges.size() / (double) tiles.tile_count());
+    }
+  }
+  ActiveSet const& active_set = cpu_state.active_set;
+  if (controls.use_active_set) {
+    long num_node_iters = active_set.num_updates + active_set.num_skipped;
+    printf("active set: %ld of %ld node updates skipped (%.1f%%)\n",
+        active_set.num_skipped, num_node_iters,
+        100.0 * active_set.num_skipped / std::max(num_node_iters, 1L));
+  }
+  if (node_pool_enabled(node_pool)) {
+    printf("%d nodes spliced in, %d splices dropped (pool of %d)\n",
+        (int) result.size() - num_zygote_nodes, node_pool.num_dropped,
+        args.node_pool_size);
+    indices = node_pool.indices;
+  }
+  // write in the row-major order, which the spliced nodes follow
+  if (!cpu_state.node_ids.empty()) {
+    vector<int> node_ids = extend_permutation(cpu_state.node_ids,
+        result.size());
+    permute_nodes(invert_permutation(node_ids), result, indices);
+  }
+  string const& out_filename = args.out_filename;
+  size_t ext_pos = out_filename.rfind(".snap");
+  int mesh_format = mesh_format_for_path(out_filename);
+  if (ext_pos != string::npos && ext_pos + 5 == out_filename.size()) {
+    if (!write_snapshot(out_filename, num_iters,
+          args.num_zygote_samples, user_unifs, result, indices)) {
+      return 1;
+    }
+  } else if (mesh_format != -1) {
+    if (!export_mesh(out_filename, mesh_format, result.pos_vec.size(),
+          result.pos_vec.data(), result.vel_vec.data(),
+          indices.size(), indices.data())) {
+      return 1;
+    }
+  } else {
+    FILE* out_file = fopen(out_filename.c_str(), "w");
+    if (!out_file) {
+      printf("could not open %s for writing\n", out_filename.c_str());
+      return 1;
+    }
+    write_nodes_csv(out_file, result);
+    fclose(out_file);
+  }
+  auto end_time = chrono::steady_clock::now();
+
+  auto to_ms = [](chrono::steady_clock::duration d) {
+    return chrono::duration<double, milli>(d).count();
+  };
+  printf("%d nodes, %d iters\ninit: %.1fms\nsim: %.1fms\nwrite: %.1fms\n",
+      num_zygote_nodes, num_iters,
+      to_ms(init_time - start_time), to_ms(sim_time - init_time),
+      to_ms(end_time - sim_time));
+  if (!args.trace_filename.empty() &&
+      !write_trace_json(args.trace_filename)) {
+    return 1;
+  }
+  return 0;
+}
+
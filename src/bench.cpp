@@ -0,0 +1,246 @@
+#include "bench.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+BenchResult::BenchResult()
+{
+}
+
+BenchResult::BenchResult(string name, string unit) :
+  name(name), unit(unit)
+{
+}
+
+WelchTest::WelchTest() :
+  t(0.0),
+  dof(0.0),
+  p(1.0)
+{
+}
+
+bool write_bench_json(string const& path, string const& shader_path,
+    vector<BenchResult> const& results) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    printf("could not open %s for writing\n", path.c_str());
+    return false;
+  }
+  // the names are ours and need no escaping, but a path might
+  string escaped_path;
+  for (char c : shader_path) {
+    if (c == '"' || c == '\\') {
+      escaped_path += '\\';
+    }
+    escaped_path += c;
+  }
+  fprintf(file, "{\n  \"shader\": \"%s\",\n  \"results\": [\n",
+      escaped_path.c_str());
+  for (int i = 0; i < results.size(); ++i) {
+    BenchResult const& result = results[i];
+    fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": [",
+        result.name.c_str(), result.unit.c_str());
+    for (int s = 0; s < result.samples.size(); ++s) {
+      fprintf(file, "%s%.9g", s > 0 ? ", " : "", result.samples[s]);
+    }
+    fprintf(file, "]}%s\n", i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return true;
+}
+
+// Returns the string value of the next "key": "value" at or after pos,
+// moving pos past it, or false if there is none before end
+static bool read_json_string(string const& text, const char* key,
+    size_t& pos, size_t end, string& value) {
+  string quoted_key = string("\"") + key + "\"";
+  size_t key_pos = text.find(quoted_key, pos);
+  if (key_pos == string::npos || key_pos >= end) {
+    return false;
+  }
+  size_t begin = text.find('"', text.find(':', key_pos) + 1);
+  size_t close = text.find('"', begin + 1);
+  if (begin == string::npos || close == string::npos || close > end) {
+    return false;
+  }
+  value = text.substr(begin + 1, close - begin - 1);
+  pos = close + 1;
+  return true;
+}
+
+bool read_bench_json(string const& path, vector<BenchResult>& results) {
+  ifstream file(path);
+  if (!file) {
+    printf("could not open %s\n", path.c_str());
+    return false;
+  }
+  stringstream buffer;
+  buffer << file.rdbuf();
+  string text = buffer.str();
+
+  results.clear();
+  size_t pos = text.find("\"results\"");
+  if (pos == string::npos) {
+    printf("%s: no results\n", path.c_str());
+    return false;
+  }
+  // each result is one {...} object, with no nested objects
+  while ((pos = text.find('{', pos)) != string::npos) {
+    size_t end = text.find('}', pos);
+    if (end == string::npos) {
+      break;
+    }
+    BenchResult result;
+    size_t samples_pos = text.find("\"samples\"", pos);
+    size_t list_begin = text.find('[', samples_pos);
+    size_t list_end = text.find(']', list_begin);
+    if (!read_json_string(text, "name", pos, end, result.name) ||
+        !read_json_string(text, "unit", pos, end, result.unit) ||
+        samples_pos >= end || list_end == string::npos || list_end > end) {
+      printf("%s: could not parse a result\n", path.c_str());
+      return false;
+    }
+    string list = text.substr(list_begin + 1, list_end - list_begin - 1);
+    const char* s = list.c_str();
+    char* num_end = nullptr;
+    while (true) {
+      double sample = strtod(s, &num_end);
+      if (num_end == s) {
+        break;
+      }
+      result.samples.push_back(sample);
+      s = num_end + strspn(num_end, ", \n");
+    }
+    results.push_back(result);
+    pos = end + 1;
+  }
+  return true;
+}
+
+static double mean_of(vector<double> const& v) {
+  double sum = 0.0;
+  for (double x : v) {
+    sum += x;
+  }
+  return sum / v.size();
+}
+
+static double variance_of(vector<double> const& v, double mean) {
+  double sum = 0.0;
+  for (double x : v) {
+    sum += (x - mean) * (x - mean);
+  }
+  return sum / (v.size() - 1);
+}
+
+// The continued fraction of the incomplete beta function, by the
+// modified Lentz method
+static double beta_continued_fraction(double a, double b, double x) {
+  const double tiny = 1e-300;
+  double qab = a + b;
+  double qap = a + 1.0;
+  double qam = a - 1.0;
+  double c = 1.0;
+  double d = 1.0 - qab * x / qap;
+  d = 1.0 / (fabs(d) < tiny ? tiny : d);
+  double h = d;
+  for (int m = 1; m <= 300; ++m) {
+    int m2 = 2 * m;
+    double aa = m * (b - m) * x / ((qam + m2) * (a + m2));
+    d = 1.0 + aa * d;
+    d = 1.0 / (fabs(d) < tiny ? tiny : d);
+    c = 1.0 + aa / c;
+    c = fabs(c) < tiny ? tiny : c;
+    h *= d * c;
+    aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2));
+    d = 1.0 + aa * d;
+    d = 1.0 / (fabs(d) < tiny ? tiny : d);
+    c = 1.0 + aa / c;
+    c = fabs(c) < tiny ? tiny : c;
+    double delta = d * c;
+    h *= delta;
+    if (fabs(delta - 1.0) < 1e-12) {
+      break;
+    }
+  }
+  return h;
+}
+
+// The regularized incomplete beta function I_x(a, b)
+static double incomplete_beta(double a, double b, double x) {
+  if (x <= 0.0) {
+    return 0.0;
+  }
+  if (x >= 1.0) {
+    return 1.0;
+  }
+  double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+      a * log(x) + b * log(1.0 - x));
+  // the continued fraction converges quickly on this side of the mean
+  if (x < (a + 1.0) / (a + b + 2.0)) {
+    return front * beta_continued_fraction(a, b, x) / a;
+  }
+  return 1.0 - front * beta_continued_fraction(b, a, 1.0 - x) / b;
+}
+
+WelchTest welch_t_test(vector<double> const& a, vector<double> const& b) {
+  WelchTest test;
+  if (a.size() < 2 || b.size() < 2) {
+    return test;
+  }
+  double mean_a = mean_of(a);
+  double mean_b = mean_of(b);
+  double se_a = variance_of(a, mean_a) / a.size();
+  double se_b = variance_of(b, mean_b) / b.size();
+  double se = se_a + se_b;
+  if (se == 0.0) {
+    // no noise at all, so any difference is significant
+    test.p = mean_a == mean_b ? 1.0 : 0.0;
+    return test;
+  }
+  test.t = (mean_a - mean_b) / sqrt(se);
+  test.dof = se * se / (se_a * se_a / (a.size() - 1) +
+      se_b * se_b / (b.size() - 1));
+  test.p = incomplete_beta(0.5 * test.dof, 0.5,
+      test.dof / (test.dof + test.t * test.t));
+  return test;
+}
+
+int compare_bench_results(vector<BenchResult> const& baseline,
+    vector<BenchResult> const& current, double alpha, double min_change) {
+  int num_regressions = 0;
+  printf("%-22s %12s %12s %-13s %8s %8s\n", "name", "baseline", "current",
+      "unit", "change", "p");
+  for (BenchResult const& cur : current) {
+    BenchResult const* base = nullptr;
+    for (BenchResult const& result : baseline) {
+      if (result.name == cur.name) {
+        base = &result;
+      }
+    }
+    if (!base || base->samples.empty() || cur.samples.empty()) {
+      printf("%-22s not in the baseline\n", cur.name.c_str());
+      continue;
+    }
+    double base_mean = mean_of(base->samples);
+    double cur_mean = mean_of(cur.samples);
+    double change = base_mean > 0.0 ? cur_mean / base_mean - 1.0 : 0.0;
+    WelchTest test = welch_t_test(cur.samples, base->samples);
+    const char* verdict = "";
+    if (test.p < alpha && fabs(change) > min_change) {
+      if (change > 0.0) {
+        verdict = "REGRESSION";
+        ++num_regressions;
+      } else {
+        verdict = "improved";
+      }
+    }
+    printf("%-22s %12.4g %12.4g %-13s %+7.1f%% %8.3g  %s\n",
+        cur.name.c_str(), base_mean, cur_mean, cur.unit.c_str(),
+        100.0 * change, test.p, verdict);
+  }
+  return num_regressions;
+}
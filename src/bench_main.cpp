@@ -0,0 +1,235 @@
+// Benchmark suite: times the CPU backend, the seed generation and (if
+// built with the app) the GL transfers of the node state across zygote
+// sizes and thread counts, writes the samples as JSON and compares them
+// to a saved baseline. See bench.h.
+
+#include "types.h"
+#include "cpu_sim.h"
+#include "prog_file.h"
+#include "morph_data.h"
+#include "bench.h"
+#ifdef MORPH_BENCH_GL
+#include "app.h"
+#endif
+
+#include <chrono>
+#include <cstring>
+
+const char* BENCH_USAGE_STRING = R"--(usage:
+
+morph_bench shader_file [options]
+
+options:
+  -s sizes         the zygote sides to time, comma-separated
+                   (default 64,128,256,512,1024,2048,4096)
+  -t threads       the CPU thread counts to time, comma-separated, 0 for
+                   one per core (default 1,0)
+  -r reps          samples of each measurement (default 5)
+  -w work          node iterations per sim sample, so that small zygotes
+                   run for longer (default 5000000)
+  -u name=x[,y..]  override the value of a user uniform
+  -o file          the JSON output (default morph_bench.json)
+  --compare file   compare to the baseline JSON in file. Exits with 1 if
+                   any result is a significant regression
+  --alpha a        the significance level of the comparison (default 0.01)
+  --min-change c   ignore changes smaller than this fraction (default 0.02)
+  --gl path        also time the GL upload and readback of the node state,
+                   as for the app's path arg. Needs the app to be built
+  --no-simd        do not use the SIMD kernels
+
+The sim is timed in ns per node per iteration, after one warm-up
+iteration, and the seed generation and GL transfers in ms.
+
+ex. morph_bench ../shaders/growth.glsl -s 64,256,1024 -o new.json --compare base.json
+)--";
+
+struct BenchArgs {
+  string prog_filename;
+  string out_filename = "morph_bench.json";
+  string baseline_filename;
+  string gl_base_path;
+  vector<int> zygote_sizes = {64, 128, 256, 512, 1024, 2048, 4096};
+  vector<int> thread_counts = {1, 0};
+  int num_reps = 5;
+  long work = 5000000;
+  double alpha = 0.01;
+  double min_change = 0.02;
+  bool use_simd_kernels = true;
+  // {name, value} pairs from -u
+  vector<pair<string, string>> unif_overrides;
+};
+
+// Parses a comma-separated list of ints >= min_value. Returns false if
+// there is none or any is invalid.
+bool parse_int_list(const char* value, int min_value, vector<int>& out) {
+  out.clear();
+  const char* s = value;
+  while (*s) {
+    char* end = nullptr;
+    long v = strtol(s, &end, 10);
+    if (end == s || v < min_value) {
+      return false;
+    }
+    out.push_back((int) v);
+    s = *end == ',' ? end + 1 : end;
+    if (*end && *end != ',') {
+      return false;
+    }
+  }
+  return !out.empty();
+}
+
+// Returns false if the args are invalid
+bool parse_bench_args(int argc, char** argv, BenchArgs& args) {
+  if (argc < 2) {
+    return false;
+  }
+  args.prog_filename = argv[1];
+  for (int i = 2; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "--no-simd") {
+      args.use_simd_kernels = false;
+      continue;
+    }
+    if (i + 1 == argc) {
+      printf("missing value for %s\n", arg.c_str());
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "-s") {
+      if (!parse_int_list(value, 2, args.zygote_sizes)) {
+        printf("expected zygote sides >= 2, got: %s\n", value);
+        return false;
+      }
+    } else if (arg == "-t") {
+      if (!parse_int_list(value, 0, args.thread_counts)) {
+        printf("expected thread counts >= 0, got: %s\n", value);
+        return false;
+      }
+    } else if (arg == "-r") {
+      args.num_reps = atoi(value);
+    } else if (arg == "-w") {
+      args.work = atol(value);
+    } else if (arg == "-o") {
+      args.out_filename = value;
+    } else if (arg == "--compare") {
+      args.baseline_filename = value;
+    } else if (arg == "--alpha") {
+      args.alpha = atof(value);
+    } else if (arg == "--min-change") {
+      args.min_change = atof(value);
+    } else if (arg == "--gl") {
+      args.gl_base_path = value;
+    } else if (arg == "-u") {
+      const char* eq = strchr(value, '=');
+      if (!eq) {
+        printf("expected name=value, got: %s\n", value);
+        return false;
+      }
+      args.unif_overrides.push_back(
+          make_pair(string(value, eq - value), string(eq + 1)));
+    } else {
+      printf("unknown option: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  // the t-test needs 2 samples of each
+  return args.num_reps >= 2 && args.work > 0;
+}
+
+double ms_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(
+      chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+  BenchArgs args;
+  if (!parse_bench_args(argc, argv, args)) {
+    printf("%s", BENCH_USAGE_STRING);
+    return 1;
+  }
+
+  string prog_text;
+  vector<UserUnif> user_unifs;
+  if (!read_prog_file(args.prog_filename, prog_text, user_unifs)) {
+    return 1;
+  }
+  for (auto const& unif_override : args.unif_overrides) {
+    if (!override_user_unif(user_unifs,
+          unif_override.first, unif_override.second)) {
+      return 1;
+    }
+  }
+  GrowthParams params(user_unifs);
+
+  Controls controls;
+  controls.sim_backend = SIM_BACKEND_CPU;
+  controls.use_simd_kernels = args.use_simd_kernels;
+
+  vector<BenchResult> results;
+  for (int size : args.zygote_sizes) {
+    string size_name = to_string(size);
+    BenchResult seed_result("seed/" + size_name, "ms");
+    MorphNodes seed_nodes;
+    for (int r = 0; r < args.num_reps; ++r) {
+      vector<GLuint> indices;
+      auto start_time = chrono::steady_clock::now();
+      gen_morph_data(ivec2(size), seed_nodes, indices);
+      seed_result.samples.push_back(ms_since(start_time));
+    }
+    results.push_back(seed_result);
+
+    long num_nodes = seed_nodes.size();
+    int num_iters = (int) std::max(args.work / num_nodes, 1L);
+    for (int threads : args.thread_counts) {
+      BenchResult sim_result("sim/" + size_name + "/t" + to_string(threads),
+          "ns/node/iter");
+      controls.num_sim_threads = threads;
+      for (int r = 0; r < args.num_reps; ++r) {
+        // each sample runs the same iterations from the seed
+        CpuMorphState cpu_state;
+        cpu_state.buffers[0] = seed_nodes;
+        run_cpu_simulation(cpu_state, params, 0, 1, controls);
+        auto start_time = chrono::steady_clock::now();
+        run_cpu_simulation(cpu_state, params, 1, 1 + num_iters, controls);
+        double ms = ms_since(start_time);
+        sim_result.samples.push_back(1e6 * ms / (num_nodes * num_iters));
+      }
+      results.push_back(sim_result);
+      printf("%s: %.2f ns/node/iter (%d iters)\n", sim_result.name.c_str(),
+          sim_result.samples[0], num_iters);
+    }
+  }
+
+  if (!args.gl_base_path.empty()) {
+#ifdef MORPH_BENCH_GL
+    if (!time_gl_transfers(args.gl_base_path, args.zygote_sizes,
+          args.num_reps, results)) {
+      printf("could not time the GL transfers\n");
+      return 1;
+    }
+#else
+    printf("--gl needs morph_bench to be built with the app\n");
+    return 1;
+#endif
+  }
+
+  if (!write_bench_json(args.out_filename, args.prog_filename, results)) {
+    return 1;
+  }
+  printf("wrote %d results to %s\n", (int) results.size(),
+      args.out_filename.c_str());
+
+  if (!args.baseline_filename.empty()) {
+    vector<BenchResult> baseline;
+    if (!read_bench_json(args.baseline_filename, baseline)) {
+      return 1;
+    }
+    int num_regressions = compare_bench_results(baseline, results,
+        args.alpha, args.min_change);
+    printf("%d significant regressions (p < %g, change > %g%%)\n",
+        num_regressions, args.alpha, 100.0 * args.min_change);
+    return num_regressions > 0 ? 1 : 0;
+  }
+  return 0;
+}
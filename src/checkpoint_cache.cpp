@@ -0,0 +1,150 @@
+#include "checkpoint_cache.h"
+#include "node_pool.h"
+
+#include <algorithm>
+
+string checkpoint_key(MorphProgram const& prog, Controls const& controls) {
+  array<char, 200> s;
+  // the active set epsilon changes the result unless it is 0
+  float active_set_epsilon = controls.use_active_set ?
+    controls.active_set_epsilon : 0.0f;
+  // the name is a path of any length, so it is not formatted
+  // the compact encoding rounds the nodes, and only the GL backend has it
+  bool compact_nodes = controls.compact_nodes &&
+    controls.sim_backend == SIM_BACKEND_GL && prog.compact_gl_handle != 0;
+  string key = prog.name;
+  snprintf(s.data(), s.size(), "|%d|%d|%d|%d|%a|%d",
+      controls.sim_backend, controls.num_zygote_samples, controls.node_order,
+      controls.node_pool_size, active_set_epsilon, compact_nodes);
+  key += s.data();
+  // %a prints the exact float, so any change to a uniform gives a new key
+  for (UserUnif const& user_unif : prog.user_unifs) {
+    vec4 v = user_unif.cur_val;
+    snprintf(s.data(), s.size(), "|%a,%a,%a,%a", v[0], v[1], v[2], v[3]);
+    key += s.data();
+  }
+  return key;
+}
+
+SimCheckpoint* find_checkpoint(CheckpointCache& cache,
+    string const& key, int max_iter_num) {
+  SimCheckpoint* best = nullptr;
+  for (SimCheckpoint& cp : cache.checkpoints) {
+    if (cp.key == key && cp.iter_num <= max_iter_num &&
+        (!best || cp.iter_num > best->iter_num)) {
+      best = &cp;
+    }
+  }
+  if (best) {
+    best->last_use = ++cache.use_count;
+  }
+  return best;
+}
+
+bool has_checkpoint(CheckpointCache const& cache,
+    string const& key, int iter_num) {
+  for (SimCheckpoint const& cp : cache.checkpoints) {
+    if (cp.key == key && cp.iter_num == iter_num) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void delete_checkpoint_data(SimCheckpoint& cp) {
+  if (cp.vbos[0] != 0) {
+    glDeleteBuffers(cp.vbos.size(), cp.vbos.data());
+    cp.vbos.fill(0);
+  }
+  cp.nodes = MorphNodes();
+  cp.node_pool = NodePool();
+}
+
+void trim_checkpoints(CheckpointCache& cache, size_t budget_bytes) {
+  vector<SimCheckpoint>& cps = cache.checkpoints;
+  while (cache.num_bytes > budget_bytes && !cps.empty()) {
+    auto lru = std::min_element(cps.begin(), cps.end(),
+        [](SimCheckpoint const& a, SimCheckpoint const& b) {
+          return a.last_use < b.last_use;
+        });
+    cache.num_bytes -= lru->num_bytes;
+    delete_checkpoint_data(*lru);
+    cps.erase(lru);
+  }
+}
+
+void add_checkpoint(MorphState& m_state, string const& key,
+    int iter_num, int sim_backend) {
+  CheckpointCache& cache = m_state.checkpoints;
+  // the CPU backend may have spliced nodes in since m_state.num_nodes
+  // was set
+  int num_nodes = m_state.num_nodes;
+  NodePool const& node_pool = m_state.cpu_state.node_pool;
+  if (sim_backend == SIM_BACKEND_CPU) {
+    num_nodes = m_state.cpu_state.buffers[iter_num & 1].size();
+  }
+  // every MorphNode member is 16 bytes
+  size_t buf_size = num_nodes * sizeof(vec4);
+  size_t num_bytes = MORPH_BUF_COUNT * buf_size;
+  if (sim_backend == SIM_BACKEND_CPU && node_pool_enabled(node_pool)) {
+    // roughly, as each index is also in node_tris
+    num_bytes += 2 * node_pool.indices.size() * sizeof(GLuint);
+  }
+  if (num_bytes > cache.budget_bytes) {
+    return;
+  }
+  trim_checkpoints(cache, cache.budget_bytes - num_bytes);
+
+  SimCheckpoint cp;
+  cp.key = key;
+  cp.iter_num = iter_num;
+  cp.sim_backend = sim_backend;
+  cp.num_nodes = num_nodes;
+  cp.num_bytes = num_bytes;
+  cp.last_use = ++cache.use_count;
+  if (sim_backend == SIM_BACKEND_CPU) {
+    cp.nodes = m_state.cpu_state.buffers[iter_num & 1];
+    cp.node_pool = node_pool;
+  } else {
+    // copy on the GPU, without a round trip through the CPU
+    MorphBuffer& src_buf = m_state.buffers[iter_num & 1];
+    glGenBuffers(cp.vbos.size(), cp.vbos.data());
+    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+      glBindBuffer(GL_COPY_READ_BUFFER, src_buf.vbos[i]);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, cp.vbos[i]);
+      glBufferData(GL_COPY_WRITE_BUFFER, buf_size, nullptr, GL_STATIC_COPY);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+          0, 0, buf_size);
+    }
+    log_gl_errors("add checkpoint");
+  }
+  cache.checkpoints.push_back(std::move(cp));
+  cache.num_bytes += num_bytes;
+}
+
+void restore_checkpoint(MorphState& m_state, SimCheckpoint const& cp) {
+  if (cp.sim_backend == SIM_BACKEND_CPU) {
+    m_state.cpu_state.buffers[cp.iter_num & 1] = cp.nodes;
+    m_state.cpu_state.node_pool = cp.node_pool;
+  } else {
+    size_t buf_size = cp.num_nodes * sizeof(vec4);
+    MorphBuffer& dst_buf = m_state.buffers[cp.iter_num & 1];
+    for (int i = 0; i < MORPH_BUF_COUNT; ++i) {
+      glBindBuffer(GL_COPY_READ_BUFFER, cp.vbos[i]);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, dst_buf.vbos[i]);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+          0, 0, buf_size);
+    }
+    log_gl_errors("restore checkpoint");
+  }
+  m_state.num_nodes = cp.num_nodes;
+}
+
+void clear_checkpoints(CheckpointCache& cache) {
+  for (SimCheckpoint& cp : cache.checkpoints) {
+    delete_checkpoint_data(cp);
+  }
+  cache.checkpoints.clear();
+  cache.num_bytes = 0;
+}
+
@@ -0,0 +1,886 @@
+#include "cpu_sim.h"
+#include "cpu_sim_simd.h"
+#include "philox.h"
+#include "node_pool.h"
+#include "morph_data.h"
+#include "node_order.h"
+#include "trace.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+// Note: the functions below mirror those of the same name in
+// shaders/growth.glsl. Keep the two in sync.
+
+// the value of pi used by growth.glsl
+static const float shader_pi = 3.141592f;
+
+GrowthParams::GrowthParams()
+{
+}
+
+GrowthParams::GrowthParams(vector<UserUnif> const& user_unifs)
+{
+  // each pair is {uniform name, destination}
+  vector<pair<const char*, vec4*>> targets = {
+    {"fix_positions", &fix_positions},
+    {"norm_src_pos", &norm_src_pos},
+    {"init_src_dir", &init_src_dir},
+    {"src_heat_gen_rate", &src_heat_gen_rate},
+    {"heat_transfer_coeff", &heat_transfer_coeff},
+    {"target_spring_len", &target_spring_len},
+    {"spring_coeffs", &spring_coeffs},
+    {"force_coeffs", &force_coeffs},
+    {"src_trans_probs", &src_trans_probs},
+    {"cloning_coeffs", &cloning_coeffs},
+    {"cloning_interval", &cloning_interval},
+    {"noise_seed", &noise_seed},
+    {"spawn_prob", &spawn_prob},
+  };
+  for (auto& target : targets) {
+    bool found = false;
+    for (UserUnif const& user_unif : user_unifs) {
+      if (user_unif.name == target.first) {
+        *target.second = user_unif.cur_val;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      printf("cpu sim: WARNING user unif \"%s\" not found\n", target.first);
+    }
+  }
+}
+
+uint32_t GrowthParams::seed() const {
+  // as uint(noise_seed.x) in the shader
+  return (uint32_t) std::max(noise_seed.x, 0.0f);
+}
+
+static vec4 node_noise(GrowthParams const& params, int node_index,
+    int iter_num, NoiseStream stream) {
+  vec4 noise;
+  node_noise(params.seed(), node_index, iter_num, stream, &noise[0]);
+  return noise;
+}
+
+static MorphNode run_init_iter(GrowthParams const& params,
+    MorphNodes const& cur, int node_index, int node_id) {
+  int num_nodes = cur.pos_vec.size();
+  int side_len = (int) sqrt((float) num_nodes);
+  int target_src_id = (int) (num_nodes * params.norm_src_pos.x +
+      0.5f * side_len);
+  MorphNode next;
+  if (node_id == target_src_id) {
+    next.vel = vec4(normalize(vec3(params.init_src_dir)),
+        params.src_heat_gen_rate.x);
+  } else {
+    next.vel = vec4(0.0);
+  }
+  next.pos = vec4(vec3(cur.pos_vec[node_index]), 0.0);
+  next.neighbors = cur.neighbors_vec[node_index];
+  next.data = vec4(-1.0);
+  return next;
+}
+
+static vec4 compute_heat_emit(GrowthParams const& params,
+    MorphNodes const& cur, float cur_heat, ivec4 node_neighbors) {
+  float alpha = params.heat_transfer_coeff.x;
+  vec4 out_heats(0.0);
+  for (int i = 0; i < 4; ++i) {
+    int n_index = node_neighbors[i];
+    if (n_index == -1) {
+      // treat exterior as 0-heat neighbor
+      out_heats[i] = alpha * cur_heat;
+    } else if (n_index >= 0) {
+      float n_heat = cur.pos_vec[n_index].w;
+      if (n_heat < cur_heat) {
+        out_heats[i] = alpha * (cur_heat - n_heat);
+      }
+    }
+  }
+  // normalize the amt emit out each edge so that we don't emit
+  // more than we have available
+  float total_emit = dot(out_heats, vec4(1.0));
+  if (total_emit > 0.0f) {
+    out_heats = (out_heats / total_emit) * std::min(total_emit, cur_heat);
+  }
+  return out_heats;
+}
+
+static float compute_next_heat(GrowthParams const& params,
+    MorphNodes const& cur, int node_index) {
+  vec4 pos = cur.pos_vec[node_index];
+  vec4 vel = cur.vel_vec[node_index];
+  ivec4 neighbors = cur.neighbors_vec[node_index];
+
+  vec4 my_out_heats = compute_heat_emit(params, cur, pos.w, neighbors);
+  float total_heat_out = dot(my_out_heats, vec4(1.0));
+
+  float total_heat_in = 0.0;
+  for (int i = 0; i < 4; ++i) {
+    int n_index = neighbors[i];
+    if (n_index >= 0) {
+      float other_heat = cur.pos_vec[n_index].w;
+      if (pos.w < other_heat) {
+        // the heat in from this neighbor is the heat that it emits along
+        // the edge pointing to this node
+        ivec4 other_neighbors = cur.neighbors_vec[n_index];
+        vec4 other_out_heats = compute_heat_emit(
+            params, cur, other_heat, other_neighbors);
+        total_heat_in += other_out_heats[(i + 2) % 4];
+      }
+    }
+  }
+  total_heat_in += vel.w;
+  return pos.w - total_heat_out + total_heat_in;
+}
+
+static vec3 node_normal(MorphNodes const& cur,
+    vec3 node_pos, ivec4 node_neighbors) {
+  vec3 nor(0.0, 1.0, 0.0);
+  for (int i = 0; i < 4; ++i) {
+    int i_a = node_neighbors[i];
+    int i_b = node_neighbors[(i + 1) % 4];
+    if (i_a >= 0 && i_b >= 0) {
+      vec3 p_a = vec3(cur.pos_vec[i_a]);
+      vec3 p_b = vec3(cur.pos_vec[i_b]);
+      nor = normalize(-cross(p_a - node_pos, p_b - node_pos));
+      break;
+    }
+  }
+  return nor;
+}
+
+// Return the index of the neighbor that is furthest in the target direction
+// Note: target_dir must be normalized
+static int directed_neighbor(MorphNodes const& cur,
+    vec3 node_pos, ivec4 node_neighbors, vec3 target_dir) {
+  int out_index = -1;
+  float largest_dot = -2.0;
+  for (int i = 0; i < 4; ++i) {
+    int n_index = node_neighbors[i];
+    if (n_index >= 0) {
+      vec3 n_pos = vec3(cur.pos_vec[n_index]);
+      float d = dot(n_pos - node_pos, target_dir);
+      if (out_index == -1 || d > largest_dot) {
+        out_index = i;
+        largest_dot = d;
+      }
+    }
+  }
+  return out_index;
+}
+
+static void compute_source_transition(GrowthParams const& params,
+    MorphNodes const& cur, int node_index, int node_id, int iter_num,
+    vec4& out_vel, vec4& out_data) {
+  vec4 pos = cur.pos_vec[node_index];
+  vec4 vel = cur.vel_vec[node_index];
+  ivec4 neighbors = cur.neighbors_vec[node_index];
+
+  vec4 next_vel = vel;
+  vec4 next_data(-1.0);
+
+  vec3 trans_noise = vec3(node_noise(params, node_id, iter_num,
+        NOISE_STREAM_SOURCE_TRANSITION));
+  if (vel.w == 0.0f) {
+    // check if a neighbor has requested to be cloned
+    bool did_promote = false;
+    for (int i = 0; i < 4; ++i) {
+      int n_index = neighbors[i];
+      if (n_index >= 0) {
+        vec4 n_data = cur.data_vec[n_index];
+        if ((int) n_data.w == (i + 2) % 4) {
+          // neighbor has requested that this node be its clone
+          float gen_amt = length(vec3(n_data));
+          next_vel = vec4(normalize(vec3(n_data)), gen_amt);
+          next_data = vec4(-1.0);
+          did_promote = true;
+        }
+      }
+    }
+
+    // promote this node to a src with some probability
+    if (!did_promote && trans_noise.z < params.src_trans_probs.z) {
+      vec3 nor = node_normal(cur, vec3(pos), neighbors);
+      next_vel = vec4(nor, params.src_heat_gen_rate.x);
+      next_data = vec4(-1.0);
+    }
+  } else {
+    // this node is currently a source
+
+    // clone if right conditions
+    bool is_cloning = false;
+    // Note: the shader leaves an interval < 1 undefined (mod by 0),
+    // here it disables cloning
+    int cloning_interval = (int) params.cloning_interval.x;
+    if (cloning_interval > 0 && iter_num % cloning_interval == 0) {
+      // create two new vecs mirrored across the current vec
+      float tangent_len = tan(0.5f * shader_pi * params.cloning_coeffs.z);
+      vec3 tangent_vec = tangent_len *
+        normalize(cross(vec3(vel), trans_noise));
+      vec3 my_dir = normalize(vec3(vel) - tangent_vec);
+      vec3 clone_dir = normalize(vec3(vel) + tangent_vec);
+
+      float clone_gen_amt = params.cloning_coeffs.y * vel.w;
+      int target_n = directed_neighbor(cur, vec3(pos), neighbors, clone_dir);
+      next_vel = vec4(my_dir, params.cloning_coeffs.x * vel.w);
+      next_data = vec4(clone_gen_amt * clone_dir, target_n);
+      is_cloning = true;
+    }
+
+    // traverse mesh if right conditions
+    bool is_walking = false;
+    if (!is_cloning && trans_noise.y < params.src_trans_probs.y) {
+      int target_n = directed_neighbor(cur, vec3(pos), neighbors, vec3(vel));
+      next_vel = vec4(0.0);
+      next_data = vec4(vel.w * vec3(vel), target_n);
+      is_walking = true;
+    }
+
+    // splice a new node into the edge behind this source, so that the
+    // mesh grows rather than only stretching
+    bool is_spawning = false;
+    if (!is_cloning && !is_walking && trans_noise.x < params.spawn_prob.x) {
+      int target_n = directed_neighbor(cur, vec3(pos), neighbors, -vec3(vel));
+      if (target_n != -1) {
+        next_vel = vel;
+        next_data = vec4(-1.0, -1.0, -1.0, SPLICE_MSG_BASE + target_n);
+        is_spawning = true;
+      }
+    }
+
+    if (!is_cloning && !is_walking && !is_spawning) {
+      // no msg for neighbors
+      next_vel = vel;
+      next_data = vec4(-1.0);
+    }
+  }
+  out_vel = next_vel;
+  out_data = next_data;
+}
+
+static vec3 compute_next_pos(GrowthParams const& params,
+    MorphNodes const& cur, int node_index) {
+  vec4 pos = cur.pos_vec[node_index];
+  vec4 vel = cur.vel_vec[node_index];
+  ivec4 neighbors = cur.neighbors_vec[node_index];
+
+  bool is_fixed = false;
+  vec3 force(0.0);
+  vec3 delta_heat(0.0);
+  float largest_delta = 0.0;
+  for (int i = 0; i < 4; ++i) {
+    int n_i = neighbors[i];
+    if (n_i >= 0) {
+      vec4 n_pos = cur.pos_vec[n_i];
+      vec3 delta_pos = vec3(n_pos) - vec3(pos);
+      float spring_len = length(delta_pos);
+      float spring_factor = spring_len < params.target_spring_len.x ?
+        params.spring_coeffs.x : params.spring_coeffs.y;
+      force += spring_factor * normalize(delta_pos) *
+        (spring_len - params.target_spring_len.x);
+
+      if (n_pos.w - pos.w > largest_delta) {
+        delta_heat = normalize(vec3(n_pos) - vec3(pos));
+        largest_delta = n_pos.w - pos.w;
+      }
+    } else if (n_i == -1) {
+      is_fixed = true;
+    }
+  }
+
+  if (vel.w != 0.0f) {
+    force += params.force_coeffs.y * vec3(vel);
+  } else {
+    force += params.force_coeffs.z * delta_heat;
+  }
+
+  vec3 p_next = vec3(pos) + force;
+
+  if (is_fixed) {
+    p_next = vec3(pos);
+  }
+  return p_next;
+}
+
+static MorphNode run_reg_iter(GrowthParams const& params,
+    MorphNodes const& cur, int node_index, int node_id, int iter_num) {
+  vec3 next_pos = compute_next_pos(params, cur, node_index);
+  float next_heat = compute_next_heat(params, cur, node_index);
+  vec4 next_vel(0.0);
+  vec4 next_data(0.0);
+  compute_source_transition(params, cur, node_index, node_id, iter_num,
+      next_vel, next_data);
+
+  if ((int) params.fix_positions.x == 1) {
+    next_pos = vec3(cur.pos_vec[node_index]);
+  }
+
+  return MorphNode(vec4(next_pos, next_heat), next_vel,
+      cur.neighbors_vec[node_index], next_data);
+}
+
+void run_cpu_iter(GrowthParams const& params, MorphNodes const& cur,
+    MorphNodes& next, const int* node_ids, int iter_num, int begin, int end) {
+  for (int i = begin; i < end; ++i) {
+    int node_id = node_ids ? node_ids[i] : i;
+    MorphNode node = iter_num == 0 ?
+      run_init_iter(params, cur, i, node_id) :
+      run_reg_iter(params, cur, i, node_id, iter_num);
+    next.pos_vec[i] = node.pos;
+    next.vel_vec[i] = node.vel;
+    next.neighbors_vec[i] = node.neighbors;
+    next.data_vec[i] = node.data;
+  }
+}
+
+// Runs fn over nodes [0, num_nodes) on the pool. With tiles, each thread
+// gets a run of whole tiles and fn is called once per tile, so that the
+// nodes of a tile (and most of their neighbors) stay in cache. Any
+// spliced nodes after the tiles are split up as usual.
+static void parallel_for_nodes(ThreadPool& pool, NodeTiles const& tiles,
+    int num_nodes, ThreadPool::RangeFn const& fn) {
+  if (tiles.tile_starts.empty()) {
+    pool.parallel_for(0, num_nodes, fn);
+    return;
+  }
+  int num_tiled_nodes = tiles.tile_starts.back();
+  assert(num_tiled_nodes <= num_nodes);
+  pool.parallel_for(0, tiles.tile_count(),
+    [&](int tile_begin, int tile_end, int thread_index) {
+      for (int t = tile_begin; t < tile_end; ++t) {
+        fn(tiles.tile_starts[t], tiles.tile_starts[t + 1], thread_index);
+      }
+    });
+  if (num_tiled_nodes < num_nodes) {
+    pool.parallel_for(num_tiled_nodes, num_nodes, fn);
+  }
+}
+
+// Returns the arguments of the SIMD kernels for iteration iter_num from
+// cur into next. heat_flux must already hold an entry per node.
+static SimdIterArgs simd_iter_args(GrowthParams const& params,
+    MorphNodes const& cur, MorphNodes& next, vector<vec4>& heat_flux,
+    const int* node_ids, int iter_num) {
+  SimdIterArgs args;
+  args.pos = &cur.pos_vec[0][0];
+  args.vel = &cur.vel_vec[0][0];
+  args.neighbors = &cur.neighbors_vec[0][0];
+  args.data = &cur.data_vec[0][0];
+  args.heat_flux = &heat_flux[0][0];
+  args.next_pos = &next.pos_vec[0][0];
+  args.next_vel = &next.vel_vec[0][0];
+  args.next_neighbors = &next.neighbors_vec[0][0];
+  args.next_data = &next.data_vec[0][0];
+  args.next_heat_flux = &heat_flux[0][0];
+  args.heat_transfer_coeff = params.heat_transfer_coeff.x;
+  args.target_spring_len = params.target_spring_len.x;
+  args.spring_coeff_short = params.spring_coeffs.x;
+  args.spring_coeff_long = params.spring_coeffs.y;
+  args.force_coeff_src = params.force_coeffs.y;
+  args.force_coeff_heat = params.force_coeffs.z;
+  args.fix_positions = (int) params.fix_positions.x == 1;
+  // the noise is in [0, 1)
+  args.can_promote = params.src_trans_probs.z > 0.0f;
+  args.src_promote_prob = params.src_trans_probs.z;
+  args.seed = params.seed();
+  args.iter_num = iter_num;
+  args.node_ids = node_ids;
+  return args;
+}
+
+// Writes the heat that each of nodes [begin, end) emits to heat_flux, a
+// block of kernels.lanes nodes at a time
+static void run_simd_flux_range(SimdKernels const& kernels,
+    SimdIterArgs const& args, GrowthParams const& params,
+    MorphNodes const& cur, vector<vec4>& heat_flux, int begin, int end) {
+  int i = begin;
+  for (; i + kernels.lanes <= end; i += kernels.lanes) {
+    kernels.flux_block(args, i);
+  }
+  for (; i < end; ++i) {
+    heat_flux[i] = compute_heat_emit(params, cur,
+        cur.pos_vec[i].w, cur.neighbors_vec[i]);
+  }
+}
+
+// Writes the next state of nodes [begin, end), which reads the heat flux
+// of the nodes and their neighbors
+static void run_simd_reg_range(SimdKernels const& kernels,
+    SimdIterArgs const& args, GrowthParams const& params,
+    MorphNodes const& cur, MorphNodes& next, int begin, int end) {
+  array<int, 16> fixup_nodes;
+  assert(kernels.lanes <= fixup_nodes.size());
+  int i = begin;
+  for (; i + kernels.lanes <= end; i += kernels.lanes) {
+    int num_fixups = kernels.reg_block(args, i, fixup_nodes.data());
+    for (int j = 0; j < num_fixups; ++j) {
+      int node_index = fixup_nodes[j];
+      int node_id = args.node_ids ? args.node_ids[node_index] : node_index;
+      compute_source_transition(params, cur, node_index, node_id,
+          args.iter_num, next.vel_vec[node_index], next.data_vec[node_index]);
+    }
+  }
+  run_cpu_iter(params, cur, next, args.node_ids, args.iter_num, i, end);
+}
+
+// Runs one regular iteration with the SIMD kernels. The heat each node
+// emits is computed once per node in a separate pass, rather than once
+// per neighbor, so the two passes need the whole range in between.
+static void run_cpu_iter_simd(SimdKernels const& kernels, ThreadPool& pool,
+    GrowthParams const& params, MorphNodes const& cur, MorphNodes& next,
+    vector<vec4>& heat_flux, const int* node_ids, NodeTiles const& tiles,
+    int iter_num) {
+  int num_nodes = cur.pos_vec.size();
+  heat_flux.resize(num_nodes);
+  SimdIterArgs args = simd_iter_args(params, cur, next, heat_flux,
+      node_ids, iter_num);
+  parallel_for_nodes(pool, tiles, num_nodes,
+    [&](int begin, int end, int thread_index) {
+      run_simd_flux_range(kernels, args, params, cur, heat_flux, begin, end);
+    });
+  parallel_for_nodes(pool, tiles, num_nodes,
+    [&](int begin, int end, int thread_index) {
+      run_simd_reg_range(kernels, args, params, cur, next, begin, end);
+    });
+}
+
+// Calls fn(run_begin, run_end) for each run of consecutive nodes in the
+// sorted list nodes, with the list split across the pool
+template <typename Fn>
+static void for_each_node_run(ThreadPool& pool, vector<int> const& nodes,
+    Fn const& fn) {
+  pool.parallel_for(0, nodes.size(),
+    [&](int begin, int end, int thread_index) {
+      int k = begin;
+      while (k < end) {
+        int run_begin = nodes[k];
+        int run_end = run_begin + 1;
+        for (++k; k < end && nodes[k] == run_end; ++k) {
+          ++run_end;
+        }
+        fn(run_begin, run_end);
+      }
+    });
+}
+
+// Records which of the updated nodes [begin, end) changed, and snaps the
+// rest back to their current state. A node changed if the update moved it
+// or changed its heat by more than epsilon, or changed anything else. A
+// source or a node with a message for a neighbor always counts as changed.
+static void record_node_changes(MorphNodes const& cur, MorphNodes& next,
+    ActiveSet& active, float epsilon, int begin, int end) {
+  // the flags are bytes, which may alias the node arrays, so the arrays
+  // are loaded once rather than after each flag is stored
+  const vec4* cur_pos = cur.pos_vec.data();
+  const vec4* cur_vel = cur.vel_vec.data();
+  const vec4* cur_data = cur.data_vec.data();
+  vec4* next_pos = next.pos_vec.data();
+  const vec4* next_vel = next.vel_vec.data();
+  const vec4* next_data = next.data_vec.data();
+  uint8_t* changed = active.changed.data();
+  for (int i = begin; i < end; ++i) {
+    vec4 delta = next_pos[i] - cur_pos[i];
+    // length() squares the delta, which underflows to 0 for tiny moves,
+    // so epsilon 0 compares exactly
+    bool moved = epsilon == 0.0f ? delta != vec4(0.0) :
+      length(vec3(delta)) > epsilon || fabsf(delta.w) > epsilon;
+    bool is_changed = moved || next_vel[i].w != 0.0f ||
+      next_data[i] != vec4(-1.0) || next_vel[i] != cur_vel[i] ||
+      next_data[i] != cur_data[i];
+    if (!is_changed) {
+      next_pos[i] = cur_pos[i];
+    }
+    changed[i] = is_changed;
+  }
+}
+
+// Runs iteration iter_num on the nodes of the active set only, with the
+// SIMD kernels if they are given. Every other node is asleep, and both
+// buffers already hold its state. An updated node that did not change is
+// snapped back to its current state, so that the same holds if it goes
+// to sleep.
+static void run_active_iter(ThreadPool& pool, SimdKernels const* kernels,
+    GrowthParams const& params, MorphNodes const& cur, MorphNodes& next,
+    vector<vec4>& heat_flux, const int* node_ids, ActiveSet& active,
+    float epsilon, int iter_num) {
+  if (!kernels) {
+    active.heat_flux_valid = false;
+    for_each_node_run(pool, active.nodes, [&](int begin, int end) {
+        run_cpu_iter(params, cur, next, node_ids, iter_num, begin, end);
+        record_node_changes(cur, next, active, epsilon, begin, end);
+      });
+    return;
+  }
+  // The flux of a node depends on its heat and that of its neighbors, so
+  // it can only have changed if the node is within an edge of one that
+  // changed, which puts it in the set. The flux of the sleeping nodes is
+  // kept from the last iteration that computed it.
+  int num_nodes = cur.size();
+  heat_flux.resize(num_nodes);
+  SimdIterArgs args = simd_iter_args(params, cur, next, heat_flux,
+      node_ids, iter_num);
+  if (active.heat_flux_valid) {
+    for_each_node_run(pool, active.nodes, [&](int begin, int end) {
+        run_simd_flux_range(*kernels, args, params, cur, heat_flux,
+            begin, end);
+      });
+  } else {
+    pool.parallel_for(0, num_nodes,
+      [&](int begin, int end, int thread_index) {
+        run_simd_flux_range(*kernels, args, params, cur, heat_flux,
+            begin, end);
+      });
+    active.heat_flux_valid = true;
+  }
+  for_each_node_run(pool, active.nodes, [&](int begin, int end) {
+      run_simd_reg_range(*kernels, args, params, cur, next, begin, end);
+      record_node_changes(cur, next, active, epsilon, begin, end);
+    });
+}
+
+// Adds node to the set that a thread is building in found, unless some
+// thread already added it. Threads may reach the same node, so its wake
+// flag is swapped atomically, but most nodes are reached many times, so it
+// is loaded first to skip the locked swap for them.
+static void wake_node(uint8_t* wake, int node, vector<int>& found) {
+  if (!__atomic_load_n(&wake[node], __ATOMIC_RELAXED) &&
+      !__atomic_exchange_n(&wake[node], 1, __ATOMIC_RELAXED)) {
+    found.push_back(node);
+  }
+}
+
+// Wakes the neighbors of node
+static void wake_neighbors(const ivec4* neighbors_vec, uint8_t* wake,
+    int node, vector<int>& found) {
+  ivec4 neighbors = neighbors_vec[node];
+  for (int j = 0; j < 4; ++j) {
+    if (neighbors[j] >= 0) {
+      wake_node(wake, neighbors[j], found);
+    }
+  }
+}
+
+// Writes the indices of the set flags to out in order, and clears them.
+// Each thread counts the flags of its range, and an exclusive scan of
+// the counts gives the offset that it writes its indices at. Both passes
+// get the same ranges, as the pool splits a loop the same way each time.
+static void compact_flags(ThreadPool& pool, vector<uint8_t>& flags,
+    vector<int>& out) {
+  int num_threads = pool.num_threads();
+  vector<int> offsets(num_threads + 1, 0);
+  pool.parallel_for(0, flags.size(),
+    [&](int begin, int end, int thread_index) {
+      int count = 0;
+      for (int i = begin; i < end; ++i) {
+        count += flags[i];
+      }
+      offsets[thread_index + 1] = count;
+    });
+  for (int t = 0; t < num_threads; ++t) {
+    offsets[t + 1] += offsets[t];
+  }
+  out.resize(offsets[num_threads]);
+  pool.parallel_for(0, flags.size(),
+    [&](int begin, int end, int thread_index) {
+      int out_index = offsets[thread_index];
+      for (int i = begin; i < end; ++i) {
+        if (flags[i]) {
+          out[out_index++] = i;
+          flags[i] = 0;
+        }
+      }
+    });
+}
+
+// Puts all num_nodes nodes in the active set
+static void reset_active_set(ActiveSet& active, int num_nodes) {
+  active.nodes.resize(num_nodes);
+  for (int i = 0; i < num_nodes; ++i) {
+    active.nodes[i] = i;
+  }
+  active.changed.assign(num_nodes, 0);
+  active.wake.assign(num_nodes, 0);
+  active.heat_flux_valid = false;
+}
+
+// the active set is built by sorting the woken nodes if there are fewer
+// than 1 in this many nodes, and by a scan of the wake flags otherwise
+static const int ACTIVE_SET_SORT_RATIO = 16;
+
+// Sets the active set to the nodes to update in iteration iter_num: those
+// within two edges of a node that changed in the last one, the nodes that
+// it spliced in, and the sleeping nodes that iter_num promotes to a
+// source. nodes is the state after the last iteration.
+//
+// The set is gathered from the two-rings of the changed nodes of the last
+// set, so it costs in proportion to the set rather than to the mesh. The
+// exception is the random promotion (src_trans_probs.z > 0): any sleeping
+// node may be promoted, so each one's noise is checked every iteration,
+// which is a pass over the whole mesh.
+static void update_active_set(ThreadPool& pool, GrowthParams const& params,
+    MorphNodes const& nodes, const int* node_ids, ActiveSet& active,
+    int iter_num) {
+  int num_nodes = nodes.size();
+  int num_old_nodes = active.changed.size();
+  active.changed.resize(num_nodes, 0);
+  active.wake.resize(num_nodes, 0);
+  active.thread_nodes.resize(pool.num_threads());
+  for (vector<int>& found : active.thread_nodes) {
+    found.clear();
+  }
+  // The heat a node takes in depends on the heat its neighbors emit,
+  // which depends on their own neighbors, so the set is every node within
+  // two edges of a changed one. It is gathered an edge at a time, as the
+  // rings of nearby nodes mostly overlap. The flags are bytes, which may
+  // alias anything, so the arrays are loaded once.
+  const ivec4* neighbors_vec = nodes.neighbors_vec.data();
+  uint8_t* wake = active.wake.data();
+  const uint8_t* changed = active.changed.data();
+  const int* set_nodes = active.nodes.data();
+  pool.parallel_for(0, active.nodes.size(),
+    [&](int begin, int end, int thread_index) {
+      vector<int>& found = active.thread_nodes[thread_index];
+      for (int k = begin; k < end; ++k) {
+        int i = set_nodes[k];
+        if (changed[i]) {
+          wake_node(wake, i, found);
+          wake_neighbors(neighbors_vec, wake, i, found);
+        }
+      }
+    });
+  pool.parallel_for(num_old_nodes, num_nodes,
+    [&](int begin, int end, int thread_index) {
+      vector<int>& found = active.thread_nodes[thread_index];
+      for (int i = begin; i < end; ++i) {
+        wake_node(wake, i, found);
+        wake_neighbors(neighbors_vec, wake, i, found);
+      }
+    });
+  active.nodes.clear();
+  for (vector<int>& found : active.thread_nodes) {
+    active.nodes.insert(active.nodes.end(), found.begin(), found.end());
+    found.clear();
+  }
+  set_nodes = active.nodes.data();
+  pool.parallel_for(0, active.nodes.size(),
+    [&](int begin, int end, int thread_index) {
+      vector<int>& found = active.thread_nodes[thread_index];
+      for (int k = begin; k < end; ++k) {
+        wake_neighbors(neighbors_vec, wake, set_nodes[k], found);
+      }
+    });
+
+  // a sleeping node is not a source and has no messages from its
+  // neighbors, so only the random promotion can change it
+  if (params.src_trans_probs.z > 0.0f) {
+    pool.parallel_for(0, num_nodes,
+      [&](int begin, int end, int thread_index) {
+        vector<int>& found = active.thread_nodes[thread_index];
+        for (int i = begin; i < end; ++i) {
+          int node_id = node_ids ? node_ids[i] : i;
+          if (!wake[i] && node_noise(params, node_id, iter_num,
+                NOISE_STREAM_SOURCE_TRANSITION).z < params.src_trans_probs.z) {
+            wake_node(wake, i, found);
+          }
+        }
+      });
+  }
+
+  size_t num_woken = active.nodes.size();
+  for (vector<int> const& found : active.thread_nodes) {
+    num_woken += found.size();
+  }
+  // sorting a large set costs more than a scan of the flags
+  if (num_woken * ACTIVE_SET_SORT_RATIO > (size_t) num_nodes) {
+    compact_flags(pool, active.wake, active.nodes);
+    return;
+  }
+  for (vector<int> const& found : active.thread_nodes) {
+    active.nodes.insert(active.nodes.end(), found.begin(), found.end());
+  }
+  sort(active.nodes.begin(), active.nodes.end());
+  for (int i : active.nodes) {
+    wake[i] = 0;
+  }
+}
+
+void seed_cpu_state(CpuMorphState& cpu_state, Controls const& controls,
+    vector<GLuint>& indices) {
+  ivec2 zygote_samples(controls.num_zygote_samples);
+  MorphNodes& nodes = cpu_state.buffers[0];
+  indices.clear();
+  gen_morph_data(zygote_samples, nodes, indices);
+  cpu_state.result_buffer_index = 0;
+  cpu_state.node_ids.clear();
+  cpu_state.tiles = NodeTiles();
+  if (controls.node_order != NODE_ORDER_ROW_MAJOR) {
+    cpu_state.node_ids = compute_node_order(controls.node_order,
+        zygote_samples, nodes);
+    permute_nodes(cpu_state.node_ids, nodes, indices);
+  }
+  if (controls.node_order == NODE_ORDER_TILED) {
+    cpu_state.tiles = compute_node_tiles(zygote_samples, nodes);
+  }
+  cpu_state.node_pool = NodePool();
+  if (controls.node_pool_size > 0) {
+    init_node_pool(cpu_state.node_pool, nodes.size(), indices,
+        controls.node_pool_size);
+  }
+}
+
+void run_cpu_simulation(CpuMorphState& cpu_state, GrowthParams const& params,
+    int start_iter, int end_iter, Controls const& controls) {
+  MORPH_TRACE_ZONE("run_cpu_simulation");
+  int num_threads = controls.num_sim_threads;
+  if (num_threads <= 0) {
+    num_threads = std::max((int) thread::hardware_concurrency(), 1);
+  }
+  if (!cpu_state.pool || cpu_state.pool->num_threads() != num_threads) {
+    cpu_state.pool.reset(new ThreadPool(num_threads));
+  }
+  ThreadPool& pool = *cpu_state.pool;
+  SimdKernels const* simd_kernels = controls.use_simd_kernels ?
+    get_simd_kernels() : nullptr;
+
+  NodePool& node_pool = cpu_state.node_pool;
+  if (node_pool_enabled(node_pool)) {
+    // so that splicing a node does not move the arrays
+    for (MorphNodes& buf : cpu_state.buffers) {
+      buf.reserve(node_pool.capacity);
+    }
+    cpu_state.heat_flux.reserve(node_pool.capacity);
+  }
+
+  // every node is updated in the first iteration, as the other buffer
+  // may not hold the state of the sleeping nodes
+  ActiveSet& active_set = cpu_state.active_set;
+  active_set.num_updates = 0;
+  active_set.num_skipped = 0;
+  if (controls.use_active_set) {
+    reset_active_set(active_set, cpu_state.buffers[start_iter & 1].size());
+  }
+
+  // perform double-buffered iterations
+  for (int i = start_iter; i < end_iter; ++i) {
+    MORPH_TRACE_ZONE("cpu iteration");
+    MorphNodes const& cur_buf = cpu_state.buffers[i & 1];
+    MorphNodes& next_buf = cpu_state.buffers[(i + 1) & 1];
+    // the next buffer is only written to, so only its size matters. The
+    // number of nodes only changes in the topology pass.
+    int num_nodes = cur_buf.size();
+    next_buf.resize(num_nodes);
+    assert(cpu_state.node_ids.empty() ||
+        cpu_state.node_ids.size() >= num_nodes);
+    const int* node_ids = cpu_state.node_ids.empty() ?
+      nullptr : cpu_state.node_ids.data();
+
+    if (controls.use_active_set) {
+      // the first iteration is not a regular one, and has no SIMD kernel
+      SimdKernels const* active_kernels = i > 0 && num_nodes > 0 ?
+        simd_kernels : nullptr;
+      run_active_iter(pool, active_kernels, params, cur_buf, next_buf,
+          cpu_state.heat_flux, node_ids, active_set,
+          controls.active_set_epsilon, i);
+      active_set.num_updates += active_set.nodes.size();
+      active_set.num_skipped += num_nodes - active_set.nodes.size();
+    } else if (simd_kernels && i > 0 && num_nodes > 0) {
+      run_cpu_iter_simd(*simd_kernels, pool, params, cur_buf, next_buf,
+          cpu_state.heat_flux, node_ids, cpu_state.tiles, i);
+    } else {
+      parallel_for_nodes(pool, cpu_state.tiles, num_nodes,
+        [&](int begin, int end, int thread_index) {
+          run_cpu_iter(params, cur_buf, next_buf, node_ids, i, begin, end);
+        });
+    }
+    if (node_pool_enabled(node_pool)) {
+      run_topology_pass(node_pool, next_buf, cpu_state.node_ids);
+    }
+    if (controls.use_active_set && i + 1 < end_iter) {
+      // the topology pass may have moved the node ids
+      update_active_set(pool, params, next_buf, cpu_state.node_ids.empty() ?
+          nullptr : cpu_state.node_ids.data(), active_set, i + 1);
+    }
+  }
+  // store the index of the most recently written buffer
+  cpu_state.result_buffer_index = end_iter % 2;
+}
+
+SimResidual compute_cpu_residual(CpuMorphState& cpu_state,
+    vector<vec4> const& prev_pos) {
+  assert(cpu_state.pool);
+  ThreadPool& pool = *cpu_state.pool;
+  MorphNodes const& nodes = cpu_state.buffers[cpu_state.result_buffer_index];
+  int num_nodes = std::min((int) nodes.size(), (int) prev_pos.size());
+
+  // each thread reduces its range, then the partials are combined in
+  // thread order, so the result only depends on the thread count
+  int num_threads = pool.num_threads();
+  vector<float> max_disps(num_threads, 0.0f);
+  vector<double> disp_sums(num_threads, 0.0);
+  vector<double> heat_changes(num_threads, 0.0);
+  pool.parallel_for(0, num_nodes,
+    [&](int begin, int end, int thread_index) {
+      float max_disp = 0.0f;
+      double disp_sum = 0.0;
+      double heat_change = 0.0;
+      for (int i = begin; i < end; ++i) {
+        vec4 delta = nodes.pos_vec[i] - prev_pos[i];
+        float disp = length(vec3(delta));
+        max_disp = std::max(max_disp, disp);
+        disp_sum += disp;
+        heat_change += fabsf(delta.w);
+      }
+      max_disps[thread_index] = max_disp;
+      disp_sums[thread_index] = disp_sum;
+      heat_changes[thread_index] = heat_change;
+    });
+
+  SimResidual residual;
+  double disp_sum = 0.0;
+  double heat_change = 0.0;
+  for (int t = 0; t < num_threads; ++t) {
+    residual.max_disp = std::max(residual.max_disp, max_disps[t]);
+    disp_sum += disp_sums[t];
+    heat_change += heat_changes[t];
+  }
+  residual.mean_disp = num_nodes > 0 ? disp_sum / num_nodes : 0.0;
+  residual.heat_change = heat_change;
+  residual.num_new_nodes = nodes.size() - num_nodes;
+  return residual;
+}
+
+bool residual_converged(SimResidual const& residual,
+    ConvergenceCriteria const& criteria) {
+  // the mean is NaN, and so fails, if any node went NaN
+  return residual.max_disp <= criteria.disp_tol &&
+    residual.mean_disp <= criteria.disp_tol &&
+    residual.heat_change <= criteria.heat_tol &&
+    residual.num_new_nodes == 0;
+}
+
+int run_cpu_to_convergence(CpuMorphState& cpu_state,
+    GrowthParams const& params, int start_iter,
+    ConvergenceCriteria const& criteria, Controls const& controls,
+    SimResidual& residual) {
+  int check_interval = std::max(criteria.check_interval, 1);
+  residual = SimResidual();
+  int iter_num = start_iter;
+  vector<vec4> prev_pos;
+  while (iter_num < criteria.max_iters) {
+    prev_pos = cpu_state.buffers[iter_num & 1].pos_vec;
+    int next_iter_num = std::min(iter_num + check_interval,
+        criteria.max_iters);
+    run_cpu_simulation(cpu_state, params, iter_num, next_iter_num, controls);
+    iter_num = next_iter_num;
+    residual = compute_cpu_residual(cpu_state, prev_pos);
+    if (residual_converged(residual, criteria)) {
+      break;
+    }
+  }
+  cpu_state.result_buffer_index = iter_num % 2;
+  return iter_num;
+}
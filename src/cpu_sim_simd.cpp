@@ -0,0 +1,277 @@
+#include "cpu_sim_simd.h"
+#include "philox.h"
+
+#include <immintrin.h>
+
+// The kernels are compiled for each instruction set with target pragmas
+// rather than per-file compiler flags, so that no code outside of them
+// can end up using instructions the CPU may not support.
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+namespace avx2 {
+
+typedef __m256 vf;
+typedef __m256i vi;
+const int LANES = 8;
+
+static inline vf vset(float x) { return _mm256_set1_ps(x); }
+static inline vf vzero() { return _mm256_setzero_ps(); }
+static inline vf vtrue() { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+static inline vf vadd(vf a, vf b) { return _mm256_add_ps(a, b); }
+static inline vf vsub(vf a, vf b) { return _mm256_sub_ps(a, b); }
+static inline vf vmul(vf a, vf b) { return _mm256_mul_ps(a, b); }
+static inline vf vdiv(vf a, vf b) { return _mm256_div_ps(a, b); }
+static inline vf vsqrt(vf a) { return _mm256_sqrt_ps(a); }
+// a < b ? a : b
+static inline vf vmin(vf a, vf b) { return _mm256_min_ps(a, b); }
+static inline vf vlt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vf vgt(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vf vneq(vf a, vf b) { return _mm256_cmp_ps(a, b, _CMP_NEQ_UQ); }
+static inline vf vand(vf a, vf b) { return _mm256_and_ps(a, b); }
+static inline vf vor(vf a, vf b) { return _mm256_or_ps(a, b); }
+static inline vf vnot(vf a) { return _mm256_xor_ps(a, vtrue()); }
+// mask ? b : a
+static inline vf vblend(vf a, vf b, vf mask) { return _mm256_blendv_ps(a, b, mask); }
+static inline int vmovemask(vf mask) { return _mm256_movemask_ps(mask); }
+
+static inline vi vset_i(int x) { return _mm256_set1_epi32(x); }
+static inline vi vlane_ids() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+static inline vi vadd_i(vi a, vi b) { return _mm256_add_epi32(a, b); }
+static inline int vfirst_i(vi a) {
+  return _mm_cvtsi128_si32(_mm256_castsi256_si128(a));
+}
+static inline vi vshl2(vi a) { return _mm256_slli_epi32(a, 2); }
+static inline vi vtoi(vf a) { return _mm256_cvttps_epi32(a); }
+// reinterprets the bits, for int data loaded as floats
+static inline vi vbits_i(vf a) { return _mm256_castps_si256(a); }
+static inline vf veq_i(vi a, vi b) {
+  return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b));
+}
+static inline vf vgt_i(vi a, vi b) {
+  return _mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b));
+}
+static inline vi vxor_i(vi a, vi b) { return _mm256_xor_si256(a, b); }
+// the high and low 32 bits of the unsigned products a * b
+static inline void vmulhilo_u(vi a, vi b, vi& hi, vi& lo) {
+  // mul_epu32 multiplies the even lanes into 64-bit products
+  vi even = _mm256_mul_epu32(a, b);
+  vi odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+  hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+  lo = _mm256_mullo_epi32(a, b);
+}
+// as philox_unit_float
+static inline vf vunit_float(vi a) {
+  return vmul(_mm256_cvtepi32_ps(_mm256_srli_epi32(a, 8)),
+      vset(1.0f / 16777216.0f));
+}
+
+// Loads base[index] for the lanes set in mask, and 0 for the others
+static inline vf vgather(const float* base, vi index, vf mask) {
+  return _mm256_mask_i32gather_ps(vzero(), base, index, mask, 4);
+}
+
+// Loads 8 consecutive vec4s starting at node first and transposes
+// them into one register per component
+static inline void vload_aos(const float* base, int first,
+    vf& x, vf& y, vf& z, vf& w) {
+  const float* p = base + 4 * first;
+  // rows hold nodes {0, 4}, {1, 5}, {2, 6}, {3, 7}
+  vf r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p + 0)), _mm_loadu_ps(p + 16), 1);
+  vf r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p + 4)), _mm_loadu_ps(p + 20), 1);
+  vf r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p + 8)), _mm_loadu_ps(p + 24), 1);
+  vf r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p + 12)), _mm_loadu_ps(p + 28), 1);
+  vf t0 = _mm256_unpacklo_ps(r0, r1);
+  vf t1 = _mm256_unpacklo_ps(r2, r3);
+  vf t2 = _mm256_unpackhi_ps(r0, r1);
+  vf t3 = _mm256_unpackhi_ps(r2, r3);
+  // the lanes are now in the order {0, 1, 2, 3, 4, 5, 6, 7}
+  x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+  y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+  z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  w = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// Loads the vec4s of nodes index and transposes them like vload_aos.
+// Negative indices (missing neighbors) load node 0, so the caller must
+// mask out those lanes.
+static inline void vload_aos_at(const float* base, vi index,
+    vf& x, vf& y, vf& z, vf& w) {
+  alignas(32) int lane_index[8];
+  _mm256_store_si256((vi*) lane_index,
+      _mm256_max_epi32(index, _mm256_setzero_si256()));
+  const float* p[8];
+  for (int lane = 0; lane < 8; ++lane) {
+    p[lane] = base + 4 * lane_index[lane];
+  }
+  vf r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p[0])), _mm_loadu_ps(p[4]), 1);
+  vf r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p[1])), _mm_loadu_ps(p[5]), 1);
+  vf r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p[2])), _mm_loadu_ps(p[6]), 1);
+  vf r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(
+        _mm_loadu_ps(p[3])), _mm_loadu_ps(p[7]), 1);
+  vf t0 = _mm256_unpacklo_ps(r0, r1);
+  vf t1 = _mm256_unpacklo_ps(r2, r3);
+  vf t2 = _mm256_unpackhi_ps(r0, r1);
+  vf t3 = _mm256_unpackhi_ps(r2, r3);
+  x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+  y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+  z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  w = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// The inverse of vload_aos
+static inline void vstore_aos(float* base, int first,
+    vf x, vf y, vf z, vf w) {
+  float* p = base + 4 * first;
+  vf t0 = _mm256_unpacklo_ps(x, y);
+  vf t1 = _mm256_unpackhi_ps(x, y);
+  vf t2 = _mm256_unpacklo_ps(z, w);
+  vf t3 = _mm256_unpackhi_ps(z, w);
+  vf r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+  vf r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+  vf r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+  vf r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+  _mm_storeu_ps(p + 0, _mm256_castps256_ps128(r0));
+  _mm_storeu_ps(p + 4, _mm256_castps256_ps128(r1));
+  _mm_storeu_ps(p + 8, _mm256_castps256_ps128(r2));
+  _mm_storeu_ps(p + 12, _mm256_castps256_ps128(r3));
+  _mm_storeu_ps(p + 16, _mm256_extractf128_ps(r0, 1));
+  _mm_storeu_ps(p + 20, _mm256_extractf128_ps(r1, 1));
+  _mm_storeu_ps(p + 24, _mm256_extractf128_ps(r2, 1));
+  _mm_storeu_ps(p + 28, _mm256_extractf128_ps(r3, 1));
+}
+
+#include "cpu_sim_simd_kernel.inl"
+
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+namespace sse4 {
+
+typedef __m128 vf;
+typedef __m128i vi;
+const int LANES = 4;
+
+static inline vf vset(float x) { return _mm_set1_ps(x); }
+static inline vf vzero() { return _mm_setzero_ps(); }
+static inline vf vtrue() { return _mm_castsi128_ps(_mm_set1_epi32(-1)); }
+static inline vf vadd(vf a, vf b) { return _mm_add_ps(a, b); }
+static inline vf vsub(vf a, vf b) { return _mm_sub_ps(a, b); }
+static inline vf vmul(vf a, vf b) { return _mm_mul_ps(a, b); }
+static inline vf vdiv(vf a, vf b) { return _mm_div_ps(a, b); }
+static inline vf vsqrt(vf a) { return _mm_sqrt_ps(a); }
+// a < b ? a : b
+static inline vf vmin(vf a, vf b) { return _mm_min_ps(a, b); }
+static inline vf vlt(vf a, vf b) { return _mm_cmplt_ps(a, b); }
+static inline vf vgt(vf a, vf b) { return _mm_cmpgt_ps(a, b); }
+static inline vf vneq(vf a, vf b) { return _mm_cmpneq_ps(a, b); }
+static inline vf vand(vf a, vf b) { return _mm_and_ps(a, b); }
+static inline vf vor(vf a, vf b) { return _mm_or_ps(a, b); }
+static inline vf vnot(vf a) { return _mm_xor_ps(a, vtrue()); }
+// mask ? b : a
+static inline vf vblend(vf a, vf b, vf mask) { return _mm_blendv_ps(a, b, mask); }
+static inline int vmovemask(vf mask) { return _mm_movemask_ps(mask); }
+
+static inline vi vset_i(int x) { return _mm_set1_epi32(x); }
+static inline vi vlane_ids() { return _mm_setr_epi32(0, 1, 2, 3); }
+static inline vi vadd_i(vi a, vi b) { return _mm_add_epi32(a, b); }
+static inline int vfirst_i(vi a) { return _mm_cvtsi128_si32(a); }
+static inline vi vshl2(vi a) { return _mm_slli_epi32(a, 2); }
+static inline vi vtoi(vf a) { return _mm_cvttps_epi32(a); }
+// reinterprets the bits, for int data loaded as floats
+static inline vi vbits_i(vf a) { return _mm_castps_si128(a); }
+static inline vf veq_i(vi a, vi b) {
+  return _mm_castsi128_ps(_mm_cmpeq_epi32(a, b));
+}
+static inline vf vgt_i(vi a, vi b) {
+  return _mm_castsi128_ps(_mm_cmpgt_epi32(a, b));
+}
+static inline vi vxor_i(vi a, vi b) { return _mm_xor_si128(a, b); }
+static inline void vmulhilo_u(vi a, vi b, vi& hi, vi& lo) {
+  vi even = _mm_mul_epu32(a, b);
+  vi odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  hi = _mm_blend_epi16(_mm_srli_epi64(even, 32), odd, 0xCC);
+  lo = _mm_mullo_epi32(a, b);
+}
+static inline vf vunit_float(vi a) {
+  return vmul(_mm_cvtepi32_ps(_mm_srli_epi32(a, 8)),
+      vset(1.0f / 16777216.0f));
+}
+
+// SSE has no gather instruction, so load each lane separately
+static inline vf vgather(const float* base, vi index, vf mask) {
+  alignas(16) int lane_index[4];
+  alignas(16) float lane_value[4];
+  _mm_store_si128((vi*) lane_index, index);
+  int mask_bits = vmovemask(mask);
+  for (int lane = 0; lane < 4; ++lane) {
+    lane_value[lane] = (mask_bits & (1 << lane)) ?
+      base[lane_index[lane]] : 0.0f;
+  }
+  return _mm_load_ps(lane_value);
+}
+
+static inline void vload_aos(const float* base, int first,
+    vf& x, vf& y, vf& z, vf& w) {
+  const float* p = base + 4 * first;
+  x = _mm_loadu_ps(p + 0);
+  y = _mm_loadu_ps(p + 4);
+  z = _mm_loadu_ps(p + 8);
+  w = _mm_loadu_ps(p + 12);
+  _MM_TRANSPOSE4_PS(x, y, z, w);
+}
+
+static inline void vload_aos_at(const float* base, vi index,
+    vf& x, vf& y, vf& z, vf& w) {
+  alignas(16) int lane_index[4];
+  _mm_store_si128((vi*) lane_index, _mm_max_epi32(index, _mm_setzero_si128()));
+  const float* p[4];
+  for (int lane = 0; lane < 4; ++lane) {
+    p[lane] = base + 4 * lane_index[lane];
+  }
+  x = _mm_loadu_ps(p[0]);
+  y = _mm_loadu_ps(p[1]);
+  z = _mm_loadu_ps(p[2]);
+  w = _mm_loadu_ps(p[3]);
+  _MM_TRANSPOSE4_PS(x, y, z, w);
+}
+
+static inline void vstore_aos(float* base, int first,
+    vf x, vf y, vf z, vf w) {
+  float* p = base + 4 * first;
+  _MM_TRANSPOSE4_PS(x, y, z, w);
+  _mm_storeu_ps(p + 0, x);
+  _mm_storeu_ps(p + 4, y);
+  _mm_storeu_ps(p + 8, z);
+  _mm_storeu_ps(p + 12, w);
+}
+
+#include "cpu_sim_simd_kernel.inl"
+
+}
+#pragma GCC pop_options
+
+SimdKernels const* get_simd_kernels() {
+  static const SimdKernels avx2_kernels = {
+    "avx2", avx2::LANES, avx2::flux_block, avx2::reg_block
+  };
+  static const SimdKernels sse4_kernels = {
+    "sse4.1", sse4::LANES, sse4::flux_block, sse4::reg_block
+  };
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &avx2_kernels;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    return &sse4_kernels;
+  }
+  return nullptr;
+}
@@ -0,0 +1,217 @@
+// Body of the SIMD kernels, included once per instruction set by
+// cpu_sim_simd.cpp. The including namespace provides the vector types
+// (vf, vi), LANES, and the v* primitives.
+//
+// Every step mirrors the scalar code in cpu_sim.cpp, including the order
+// of floating-point operations, so that the results are bit-identical.
+
+// Mirrors philox4x32 for the counters {node id, iter_num, stream, 0} of
+// nodes [first, first + LANES)
+static void vphilox4x32(SimdIterArgs const& a, int first, uint32_t stream,
+    vi ctr[4]) {
+  if (a.node_ids) {
+    ctr[0] = vbits_i(vgather((const float*) a.node_ids,
+          vadd_i(vset_i(first), vlane_ids()), vtrue()));
+  } else {
+    ctr[0] = vadd_i(vset_i(first), vlane_ids());
+  }
+  ctr[1] = vset_i(a.iter_num);
+  ctr[2] = vset_i(stream);
+  ctr[3] = vset_i(0);
+  uint32_t key[2] = {a.seed, 0};
+  for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+    if (r > 0) {
+      key[0] += PHILOX_W0;
+      key[1] += PHILOX_W1;
+    }
+    vi hi0, lo0, hi1, lo1;
+    vmulhilo_u(vset_i(PHILOX_M0), ctr[0], hi0, lo0);
+    vmulhilo_u(vset_i(PHILOX_M1), ctr[2], hi1, lo1);
+    ctr[0] = vxor_i(vxor_i(hi1, ctr[1]), vset_i(key[0]));
+    ctr[1] = lo1;
+    ctr[2] = vxor_i(vxor_i(hi0, ctr[3]), vset_i(key[1]));
+    ctr[3] = lo0;
+  }
+}
+
+// Mirrors compute_heat_emit
+static void flux_block(SimdIterArgs const& a, int first) {
+  vf alpha = vset(a.heat_transfer_coeff);
+
+  vf pos[4];
+  vf neighbors[4];
+  vload_aos(a.pos, first, pos[0], pos[1], pos[2], pos[3]);
+  // the int indices are moved as raw bits
+  vload_aos((const float*) a.neighbors, first,
+      neighbors[0], neighbors[1], neighbors[2], neighbors[3]);
+  vf heat = pos[3];
+  vf out_heats[4];
+  for (int i = 0; i < 4; ++i) {
+    vi n_index = vbits_i(neighbors[i]);
+    vf valid = vgt_i(n_index, vset_i(-1));
+    vf n_heat = vgather(a.pos, vadd_i(vshl2(n_index), vset_i(3)), valid);
+    // treat exterior as 0-heat neighbor, and emit nothing along open edges
+    vf exterior_emit = vand(veq_i(n_index, vset_i(-1)), vmul(alpha, heat));
+    vf interior_emit = vand(vlt(n_heat, heat),
+        vmul(alpha, vsub(heat, n_heat)));
+    out_heats[i] = vblend(exterior_emit, interior_emit, valid);
+  }
+  vf total_emit = vadd(vadd(out_heats[0], out_heats[1]),
+      vadd(out_heats[2], out_heats[3]));
+  vf do_scale = vgt(total_emit, vzero());
+  vf max_emit = vmin(heat, total_emit);
+  for (int i = 0; i < 4; ++i) {
+    vf scaled = vmul(vdiv(out_heats[i], total_emit), max_emit);
+    out_heats[i] = vblend(out_heats[i], scaled, do_scale);
+  }
+  vstore_aos(a.next_heat_flux, first,
+      out_heats[0], out_heats[1], out_heats[2], out_heats[3]);
+}
+
+// Mirrors run_reg_iter, with compute_next_heat reading the emitted heat
+// from the flux pass
+static int reg_block(SimdIterArgs const& a, int first, int* fixup_nodes) {
+  vf pos[4];
+  vf vel[4];
+  vf neighbors[4];
+  vf flux[4];
+  vload_aos(a.pos, first, pos[0], pos[1], pos[2], pos[3]);
+  vload_aos(a.vel, first, vel[0], vel[1], vel[2], vel[3]);
+  // the int indices are moved as raw bits
+  vload_aos((const float*) a.neighbors, first,
+      neighbors[0], neighbors[1], neighbors[2], neighbors[3]);
+  vload_aos(a.heat_flux, first, flux[0], flux[1], flux[2], flux[3]);
+
+  vi n_index[4];
+  vf valid[4];
+  vf is_border[4];
+  for (int i = 0; i < 4; ++i) {
+    n_index[i] = vbits_i(neighbors[i]);
+    valid[i] = vgt_i(n_index[i], vset_i(-1));
+    is_border[i] = veq_i(n_index[i], vset_i(-1));
+  }
+
+  // compute_next_pos and compute_next_heat
+  vf target_len = vset(a.target_spring_len);
+  vf coeff_short = vset(a.spring_coeff_short);
+  vf coeff_long = vset(a.spring_coeff_long);
+
+  vf is_fixed = vzero();
+  vf force[3] = {vzero(), vzero(), vzero()};
+  vf delta_heat[3] = {vzero(), vzero(), vzero()};
+  vf largest_delta = vzero();
+  vf total_heat_in = vzero();
+  for (int i = 0; i < 4; ++i) {
+    vi n_aos = vshl2(n_index[i]);
+    vf n_pos[4];
+    // the lanes with no neighbor are masked out below. Along a row of the
+    // grid the neighbors are consecutive nodes, which are loaded as a
+    // block rather than gathered.
+    int n_first = vfirst_i(n_index[i]);
+    if (vmovemask(veq_i(n_index[i], vadd_i(vset_i(n_first), vlane_ids())))
+        == (1 << LANES) - 1) {
+      vload_aos(a.pos, n_first, n_pos[0], n_pos[1], n_pos[2], n_pos[3]);
+    } else {
+      vload_aos_at(a.pos, n_index[i], n_pos[0], n_pos[1], n_pos[2], n_pos[3]);
+    }
+    vf delta_pos[3];
+    for (int c = 0; c < 3; ++c) {
+      delta_pos[c] = vsub(n_pos[c], pos[c]);
+    }
+    vf len_sq = vadd(vadd(vmul(delta_pos[0], delta_pos[0]),
+          vmul(delta_pos[1], delta_pos[1])), vmul(delta_pos[2], delta_pos[2]));
+    vf spring_len = vsqrt(len_sq);
+    vf inv_len = vdiv(vset(1.0f), vsqrt(len_sq));
+    vf spring_factor = vblend(coeff_long, coeff_short,
+        vlt(spring_len, target_len));
+    vf stretch = vsub(spring_len, target_len);
+    vf heat_diff = vsub(n_pos[3], pos[3]);
+    vf is_hotter = vand(valid[i], vgt(heat_diff, largest_delta));
+    for (int c = 0; c < 3; ++c) {
+      vf dir = vmul(delta_pos[c], inv_len);
+      vf next_force = vadd(force[c], vmul(vmul(spring_factor, dir), stretch));
+      force[c] = vblend(force[c], next_force, valid[i]);
+      delta_heat[c] = vblend(delta_heat[c], dir, is_hotter);
+    }
+    largest_delta = vblend(largest_delta, heat_diff, is_hotter);
+    is_fixed = vor(is_fixed, is_border[i]);
+
+    // the heat in from a hotter neighbor is the heat that it emits along
+    // the edge pointing to this node
+    vf heat_in_mask = vand(valid[i], vlt(pos[3], n_pos[3]));
+    vf heat_in = vgather(a.heat_flux,
+        vadd_i(n_aos, vset_i((i + 2) % 4)), heat_in_mask);
+    total_heat_in = vblend(total_heat_in,
+        vadd(total_heat_in, heat_in), heat_in_mask);
+  }
+
+  vf is_src = vneq(vel[3], vzero());
+  vf next_pos[4];
+  for (int c = 0; c < 3; ++c) {
+    vf src_force = vmul(vset(a.force_coeff_src), vel[c]);
+    vf heat_force = vmul(vset(a.force_coeff_heat), delta_heat[c]);
+    vf total_force = vadd(force[c], vblend(heat_force, src_force, is_src));
+    next_pos[c] = vblend(vadd(pos[c], total_force), pos[c], is_fixed);
+    if (a.fix_positions) {
+      next_pos[c] = pos[c];
+    }
+  }
+  vf total_heat_out = vadd(vadd(flux[0], flux[1]), vadd(flux[2], flux[3]));
+  total_heat_in = vadd(total_heat_in, vel[3]);
+  next_pos[3] = vadd(vsub(pos[3], total_heat_out), total_heat_in);
+
+  // compute_source_transition, for the non-source nodes: check if a
+  // neighbor has requested that this node be its clone
+  vf next_vel[4] = {vel[0], vel[1], vel[2], vel[3]};
+  vf did_promote = vzero();
+  for (int i = 0; i < 4; ++i) {
+    // requests are rare, so only the message slot is gathered until one
+    // is found
+    vf n_slot = vgather(a.data, vadd_i(vshl2(n_index[i]), vset_i(3)),
+        valid[i]);
+    vf is_request = vand(valid[i],
+        veq_i(vtoi(n_slot), vset_i((i + 2) % 4)));
+    if (vmovemask(is_request) == 0) {
+      continue;
+    }
+    vf n_data[4];
+    vload_aos_at(a.data, n_index[i],
+        n_data[0], n_data[1], n_data[2], n_data[3]);
+    vf len_sq = vadd(vadd(vmul(n_data[0], n_data[0]),
+          vmul(n_data[1], n_data[1])), vmul(n_data[2], n_data[2]));
+    vf inv_len = vdiv(vset(1.0f), vsqrt(len_sq));
+    for (int c = 0; c < 3; ++c) {
+      next_vel[c] = vblend(next_vel[c], vmul(n_data[c], inv_len), is_request);
+    }
+    next_vel[3] = vblend(next_vel[3], vsqrt(len_sq), is_request);
+    did_promote = vor(did_promote, is_request);
+  }
+  vf minus_one = vset(-1.0f);
+
+  vstore_aos(a.next_pos, first, next_pos[0], next_pos[1],
+      next_pos[2], next_pos[3]);
+  vstore_aos(a.next_vel, first, next_vel[0], next_vel[1],
+      next_vel[2], next_vel[3]);
+  vstore_aos((float*) a.next_neighbors, first, neighbors[0], neighbors[1],
+      neighbors[2], neighbors[3]);
+  vstore_aos(a.next_data, first, minus_one, minus_one, minus_one, minus_one);
+
+  // the remaining branches are left to the scalar code
+  vf needs_fixup = is_src;
+  if (a.can_promote) {
+    // promote this node to a src with some probability
+    vi noise[4];
+    vphilox4x32(a, first, NOISE_STREAM_SOURCE_TRANSITION, noise);
+    vf is_promoted = vand(vnot(did_promote),
+        vlt(vunit_float(noise[2]), vset(a.src_promote_prob)));
+    needs_fixup = vor(needs_fixup, is_promoted);
+  }
+  int fixup_bits = vmovemask(needs_fixup);
+  int num_fixups = 0;
+  for (int lane = 0; lane < LANES; ++lane) {
+    if (fixup_bits & (1 << lane)) {
+      fixup_nodes[num_fixups++] = first + lane;
+    }
+  }
+  return num_fixups;
+}
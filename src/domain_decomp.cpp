@@ -0,0 +1,366 @@
+#include "domain_decomp.h"
+#include "node_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+DomainPart::DomainPart() :
+  begin(0),
+  end(0)
+{
+}
+
+DomainStats::DomainStats() :
+  wall_ms(0.0),
+  num_halo_nodes(0)
+{
+}
+
+vector<DomainPart> partition_nodes(MorphNodes const& nodes, int num_parts) {
+  int num_nodes = nodes.size();
+  vector<DomainPart> parts(num_parts);
+  vector<int> owners(num_nodes);
+  for (int p = 0; p < num_parts; ++p) {
+    DomainPart& part = parts[p];
+    part.begin = (long) num_nodes * p / num_parts;
+    part.end = (long) num_nodes * (p + 1) / num_parts;
+    for (int i = part.begin; i < part.end; ++i) {
+      owners[i] = p;
+      part.local_nodes.push_back(i);
+    }
+  }
+
+  // the halo of a part is found two rings at a time from its nodes.
+  // in_part[i] is the last part that node i was added to.
+  vector<int> in_part(num_nodes, -1);
+  vector<uint8_t> is_sent(num_nodes, 0);
+  for (int p = 0; p < num_parts; ++p) {
+    DomainPart& part = parts[p];
+    for (int i = part.begin; i < part.end; ++i) {
+      in_part[i] = p;
+    }
+    vector<int> halo;
+    vector<int> ring(part.local_nodes);
+    for (int depth = 0; depth < 2; ++depth) {
+      vector<int> next_ring;
+      for (int node : ring) {
+        ivec4 neighbors = nodes.neighbors_vec[node];
+        for (int j = 0; j < 4; ++j) {
+          int n_index = neighbors[j];
+          if (n_index >= 0 && in_part[n_index] != p) {
+            in_part[n_index] = p;
+            next_ring.push_back(n_index);
+          }
+        }
+      }
+      halo.insert(halo.end(), next_ring.begin(), next_ring.end());
+      ring.swap(next_ring);
+    }
+    sort(halo.begin(), halo.end());
+    for (int node : halo) {
+      part.local_nodes.push_back(node);
+      is_sent[node] = 1;
+    }
+  }
+
+  // each node in a halo is sent by its owner, in index order
+  vector<int> send_slots(num_nodes, -1);
+  for (DomainPart& part : parts) {
+    for (int i = part.begin; i < part.end; ++i) {
+      if (is_sent[i]) {
+        send_slots[i] = part.send_nodes.size();
+        part.send_nodes.push_back(i);
+      }
+    }
+  }
+
+  vector<int> local_indices(num_nodes, -1);
+  for (DomainPart& part : parts) {
+    int num_local = part.local_nodes.size();
+    for (int l = 0; l < num_local; ++l) {
+      local_indices[part.local_nodes[l]] = l;
+    }
+    part.local_neighbors.resize(num_local);
+    for (int l = 0; l < num_local; ++l) {
+      ivec4 neighbors = nodes.neighbors_vec[part.local_nodes[l]];
+      for (int j = 0; j < 4; ++j) {
+        if (neighbors[j] >= 0) {
+          int local_index = local_indices[neighbors[j]];
+          neighbors[j] = local_index >= 0 ? local_index : OPEN_EDGE;
+        }
+      }
+      part.local_neighbors[l] = neighbors;
+    }
+    for (int l = part.end - part.begin; l < num_local; ++l) {
+      int node = part.local_nodes[l];
+      part.halo_owners.push_back(owners[node]);
+      part.halo_slots.push_back(send_slots[node]);
+    }
+    for (int node : part.local_nodes) {
+      local_indices[node] = -1;
+    }
+  }
+  return parts;
+}
+
+// The halo state of a node
+struct HaloNode {
+  vec4 pos;
+  vec4 data;
+};
+
+// The start of the mapping shared by the workers
+struct DomainShared {
+  // a sense-reversing barrier
+  int barrier_count;
+  int barrier_sense;
+  // set if a worker failed, so that the others stop waiting
+  int aborted;
+};
+
+// Where everything is in the shared mapping
+struct DomainMapping {
+  DomainShared* shared = nullptr;
+  // per worker
+  double* compute_ms = nullptr;
+  double* exchange_ms = nullptr;
+  // the send buffer of every part, for even and odd iterations
+  array<HaloNode*, 2> send_bufs;
+  // the index of each part's send buffer within send_bufs
+  vector<int> send_offsets;
+  // the final state of every node, in global order
+  vec4* result_pos = nullptr;
+  vec4* result_vel = nullptr;
+  vec4* result_data = nullptr;
+};
+
+// Returns false, without waiting for the others, if a worker failed
+static bool wait_at_barrier(DomainShared& shared, int num_parts,
+    int& sense) {
+  sense = 1 - sense;
+  if (__atomic_add_fetch(&shared.barrier_count, 1, __ATOMIC_ACQ_REL) ==
+      num_parts) {
+    __atomic_store_n(&shared.barrier_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&shared.barrier_sense, sense, __ATOMIC_RELEASE);
+    return true;
+  }
+  while (__atomic_load_n(&shared.barrier_sense, __ATOMIC_ACQUIRE) != sense) {
+    if (__atomic_load_n(&shared.aborted, __ATOMIC_RELAXED)) {
+      return false;
+    }
+    sched_yield();
+  }
+  return true;
+}
+
+static double ms_since(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(
+      chrono::steady_clock::now() - start).count();
+}
+
+// Runs the iterations of parts[part_index] from nodes, the state of the
+// whole zygote after start_iter iterations, and writes its nodes to the
+// result. Returns false if another worker failed.
+static bool run_domain_worker(DomainMapping const& mapping,
+    vector<DomainPart> const& parts, int part_index,
+    GrowthParams const& params, MorphNodes const& nodes,
+    const int* node_ids, int start_iter, int end_iter) {
+  DomainPart const& part = parts[part_index];
+  int num_parts = parts.size();
+  int num_local = part.local_nodes.size();
+  int num_owned = part.end - part.begin;
+
+  array<MorphNodes, 2> buffers;
+  for (MorphNodes& buf : buffers) {
+    buf.resize(num_local);
+    buf.neighbors_vec = part.local_neighbors;
+  }
+  MorphNodes& first = buffers[start_iter & 1];
+  vector<int> local_ids(num_local);
+  for (int l = 0; l < num_local; ++l) {
+    int node = part.local_nodes[l];
+    first.pos_vec[l] = nodes.pos_vec[node];
+    first.vel_vec[l] = nodes.vel_vec[node];
+    first.data_vec[l] = nodes.data_vec[node];
+    local_ids[l] = node_ids ? node_ids[node] : node;
+  }
+
+  int sense = 0;
+  double compute_ms = 0.0;
+  double exchange_ms = 0.0;
+  for (int i = start_iter; i < end_iter; ++i) {
+    MorphNodes const& cur_buf = buffers[i & 1];
+    MorphNodes& next_buf = buffers[(i + 1) & 1];
+    auto start_time = chrono::steady_clock::now();
+    run_cpu_iter(params, cur_buf, next_buf, local_ids.data(), i,
+        0, num_owned);
+    compute_ms += ms_since(start_time);
+
+    start_time = chrono::steady_clock::now();
+    HaloNode* send_buf = mapping.send_bufs[(i + 1) & 1];
+    HaloNode* part_send_buf = send_buf + mapping.send_offsets[part_index];
+    for (int k = 0; k < part.send_nodes.size(); ++k) {
+      int l = part.send_nodes[k] - part.begin;
+      part_send_buf[k].pos = next_buf.pos_vec[l];
+      part_send_buf[k].data = next_buf.data_vec[l];
+    }
+    if (!wait_at_barrier(*mapping.shared, num_parts, sense)) {
+      return false;
+    }
+    for (int h = 0; h < part.halo_owners.size(); ++h) {
+      HaloNode const& halo_node = send_buf[
+        mapping.send_offsets[part.halo_owners[h]] + part.halo_slots[h]];
+      next_buf.pos_vec[num_owned + h] = halo_node.pos;
+      next_buf.data_vec[num_owned + h] = halo_node.data;
+    }
+    exchange_ms += ms_since(start_time);
+  }
+
+  MorphNodes const& result = buffers[end_iter & 1];
+  for (int l = 0; l < num_owned; ++l) {
+    int node = part.begin + l;
+    mapping.result_pos[node] = result.pos_vec[l];
+    mapping.result_vel[node] = result.vel_vec[l];
+    mapping.result_data[node] = result.data_vec[l];
+  }
+  mapping.compute_ms[part_index] = compute_ms;
+  mapping.exchange_ms[part_index] = exchange_ms;
+  return true;
+}
+
+// Rounds num_bytes up to a multiple of 16, the alignment of a vec4
+static size_t align_bytes(size_t num_bytes) {
+  return (num_bytes + 15) & ~(size_t) 15;
+}
+
+bool run_domain_simulation(CpuMorphState& cpu_state,
+    GrowthParams const& params, int start_iter, int end_iter,
+    int num_workers, DomainStats* stats) {
+  if (node_pool_enabled(cpu_state.node_pool)) {
+    printf("domain decomposition: the node pool is not supported\n");
+    return false;
+  }
+  num_workers = std::max(num_workers, 1);
+  auto start_time = chrono::steady_clock::now();
+  int num_nodes = cpu_state.buffers[start_iter & 1].size();
+  const int* node_ids = cpu_state.node_ids.empty() ?
+    nullptr : cpu_state.node_ids.data();
+  cpu_state.result_buffer_index = end_iter % 2;
+  if (start_iter == 0 && end_iter > 0) {
+    // the init iteration places the first source by the size of the
+    // whole zygote (see run_init_iter)
+    cpu_state.buffers[1].resize(num_nodes);
+    run_cpu_iter(params, cpu_state.buffers[0], cpu_state.buffers[1],
+        node_ids, 0, 0, num_nodes);
+    start_iter = 1;
+  }
+  if (start_iter >= end_iter) {
+    return true;
+  }
+  MorphNodes const& nodes = cpu_state.buffers[start_iter & 1];
+  vector<DomainPart> parts = partition_nodes(nodes, num_workers);
+
+  // lay out the shared mapping
+  DomainMapping mapping;
+  int total_send_nodes = 0;
+  for (DomainPart const& part : parts) {
+    mapping.send_offsets.push_back(total_send_nodes);
+    total_send_nodes += part.send_nodes.size();
+  }
+  size_t stats_offset = align_bytes(sizeof(DomainShared));
+  size_t send_offset = stats_offset +
+    align_bytes(2 * num_workers * sizeof(double));
+  size_t send_bytes = align_bytes(total_send_nodes * sizeof(HaloNode));
+  size_t result_offset = send_offset + 2 * send_bytes;
+  size_t num_bytes = result_offset + 3 * num_nodes * sizeof(vec4);
+  // an anonymous shared mapping is zeroed and survives the fork
+  void* mem = mmap(nullptr, num_bytes, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANON, -1, 0);
+  if (mem == MAP_FAILED) {
+    printf("domain decomposition: could not map %.1fMB of shared memory\n",
+        num_bytes / (float) (1 << 20));
+    return false;
+  }
+  char* base = (char*) mem;
+  mapping.shared = (DomainShared*) base;
+  mapping.compute_ms = (double*) (base + stats_offset);
+  mapping.exchange_ms = mapping.compute_ms + num_workers;
+  mapping.send_bufs[0] = (HaloNode*) (base + send_offset);
+  mapping.send_bufs[1] = (HaloNode*) (base + send_offset + send_bytes);
+  mapping.result_pos = (vec4*) (base + result_offset);
+  mapping.result_vel = mapping.result_pos + num_nodes;
+  mapping.result_data = mapping.result_vel + num_nodes;
+
+  // so that the workers do not print what is still buffered
+  fflush(stdout);
+  vector<pid_t> pids;
+  bool ok = true;
+  for (int p = 0; p < num_workers; ++p) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      // _exit, so that the worker does not run the caller's exit handlers
+      bool worker_ok = run_domain_worker(mapping, parts, p, params, nodes,
+          node_ids, start_iter, end_iter);
+      _exit(worker_ok ? 0 : 1);
+    }
+    if (pid < 0) {
+      printf("domain decomposition: could not start worker %d\n", p);
+      __atomic_store_n(&mapping.shared->aborted, 1, __ATOMIC_RELAXED);
+      ok = false;
+      break;
+    }
+    pids.push_back(pid);
+  }
+
+  // poll rather than wait on one worker at a time, so that the others
+  // are stopped as soon as any of them fails
+  while (!pids.empty()) {
+    for (int k = 0; k < pids.size(); ++k) {
+      int status = 0;
+      if (waitpid(pids[k], &status, WNOHANG) == 0) {
+        continue;
+      }
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        if (ok) {
+          printf("domain decomposition: a worker failed\n");
+        }
+        __atomic_store_n(&mapping.shared->aborted, 1, __ATOMIC_RELAXED);
+        ok = false;
+      }
+      pids.erase(pids.begin() + k);
+      --k;
+    }
+    if (!pids.empty()) {
+      usleep(1000);
+    }
+  }
+
+  if (ok) {
+    MorphNodes& result = cpu_state.buffers[end_iter & 1];
+    if (&result != &nodes) {
+      result.resize(num_nodes);
+      result.neighbors_vec = nodes.neighbors_vec;
+    }
+    result.pos_vec.assign(mapping.result_pos, mapping.result_pos + num_nodes);
+    result.vel_vec.assign(mapping.result_vel, mapping.result_vel + num_nodes);
+    result.data_vec.assign(mapping.result_data,
+        mapping.result_data + num_nodes);
+    if (stats) {
+      stats->compute_ms.assign(mapping.compute_ms,
+          mapping.compute_ms + num_workers);
+      stats->exchange_ms.assign(mapping.exchange_ms,
+          mapping.exchange_ms + num_workers);
+      stats->num_halo_nodes = 0;
+      for (DomainPart const& part : parts) {
+        stats->num_halo_nodes += part.halo_owners.size();
+      }
+      stats->wall_ms = ms_since(start_time);
+    }
+  }
+  munmap(mem, num_bytes);
+  return ok;
+}
@@ -0,0 +1,147 @@
+#include "frame_stats.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+const char* FRAME_SERIES_NAMES[FRAME_SERIES_COUNT] = {
+  "sim", "upload", "render", "ui", "work", "frame"
+};
+
+static double steady_ms() {
+  return chrono::duration<double, milli>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FramePhaseScope::FramePhaseScope(FrameStats& stats, int phase) :
+  stats(stats),
+  prev_phase(switch_frame_phase(stats, phase))
+{
+}
+
+FramePhaseScope::~FramePhaseScope() {
+  switch_frame_phase(stats, prev_phase);
+}
+
+FramePercentiles::FramePercentiles() :
+  p50(0.0f),
+  p95(0.0f),
+  p99(0.0f),
+  max(0.0f),
+  num_over_budget(0),
+  num_frames(0)
+{
+}
+
+void begin_frame(FrameStats& stats) {
+  double now_ms = steady_ms();
+  if (stats.frame_open) {
+    switch_frame_phase(stats, -1);
+    FrameTimes& frame = stats.cur_frame;
+    frame.ms[FRAME_SERIES_INTERVAL] = now_ms - stats.frame_begin_ms;
+    frame.frame_num = stats.num_frames;
+    stats.frames[stats.num_frames % FRAME_STATS_WINDOW] = frame;
+    stats.num_frames += 1;
+  }
+  stats.cur_frame = FrameTimes();
+  stats.frame_open = true;
+  stats.frame_begin_ms = now_ms;
+  stats.cur_phase = -1;
+  stats.phase_begin_ms = now_ms;
+}
+
+void end_frame_work(FrameStats& stats) {
+  if (!stats.frame_open) {
+    return;
+  }
+  switch_frame_phase(stats, -1);
+  stats.cur_frame.ms[FRAME_SERIES_WORK] = steady_ms() - stats.frame_begin_ms;
+}
+
+int switch_frame_phase(FrameStats& stats, int phase) {
+  int prev_phase = stats.cur_phase;
+  if (!stats.frame_open) {
+    return prev_phase;
+  }
+  double now_ms = steady_ms();
+  if (prev_phase >= 0) {
+    stats.cur_frame.ms[prev_phase] += now_ms - stats.phase_begin_ms;
+  }
+  stats.cur_phase = phase;
+  stats.phase_begin_ms = now_ms;
+  return prev_phase;
+}
+
+// Returns series of the recorded frames, oldest first
+static vector<float> recorded_series(FrameStats const& stats, int series) {
+  int num_kept = std::min(stats.num_frames, FRAME_STATS_WINDOW);
+  vector<float> values(num_kept);
+  for (int i = 0; i < num_kept; ++i) {
+    int frame_num = stats.num_frames - num_kept + i;
+    values[i] = stats.frames[frame_num % FRAME_STATS_WINDOW].ms[series];
+  }
+  return values;
+}
+
+FramePercentiles compute_frame_percentiles(FrameStats const& stats,
+    int series, float budget_ms) {
+  FramePercentiles result;
+  vector<float> values = recorded_series(stats, series);
+  result.num_frames = values.size();
+  if (values.empty()) {
+    return result;
+  }
+  sort(values.begin(), values.end());
+  auto nearest_rank = [&](double p) {
+    int rank = (int) ceil(p * values.size());
+    return values[std::max(rank, 1) - 1];
+  };
+  result.p50 = nearest_rank(0.50);
+  result.p95 = nearest_rank(0.95);
+  result.p99 = nearest_rank(0.99);
+  result.max = values.back();
+  if (budget_ms > 0.0f) {
+    result.num_over_budget = values.end() -
+      upper_bound(values.begin(), values.end(), budget_ms);
+  }
+  return result;
+}
+
+vector<float> frame_time_histogram(FrameStats const& stats, int series,
+    int num_buckets, float max_ms) {
+  vector<float> counts(num_buckets, 0.0f);
+  if (num_buckets <= 0 || max_ms <= 0.0f) {
+    return counts;
+  }
+  for (float ms : recorded_series(stats, series)) {
+    int bucket = (int) (ms / max_ms * num_buckets);
+    counts[clamp(bucket, 0, num_buckets - 1)] += 1.0f;
+  }
+  return counts;
+}
+
+bool write_frame_stats_csv(FrameStats const& stats, string const& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    printf("could not open %s for writing\n", path.c_str());
+    return false;
+  }
+  fprintf(file, "frame");
+  for (int series = 0; series < FRAME_SERIES_COUNT; ++series) {
+    fprintf(file, ",%s_ms", FRAME_SERIES_NAMES[series]);
+  }
+  fprintf(file, "\n");
+  int num_kept = std::min(stats.num_frames, FRAME_STATS_WINDOW);
+  for (int i = 0; i < num_kept; ++i) {
+    FrameTimes const& frame = stats.frames[
+      (stats.num_frames - num_kept + i) % FRAME_STATS_WINDOW];
+    fprintf(file, "%d", frame.frame_num);
+    for (float ms : frame.ms) {
+      fprintf(file, ",%.3f", ms);
+    }
+    fprintf(file, "\n");
+  }
+  fclose(file);
+  printf("wrote %d frames to %s\n", num_kept, path.c_str());
+  return true;
+}
@@ -0,0 +1,165 @@
+#include "gpu_buffers.h"
+
+#include <algorithm>
+#include <cassert>
+
+// the smallest storage a buffer grows to, so that small zygotes do not
+// reallocate every few nodes
+const size_t GPU_BUFFER_MIN_BYTES = 64 << 10;
+
+static GpuBuffer* find_gpu_buffer(GpuBuffers& bufs, GLuint buffer) {
+  for (GpuBuffer& buf : bufs.buffers) {
+    if (buf.handle == buffer) {
+      return &buf;
+    }
+  }
+  return nullptr;
+}
+
+static float to_mb(size_t num_bytes) {
+  return num_bytes / (float) (1 << 20);
+}
+
+// Binds to a copy target, which unlike GL_ARRAY_BUFFER and
+// GL_ELEMENT_ARRAY_BUFFER does not change any VAO. Returns false if the
+// storage could not be allocated.
+static bool alloc_storage(GLuint buffer, size_t num_bytes, GLenum usage) {
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, num_bytes, nullptr, usage);
+  return glGetError() != GL_OUT_OF_MEMORY;
+}
+
+static void copy_buffer(GLuint src, GLuint dst, size_t num_bytes) {
+  glBindBuffer(GL_COPY_READ_BUFFER, src);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+      0, 0, num_bytes);
+}
+
+GLuint create_gpu_buffer(GpuBuffers& bufs, GLenum usage,
+    GLuint tex_buf, GLenum tex_format) {
+  GpuBuffer buf;
+  glGenBuffers(1, &buf.handle);
+  // the first bind creates the buffer, with no storage
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buf.handle);
+  buf.usage = usage;
+  buf.tex_buf = tex_buf;
+  buf.tex_format = tex_format;
+  if (tex_buf != 0) {
+    glBindTexture(GL_TEXTURE_BUFFER, tex_buf);
+    glTexBuffer(GL_TEXTURE_BUFFER, tex_format, buf.handle);
+  }
+  bufs.buffers.push_back(buf);
+  return buf.handle;
+}
+
+// The growth that reserving num_bytes in buffer needs at the least
+static size_t min_growth(GpuBuffers& bufs, GLuint buffer, size_t num_bytes) {
+  GpuBuffer* buf = find_gpu_buffer(bufs, buffer);
+  assert(buf);
+  return num_bytes > buf->capacity ? num_bytes - buf->capacity : 0;
+}
+
+// reserve_gpu_buffer, leaving held_bytes of the budget for other buffers
+static bool grow_gpu_buffer(GpuBuffers& bufs, GLuint buffer,
+    size_t num_bytes, size_t keep_bytes, size_t held_bytes) {
+  GpuBuffer* buf = find_gpu_buffer(bufs, buffer);
+  assert(buf);
+  if (num_bytes <= buf->capacity) {
+    return true;
+  }
+  size_t other_bytes = bufs.cur_bytes - buf->capacity + held_bytes;
+  size_t budget = bufs.budget_bytes;
+  if (budget > 0 && other_bytes + num_bytes > budget) {
+    printf("GPU buffers: %.1fMB would go over the budget of %.1fMB\n",
+        to_mb(other_bytes + num_bytes), to_mb(budget));
+    return false;
+  }
+  size_t new_capacity = std::max(std::max(num_bytes, 2 * buf->capacity),
+      GPU_BUFFER_MIN_BYTES);
+  if (budget > 0 && other_bytes + new_capacity > budget) {
+    new_capacity = num_bytes;
+  }
+  other_bytes -= held_bytes;
+
+  // so that any error after glBufferData is from it
+  log_gl_errors("before reserving a GPU buffer");
+
+  // glBufferData discards the contents, so the kept bytes are moved
+  // through a temporary buffer
+  keep_bytes = std::min(keep_bytes, buf->capacity);
+  GLuint temp_buffer = 0;
+  if (keep_bytes > 0) {
+    glGenBuffers(1, &temp_buffer);
+    if (!alloc_storage(temp_buffer, keep_bytes, GL_STREAM_COPY)) {
+      printf("GPU buffers: out of memory for %.1fMB\n", to_mb(keep_bytes));
+      glDeleteBuffers(1, &temp_buffer);
+      return false;
+    }
+    copy_buffer(buffer, temp_buffer, keep_bytes);
+  }
+
+  bool ok = alloc_storage(buffer, new_capacity, buf->usage);
+  if (ok) {
+    bufs.cur_bytes = other_bytes + new_capacity;
+    bufs.peak_bytes = std::max(bufs.peak_bytes, bufs.cur_bytes);
+    ++bufs.num_reallocs;
+    buf->capacity = new_capacity;
+  } else {
+    printf("GPU buffers: out of memory for %.1fMB\n", to_mb(new_capacity));
+    // try to get back the old storage
+    if (!alloc_storage(buffer, buf->capacity, buf->usage)) {
+      bufs.cur_bytes = other_bytes;
+      buf->capacity = 0;
+      keep_bytes = 0;
+    }
+  }
+  if (temp_buffer != 0) {
+    if (keep_bytes > 0) {
+      copy_buffer(temp_buffer, buffer, keep_bytes);
+    }
+    glDeleteBuffers(1, &temp_buffer);
+  }
+  if (buf->tex_buf != 0) {
+    glBindTexture(GL_TEXTURE_BUFFER, buf->tex_buf);
+    glTexBuffer(GL_TEXTURE_BUFFER, buf->tex_format, buffer);
+  }
+  log_gl_errors("reserve GPU buffer");
+  return ok;
+}
+
+bool reserve_gpu_buffer(GpuBuffers& bufs, GLuint buffer, size_t num_bytes,
+    size_t keep_bytes) {
+  return grow_gpu_buffer(bufs, buffer, num_bytes, keep_bytes, 0);
+}
+
+bool reserve_gpu_buffers(GpuBuffers& bufs,
+    vector<GpuBufferReserve> const& reserves) {
+  size_t growth = 0;
+  for (GpuBufferReserve const& r : reserves) {
+    growth += min_growth(bufs, r.buffer, r.num_bytes);
+  }
+  size_t budget = bufs.budget_bytes;
+  if (budget > 0 && bufs.cur_bytes + growth > budget) {
+    printf("GPU buffers: %.1fMB would go over the budget of %.1fMB\n",
+        to_mb(bufs.cur_bytes + growth), to_mb(budget));
+    return false;
+  }
+  for (GpuBufferReserve const& r : reserves) {
+    growth -= min_growth(bufs, r.buffer, r.num_bytes);
+    if (!grow_gpu_buffer(bufs, r.buffer, r.num_bytes, r.keep_bytes,
+          growth)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+size_t gpu_buffer_capacity(GpuBuffers const& bufs, GLuint buffer) {
+  for (GpuBuffer const& buf : bufs.buffers) {
+    if (buf.handle == buffer) {
+      return buf.capacity;
+    }
+  }
+  return 0;
+}
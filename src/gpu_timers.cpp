@@ -0,0 +1,128 @@
+#include "gpu_timers.h"
+
+#include <chrono>
+
+const char* GPU_PASS_NAMES[GPU_PASS_COUNT] = {
+  "sim flux", "sim update", "sim codec", "residual", "faces", "wireframe",
+  "points"
+};
+
+static double steady_ms() {
+  return chrono::duration<double, milli>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Adds the results of frame to the history. Returns false, reading
+// nothing, if they are not all available yet. The results are dropped if
+// they add up to more than the time since the frame began, as llvmpipe
+// gives a bogus time for the first query with any work in it.
+static bool collect_gpu_timer_frame(GpuTimers& timers,
+    GpuTimerFrame const& frame) {
+  for (GLuint query : frame.queries) {
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      return false;
+    }
+  }
+  array<double, GPU_PASS_COUNT> frame_ms = {0.0};
+  for (int i = 0; i < frame.queries.size(); ++i) {
+    GLuint64 elapsed_ns = 0;
+    glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &elapsed_ns);
+    frame_ms[frame.passes[i]] += elapsed_ns * 1e-6;
+  }
+  double total_ms = 0.0;
+  for (double ms : frame_ms) {
+    total_ms += ms;
+  }
+  if (total_ms > steady_ms() - frame.begin_ms) {
+    timers.num_dropped += 1;
+    return true;
+  }
+  int slot = timers.num_collected % GPU_TIMER_HISTORY;
+  for (int pass = 0; pass < GPU_PASS_COUNT; ++pass) {
+    timers.history_ms[pass][slot] = (float) frame_ms[pass];
+  }
+  timers.num_collected += 1;
+  timers.last_num_untimed = frame.num_untimed;
+  return true;
+}
+
+void begin_gpu_timer_frame(GpuTimers& timers, bool enabled) {
+  end_gpu_timer(timers);
+  // the frames complete in order, so stop at the first that has not
+  int num_done = 0;
+  while (num_done < timers.frames.size()) {
+    GpuTimerFrame const& frame = timers.frames[num_done];
+    if (timers.frame_num - frame.frame_num < GPU_TIMER_LATENCY ||
+        !collect_gpu_timer_frame(timers, frame)) {
+      break;
+    }
+    timers.free_queries.insert(timers.free_queries.end(),
+        frame.queries.begin(), frame.queries.end());
+    timers.num_in_flight -= frame.queries.size();
+    num_done += 1;
+  }
+  timers.frames.erase(timers.frames.begin(),
+      timers.frames.begin() + num_done);
+
+  timers.enabled = enabled;
+  timers.frame_num += 1;
+  GpuTimerFrame frame;
+  frame.frame_num = timers.frame_num;
+  frame.begin_ms = steady_ms();
+  timers.frames.push_back(frame);
+  log_gl_errors("begin gpu timer frame");
+}
+
+void begin_gpu_timer(GpuTimers& timers, int pass) {
+  if (!timers.enabled || timers.active_pass >= 0) {
+    return;
+  }
+  // passes timed before the first frame count towards it
+  if (timers.frames.empty()) {
+    timers.frames.push_back(GpuTimerFrame());
+    timers.frames.back().frame_num = timers.frame_num;
+    timers.frames.back().begin_ms = steady_ms();
+  }
+  GpuTimerFrame& frame = timers.frames.back();
+  if (timers.num_in_flight >= GPU_TIMER_MAX_QUERIES) {
+    frame.num_untimed += 1;
+    return;
+  }
+  GLuint query = 0;
+  if (timers.free_queries.empty()) {
+    glGenQueries(1, &query);
+  } else {
+    query = timers.free_queries.back();
+    timers.free_queries.pop_back();
+  }
+  glBeginQuery(GL_TIME_ELAPSED, query);
+  frame.queries.push_back(query);
+  frame.passes.push_back(pass);
+  timers.num_in_flight += 1;
+  timers.active_pass = pass;
+}
+
+void end_gpu_timer(GpuTimers& timers) {
+  if (timers.active_pass < 0) {
+    return;
+  }
+  glEndQuery(GL_TIME_ELAPSED);
+  timers.active_pass = -1;
+}
+
+void gpu_pass_stats(GpuTimers const& timers, int pass, float& mean_ms,
+    float& max_ms) {
+  int num_frames = std::min(timers.num_collected, GPU_TIMER_HISTORY);
+  mean_ms = 0.0f;
+  max_ms = 0.0f;
+  for (int i = 0; i < num_frames; ++i) {
+    float ms = timers.history_ms[pass][i];
+    mean_ms += ms;
+    max_ms = std::max(max_ms, ms);
+  }
+  if (num_frames > 0) {
+    mean_ms /= num_frames;
+  }
+}
@@ -0,0 +1,166 @@
+#include "mesh_export.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+// Collects writes into a fixed-size buffer, which is flushed to the
+// file whenever it fills up
+struct ChunkWriter {
+  FILE* file = nullptr;
+  vector<char> buf;
+  size_t len = 0;
+  bool ok = true;
+
+  ChunkWriter(FILE* file, size_t chunk_size) :
+    file(file), buf(chunk_size), len(0), ok(true)
+  {
+  }
+
+  void flush() {
+    if (len > 0 && fwrite(buf.data(), 1, len, file) != len) {
+      ok = false;
+    }
+    len = 0;
+  }
+
+  // Returns space for at least num_bytes bytes, to be followed by
+  // commit(num_bytes_used)
+  char* reserve(size_t num_bytes) {
+    assert(num_bytes <= buf.size());
+    if (len + num_bytes > buf.size()) {
+      flush();
+    }
+    return buf.data() + len;
+  }
+
+  void commit(size_t num_bytes) {
+    len += num_bytes;
+  }
+
+  void write(const void* data, size_t num_bytes) {
+    memcpy(reserve(num_bytes), data, num_bytes);
+    commit(num_bytes);
+  }
+};
+
+const size_t MESH_EXPORT_CHUNK_SIZE = 4 << 20;
+
+int mesh_format_for_path(string const& path) {
+  vector<pair<const char*, int>> extensions = {
+    {".ply", MESH_FORMAT_PLY},
+    {".obj", MESH_FORMAT_OBJ},
+  };
+  for (auto& ext : extensions) {
+    size_t ext_len = strlen(ext.first);
+    if (path.size() >= ext_len &&
+        path.compare(path.size() - ext_len, ext_len, ext.first) == 0) {
+      return ext.second;
+    }
+  }
+  return -1;
+}
+
+// Writes the decimal digits of x to out, returning the number written.
+// Much faster than snprintf for the millions of face indices.
+static int write_uint(char* out, uint32_t x) {
+  char digits[10];
+  int num_digits = 0;
+  do {
+    digits[num_digits++] = '0' + x % 10;
+    x /= 10;
+  } while (x != 0);
+  for (int i = 0; i < num_digits; ++i) {
+    out[i] = digits[num_digits - 1 - i];
+  }
+  return num_digits;
+}
+
+static void write_ply(ChunkWriter& writer, int num_nodes,
+    vec4 const* pos, vec4 const* vel, int num_indices, GLuint const* indices) {
+  array<char, 400> header;
+  int header_len = snprintf(header.data(), header.size(),
+      "ply\n"
+      "format binary_little_endian 1.0\n"
+      "comment generated by morph\n"
+      "element vertex %d\n"
+      "property float x\n"
+      "property float y\n"
+      "property float z\n"
+      "property float heat\n"
+      "property uchar is_source\n"
+      "element face %d\n"
+      "property list uchar int vertex_indices\n"
+      "end_header\n",
+      num_nodes, num_indices / 3);
+  writer.write(header.data(), header_len);
+
+  // the records are packed, with no padding
+  const size_t vertex_size = 4 * sizeof(float) + 1;
+  for (int i = 0; i < num_nodes; ++i) {
+    char* out = writer.reserve(vertex_size);
+    memcpy(out, &pos[i][0], 4 * sizeof(float));
+    out[4 * sizeof(float)] = vel[i].w != 0.0f;
+    writer.commit(vertex_size);
+  }
+  const size_t face_size = 1 + 3 * sizeof(int32_t);
+  for (int i = 0; i + 2 < num_indices; i += 3) {
+    char* out = writer.reserve(face_size);
+    out[0] = 3;
+    memcpy(out + 1, &indices[i], 3 * sizeof(int32_t));
+    writer.commit(face_size);
+  }
+}
+
+static void write_obj(ChunkWriter& writer, int num_nodes,
+    vec4 const* pos, vec4 const* vel, int num_indices, GLuint const* indices) {
+  const char* header = "# generated by morph\n"
+    "# vt is {heat, is_source} of each vertex\n";
+  writer.write(header, strlen(header));
+
+  const size_t max_line_len = 128;
+  for (int i = 0; i < num_nodes; ++i) {
+    char* out = writer.reserve(max_line_len);
+    int len = snprintf(out, max_line_len, "v %.7g %.7g %.7g\nvt %.7g %d\n",
+        pos[i].x, pos[i].y, pos[i].z, pos[i].w, vel[i].w != 0.0f);
+    writer.commit(len);
+  }
+  for (int i = 0; i + 2 < num_indices; i += 3) {
+    char* out = writer.reserve(max_line_len);
+    int len = 0;
+    out[len++] = 'f';
+    for (int k = 0; k < 3; ++k) {
+      // OBJ indices start at 1
+      uint32_t obj_index = indices[i + k] + 1;
+      out[len++] = ' ';
+      len += write_uint(out + len, obj_index);
+      out[len++] = '/';
+      len += write_uint(out + len, obj_index);
+    }
+    out[len++] = '\n';
+    writer.commit(len);
+  }
+}
+
+bool export_mesh(string const& path, int format, int num_nodes,
+    vec4 const* pos, vec4 const* vel,
+    int num_indices, GLuint const* indices) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    printf("could not open %s for writing\n", path.c_str());
+    return false;
+  }
+  ChunkWriter writer(file, MESH_EXPORT_CHUNK_SIZE);
+  if (format == MESH_FORMAT_PLY) {
+    write_ply(writer, num_nodes, pos, vel, num_indices, indices);
+  } else {
+    write_obj(writer, num_nodes, pos, vel, num_indices, indices);
+  }
+  writer.flush();
+  bool ok = fclose(file) == 0 && writer.ok;
+  if (!ok) {
+    printf("error writing mesh %s\n", path.c_str());
+  }
+  return ok;
+}
+
@@ -0,0 +1,102 @@
+#include "morph_data.h"
+#include "trace.h"
+
+#include <cassert>
+
+vec3 gen_sphere(vec2 unit) {
+  float v_angle = unit[1] * M_PI;
+  float h_angle = unit[0] * 2.0 * M_PI;
+  return vec3(
+      sin(v_angle) * cos(h_angle),
+      sin(v_angle) * sin(h_angle),
+      cos(v_angle));
+}
+
+vec3 gen_square(vec2 unit) {
+  return vec3(unit, 0);
+}
+
+vec3 gen_plane(vec2 unit) {
+  vec2 plane_pos = 10.0f * (unit - 0.5f);
+  return vec3(plane_pos[0], 0.0f, plane_pos[1]);
+}
+
+// Helper for gen_morph_data
+// returns -1 if the coord is outside the plane
+int coord_to_index(ivec2 coord, ivec2 samples) {
+  if ((0 <= coord[0] && coord[0] < samples[0]) &&
+      (0 <= coord[1] && coord[1] < samples[1])) {
+    return coord[0] % samples[0] + samples[0] * (coord[1] % samples[1]);
+  } else {
+    return -1;
+  }
+}
+
+// Outputs the nodes and the triangle indices, for rendering
+void gen_morph_data(ivec2 samples, MorphNodes& out_nodes,
+    vector<GLuint>& out_indices) {
+  MORPH_TRACE_ZONE("gen_morph_data");
+  MorphNodes nodes(samples[0] * samples[1]);
+  vector<GLuint> indices;
+  indices.reserve(6 * (samples[0] - 1) * (samples[1] - 1));
+  for (int y = 0; y < samples[1]; ++y) {
+    for (int x = 0; x < samples[0]; ++x) {
+      ivec2 coord(x, y);
+      vec3 pos = gen_plane(vec2(coord) / vec2(samples - 1));
+
+      int upper_neighbor = coord_to_index(coord + ivec2(0, 1), samples);
+      int lower_neighbor = coord_to_index(coord + ivec2(0, -1), samples);
+      int right_neighbor = coord_to_index(coord + ivec2(1, 0), samples);
+      int left_neighbor = coord_to_index(coord + ivec2(-1, 0), samples);
+      ivec4 neighbors(right_neighbor, upper_neighbor,
+          left_neighbor, lower_neighbor);
+
+      int my_index = coord_to_index(coord, samples);
+      nodes.pos_vec[my_index] = vec4(pos, 0.0);
+      nodes.vel_vec[my_index] = vec4(0.0);
+      nodes.neighbors_vec[my_index] = neighbors;
+      nodes.data_vec[my_index] = vec4(0.0);
+
+      // if this is the lower-left vert of a valid face, add the indices for
+      // the two triangles that make up the quad
+      if (right_neighbor != -1 && upper_neighbor != -1) {
+        int opposite_neighbor = coord_to_index(coord + ivec2(1, 1), samples);
+        assert(opposite_neighbor != -1);
+        GLuint quad_indices[6] = {
+          (GLuint) my_index, (GLuint) right_neighbor, (GLuint) opposite_neighbor,
+          (GLuint) my_index, (GLuint) opposite_neighbor, (GLuint) upper_neighbor
+        };
+        indices.insert(indices.end(), quad_indices, quad_indices + 6);
+      }
+    }
+  }
+  out_nodes = std::move(nodes);
+  out_indices = std::move(indices);
+}
+
+
+void write_nodes(FILE* file, MorphNodes const& node_vecs) {
+  fprintf(file, "%lu nodes:\n", node_vecs.pos_vec.size()); 
+  for (int i = 0; i < node_vecs.pos_vec.size(); ++i) {
+    MorphNode node = node_vecs.node_at(i);
+    fprintf(file, "%4d %s\n", i, raw_node_str(node).c_str());
+  }
+  fprintf(file, "\n\n");
+}
+
+void write_nodes_csv(FILE* file, MorphNodes const& node_vecs) {
+  fprintf(file, "pos_x,pos_y,pos_z,pos_w,vel_x,vel_y,vel_z,vel_w,"
+      "right,upper,left,lower,data_x,data_y,data_z,data_w\n");
+  for (int i = 0; i < node_vecs.pos_vec.size(); ++i) {
+    vec4 pos = node_vecs.pos_vec[i];
+    vec4 vel = node_vecs.vel_vec[i];
+    ivec4 n = node_vecs.neighbors_vec[i];
+    vec4 data = node_vecs.data_vec[i];
+    // %.9g round-trips a float
+    fprintf(file, "%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,%.9g,"
+        "%d,%d,%d,%d,%.9g,%.9g,%.9g,%.9g\n",
+        pos[0], pos[1], pos[2], pos[3], vel[0], vel[1], vel[2], vel[3],
+        n[0], n[1], n[2], n[3], data[0], data[1], data[2], data[3]);
+  }
+}
+
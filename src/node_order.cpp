@@ -0,0 +1,296 @@
+#include "node_order.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+const char* NODE_ORDER_NAMES[NODE_ORDER_COUNT] = {
+  "row-major", "morton", "hilbert", "rcm", "tiled"
+};
+
+int node_order_for_name(string const& name) {
+  for (int i = 0; i < NODE_ORDER_COUNT; ++i) {
+    if (name == NODE_ORDER_NAMES[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+LocalityStats::LocalityStats()
+{
+}
+
+// Interleaves the bits of x and y, x in the low bit
+static uint64_t morton_key(uint32_t x, uint32_t y) {
+  uint64_t key = 0;
+  for (int b = 0; b < 32; ++b) {
+    key |= (uint64_t) ((x >> b) & 1) << (2 * b);
+    key |= (uint64_t) ((y >> b) & 1) << (2 * b + 1);
+  }
+  return key;
+}
+
+// The distance along the Hilbert curve that fills the n x n grid, where
+// n is a power of 2
+static uint64_t hilbert_key(uint32_t n, uint32_t x, uint32_t y) {
+  uint64_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    d += (uint64_t) s * s * ((3 * rx) ^ ry);
+    // rotate the quadrant
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+// Orders the nodes by the key of their grid coord
+template <typename KeyFunc>
+static vector<int> order_by_key(ivec2 samples, KeyFunc key_func) {
+  int num_nodes = samples[0] * samples[1];
+  vector<pair<uint64_t, int>> keys(num_nodes);
+  for (int i = 0; i < num_nodes; ++i) {
+    keys[i] = make_pair(key_func(i % samples[0], i / samples[0]), i);
+  }
+  sort(keys.begin(), keys.end());
+  vector<int> new_to_old(num_nodes);
+  for (int i = 0; i < num_nodes; ++i) {
+    new_to_old[i] = keys[i].second;
+  }
+  return new_to_old;
+}
+
+static int node_degree(MorphNodes const& nodes, int i) {
+  int degree = 0;
+  for (int k = 0; k < 4; ++k) {
+    degree += nodes.neighbors_vec[i][k] >= 0;
+  }
+  return degree;
+}
+
+static vector<int> rcm_order(MorphNodes const& nodes) {
+  int num_nodes = nodes.pos_vec.size();
+  vector<int> order;
+  order.reserve(num_nodes);
+  vector<bool> visited(num_nodes, false);
+  // start each component from a node of minimum degree (a corner)
+  vector<int> starts(num_nodes);
+  for (int i = 0; i < num_nodes; ++i) {
+    starts[i] = i;
+  }
+  stable_sort(starts.begin(), starts.end(), [&](int a, int b) {
+    return node_degree(nodes, a) < node_degree(nodes, b);
+  });
+  for (int start : starts) {
+    if (visited[start]) {
+      continue;
+    }
+    // breadth-first, visiting the neighbors in order of increasing degree
+    visited[start] = true;
+    size_t head = order.size();
+    order.push_back(start);
+    while (head < order.size()) {
+      int node = order[head++];
+      array<int, 4> next;
+      int num_next = 0;
+      for (int k = 0; k < 4; ++k) {
+        int n = nodes.neighbors_vec[node][k];
+        if (n >= 0 && !visited[n]) {
+          visited[n] = true;
+          next[num_next++] = n;
+        }
+      }
+      stable_sort(next.begin(), next.begin() + num_next, [&](int a, int b) {
+        return node_degree(nodes, a) < node_degree(nodes, b);
+      });
+      order.insert(order.end(), next.begin(), next.begin() + num_next);
+    }
+  }
+  reverse(order.begin(), order.end());
+  return order;
+}
+
+// The number of nodes in the tiles before tile_coord, and in that tile
+static void tile_extent(ivec2 samples, ivec2 tile_coord,
+    int& out_start, ivec2& out_size) {
+  ivec2 origin = NODE_TILE_SIZE * tile_coord;
+  out_size = min(ivec2(NODE_TILE_SIZE), samples - origin);
+  // the rows of whole tiles below, then the tiles to the left in this row
+  out_start = origin[1] * samples[0] + origin[0] * out_size[1];
+}
+
+static vector<int> tiled_order(ivec2 samples) {
+  vector<int> new_to_old(samples[0] * samples[1]);
+  ivec2 num_tiles = (samples + NODE_TILE_SIZE - 1) / NODE_TILE_SIZE;
+  for (int ty = 0; ty < num_tiles[1]; ++ty) {
+    for (int tx = 0; tx < num_tiles[0]; ++tx) {
+      int start;
+      ivec2 size;
+      tile_extent(samples, ivec2(tx, ty), start, size);
+      for (int y = 0; y < size[1]; ++y) {
+        for (int x = 0; x < size[0]; ++x) {
+          ivec2 coord = NODE_TILE_SIZE * ivec2(tx, ty) + ivec2(x, y);
+          new_to_old[start + y * size[0] + x] = coord[0] + samples[0] * coord[1];
+        }
+      }
+    }
+  }
+  return new_to_old;
+}
+
+NodeTiles compute_node_tiles(ivec2 samples, MorphNodes const& nodes) {
+  int num_nodes = nodes.pos_vec.size();
+  assert(num_nodes == samples[0] * samples[1]);
+  NodeTiles tiles;
+  tiles.num_tiles = (samples + NODE_TILE_SIZE - 1) / NODE_TILE_SIZE;
+  for (int ty = 0; ty < tiles.num_tiles[1]; ++ty) {
+    for (int tx = 0; tx < tiles.num_tiles[0]; ++tx) {
+      int start;
+      ivec2 size;
+      tile_extent(samples, ivec2(tx, ty), start, size);
+      tiles.tile_starts.push_back(start);
+    }
+  }
+  tiles.tile_starts.push_back(num_nodes);
+
+  for (int t = 0; t < tiles.tile_count(); ++t) {
+    tiles.cross_edge_starts.push_back(tiles.cross_edges.size());
+    for (int i = tiles.tile_starts[t]; i < tiles.tile_starts[t + 1]; ++i) {
+      for (int k = 0; k < 4; ++k) {
+        int n = nodes.neighbors_vec[i][k];
+        if (n >= 0 && tile_local_index(tiles, t, n) == -1) {
+          tiles.cross_edges.push_back(ivec2(i, k));
+        }
+      }
+    }
+  }
+  tiles.cross_edge_starts.push_back(tiles.cross_edges.size());
+  return tiles;
+}
+
+vector<int> compute_node_order(int order, ivec2 samples,
+    MorphNodes const& nodes) {
+  int num_nodes = nodes.pos_vec.size();
+  assert(num_nodes == samples[0] * samples[1]);
+  if (order == NODE_ORDER_MORTON) {
+    return order_by_key(samples, morton_key);
+  } else if (order == NODE_ORDER_HILBERT) {
+    uint32_t n = 1;
+    while (n < (uint32_t) std::max(samples[0], samples[1])) {
+      n *= 2;
+    }
+    return order_by_key(samples, [n](uint32_t x, uint32_t y) {
+      return hilbert_key(n, x, y);
+    });
+  } else if (order == NODE_ORDER_RCM) {
+    return rcm_order(nodes);
+  } else if (order == NODE_ORDER_TILED) {
+    return tiled_order(samples);
+  }
+  return identity_permutation(num_nodes);
+}
+
+vector<int> identity_permutation(int num_nodes) {
+  vector<int> perm(num_nodes);
+  for (int i = 0; i < num_nodes; ++i) {
+    perm[i] = i;
+  }
+  return perm;
+}
+
+vector<int> invert_permutation(vector<int> const& perm) {
+  vector<int> inverse(perm.size());
+  for (int i = 0; i < perm.size(); ++i) {
+    inverse[perm[i]] = i;
+  }
+  return inverse;
+}
+
+vector<int> extend_permutation(vector<int> perm, int num_nodes) {
+  int old_size = perm.size();
+  perm.resize(num_nodes);
+  for (int i = old_size; i < num_nodes; ++i) {
+    perm[i] = i;
+  }
+  return perm;
+}
+
+void permute_nodes(vector<int> const& new_to_old, MorphNodes& nodes,
+    vector<GLuint>& indices) {
+  int num_nodes = nodes.pos_vec.size();
+  assert(new_to_old.size() == num_nodes);
+  vector<int> old_to_new = invert_permutation(new_to_old);
+  MorphNodes permuted(num_nodes);
+  for (int i = 0; i < num_nodes; ++i) {
+    int old_index = new_to_old[i];
+    permuted.pos_vec[i] = nodes.pos_vec[old_index];
+    permuted.vel_vec[i] = nodes.vel_vec[old_index];
+    permuted.data_vec[i] = nodes.data_vec[old_index];
+    ivec4 neighbors = nodes.neighbors_vec[old_index];
+    for (int k = 0; k < 4; ++k) {
+      if (neighbors[k] >= 0) {
+        neighbors[k] = old_to_new[neighbors[k]];
+      }
+    }
+    permuted.neighbors_vec[i] = neighbors;
+  }
+  nodes = std::move(permuted);
+  for (GLuint& index : indices) {
+    index = old_to_new[index];
+  }
+}
+
+LocalityStats measure_locality(MorphNodes const& nodes, size_t cache_bytes) {
+  const int line_bytes = 64;
+  const int num_ways = 8;
+  int num_sets = std::max(cache_bytes / line_bytes / num_ways, (size_t) 1);
+  // the line tags of each set, most recently used first
+  vector<int64_t> tags(num_sets * num_ways, -1);
+  uint64_t num_misses = 0;
+  auto access = [&](int node_index) {
+    int64_t line = (int64_t) node_index * sizeof(vec4) / line_bytes;
+    int64_t* set = &tags[(line % num_sets) * num_ways];
+    int way = 0;
+    while (way < num_ways && set[way] != line) {
+      ++way;
+    }
+    if (way == num_ways) {
+      ++num_misses;
+      way = num_ways - 1;
+    }
+    for (; way > 0; --way) {
+      set[way] = set[way - 1];
+    }
+    set[0] = line;
+  };
+
+  LocalityStats stats;
+  int num_nodes = nodes.pos_vec.size();
+  uint64_t total_dist = 0;
+  uint64_t num_edges = 0;
+  for (int i = 0; i < num_nodes; ++i) {
+    access(i);
+    for (int k = 0; k < 4; ++k) {
+      int n = nodes.neighbors_vec[i][k];
+      if (n >= 0) {
+        access(n);
+        int dist = std::abs(n - i);
+        total_dist += dist;
+        stats.max_neighbor_dist = std::max(stats.max_neighbor_dist, dist);
+        ++num_edges;
+      }
+    }
+  }
+  stats.mean_neighbor_dist = num_edges > 0 ?
+    (double) total_dist / num_edges : 0.0;
+  stats.gather_misses_per_node = num_nodes > 0 ?
+    (double) num_misses / num_nodes : 0.0;
+  return stats;
+}
@@ -0,0 +1,149 @@
+#include "node_pool.h"
+
+#include <algorithm>
+#include <cassert>
+
+void init_node_pool(NodePool& pool, int num_nodes,
+    vector<GLuint> indices, int pool_size) {
+  pool = NodePool();
+  pool.capacity = num_nodes + std::max(pool_size, 0);
+  pool.indices = std::move(indices);
+  pool.node_tris.reserve(pool.capacity);
+  pool.node_tris.resize(num_nodes);
+  for (int i = 0; i + 2 < pool.indices.size(); i += 3) {
+    for (int k = 0; k < 3; ++k) {
+      pool.node_tris[pool.indices[i + k]].push_back(i / 3);
+    }
+  }
+}
+
+int alloc_node(NodePool& pool, MorphNodes& nodes) {
+  if (!pool.free_nodes.empty()) {
+    int node = pool.free_nodes.back();
+    pool.free_nodes.pop_back();
+    return node;
+  }
+  int node = nodes.size();
+  if (node >= pool.capacity) {
+    return -1;
+  }
+  nodes.resize(node + 1);
+  nodes.neighbors_vec[node] = ivec4(OPEN_EDGE);
+  nodes.data_vec[node] = vec4(-1.0);
+  pool.node_tris.resize(node + 1);
+  return node;
+}
+
+void free_node(NodePool& pool, MorphNodes& nodes, int node) {
+  assert(pool.node_tris[node].empty());
+  nodes.pos_vec[node] = vec4(0.0);
+  nodes.vel_vec[node] = vec4(0.0);
+  nodes.neighbors_vec[node] = ivec4(OPEN_EDGE);
+  nodes.data_vec[node] = vec4(-1.0);
+  pool.free_nodes.push_back(node);
+}
+
+static void remove_tri(vector<int>& tris, int tri) {
+  auto it = find(tris.begin(), tris.end(), tri);
+  assert(it != tris.end());
+  tris.erase(it);
+}
+
+// Splits each triangle {s, b, x} on the edge from s to b into {s, n, x}
+// and {n, b, x}, which keeps the winding
+static void split_edge_tris(NodePool& pool, int s, int b, int n) {
+  // the triangles of s are not changed, only those of b, n and x
+  vector<int> const& s_tris = pool.node_tris[s];
+  for (int tri : s_tris) {
+    GLuint* corners = &pool.indices[3 * tri];
+    int b_corner = find(corners, corners + 3, (GLuint) b) - corners;
+    if (b_corner == 3) {
+      continue;
+    }
+    int s_corner = find(corners, corners + 3, (GLuint) s) - corners;
+    int x = corners[3 - s_corner - b_corner];
+    array<GLuint, 3> new_corners = {corners[0], corners[1], corners[2]};
+    new_corners[s_corner] = n;
+    corners[b_corner] = n;
+    int new_tri = pool.indices.size() / 3;
+    pool.indices.insert(pool.indices.end(),
+        new_corners.begin(), new_corners.end());
+
+    remove_tri(pool.node_tris[b], tri);
+    pool.node_tris[b].push_back(new_tri);
+    pool.node_tris[n].push_back(tri);
+    pool.node_tris[n].push_back(new_tri);
+    pool.node_tris[x].push_back(new_tri);
+    pool.changed_tris.push_back(tri);
+    pool.changed_tris.push_back(new_tri);
+  }
+}
+
+// Splices a new node into edge slot of node s. Returns false if the
+// edge no longer exists or the pool is full.
+static bool splice_node(NodePool& pool, MorphNodes& nodes, int s, int slot) {
+  int b = nodes.neighbors_vec[s][slot];
+  int back_slot = (slot + 2) % 4;
+  if (b < 0 || nodes.neighbors_vec[b][back_slot] != s) {
+    return false;
+  }
+  int n = alloc_node(pool, nodes);
+  if (n == -1) {
+    ++pool.num_dropped;
+    return false;
+  }
+  vec3 mid_pos = 0.5f * (vec3(nodes.pos_vec[s]) + vec3(nodes.pos_vec[b]));
+  // the new node starts with no heat, so that the total is unchanged
+  nodes.pos_vec[n] = vec4(mid_pos, 0.0);
+  nodes.vel_vec[n] = vec4(0.0);
+  nodes.data_vec[n] = vec4(-1.0);
+  ivec4 n_neighbors(OPEN_EDGE);
+  n_neighbors[slot] = b;
+  n_neighbors[back_slot] = s;
+  nodes.neighbors_vec[n] = n_neighbors;
+  nodes.neighbors_vec[s][slot] = n;
+  nodes.neighbors_vec[b][back_slot] = n;
+  split_edge_tris(pool, s, b, n);
+  return true;
+}
+
+int run_topology_pass(NodePool& pool, MorphNodes& nodes,
+    vector<int>& node_ids) {
+  // each pair is {node id, node index}
+  vector<pair<int, int>> requests;
+  int num_nodes = nodes.size();
+  for (int i = 0; i < num_nodes; ++i) {
+    if ((int) nodes.data_vec[i].w >= SPLICE_MSG_BASE) {
+      requests.push_back(make_pair(node_ids.empty() ? i : node_ids[i], i));
+    }
+  }
+  if (requests.empty()) {
+    return 0;
+  }
+  sort(requests.begin(), requests.end());
+
+  int num_spliced = 0;
+  for (auto const& request : requests) {
+    int s = request.second;
+    int slot = (int) nodes.data_vec[s].w - SPLICE_MSG_BASE;
+    assert(slot < 4);
+    nodes.data_vec[s] = vec4(-1.0);
+    if (splice_node(pool, nodes, s, slot)) {
+      ++num_spliced;
+    }
+  }
+  if (!node_ids.empty()) {
+    for (int i = node_ids.size(); i < nodes.size(); ++i) {
+      node_ids.push_back(i);
+    }
+  }
+  return num_spliced;
+}
+
+vector<int> take_changed_tris(NodePool& pool) {
+  vector<int> tris;
+  tris.swap(pool.changed_tris);
+  sort(tris.begin(), tris.end());
+  tris.erase(unique(tris.begin(), tris.end()), tris.end());
+  return tris;
+}
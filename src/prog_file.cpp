@@ -0,0 +1,76 @@
+#include "prog_file.h"
+
+#include <cassert>
+#include <cstring>
+
+bool read_prog_file(string prog_filename,
+    string& out_prog_text, vector<UserUnif>& out_user_unifs) {
+  FILE* prog_file = fopen(prog_filename.c_str(), "r");
+  if (!prog_file) {
+    printf("WARNING shader file not found at the path:\n%s\n", prog_filename.c_str());
+    return false;
+  }
+  // read user defined uniforms from the file header
+  vector<UserUnif> user_unifs;
+  while (true) {
+    array<char, 100> unif_name;
+    int num_comps = 0;
+    float min = 0.0;
+    float max = 1.0;
+    float drag_speed = 1.0;
+    vec4 def_val(0.0);
+
+    int num_read = fscanf(prog_file, "%s", unif_name.data());
+    assert(num_read == 1);
+    if (strcmp(unif_name.data(), "END_USER_UNIFS") == 0) {
+      break;    
+    }
+    num_read = fscanf(prog_file,
+        " comps %d min %f max %f speed %f default ",
+        &num_comps, &min, &max, &drag_speed);
+    assert(num_read == 4);
+    for (int i = 0; i < num_comps; ++i) {
+      num_read = fscanf(prog_file, "%f", &def_val[i]);
+      assert(num_read == 1);
+    }
+    UserUnif unif(unif_name.data(), num_comps,
+        min, max, drag_speed, def_val, def_val);
+    user_unifs.push_back(unif);
+  }
+  // read the GLSL text
+  long start_pos = ftell(prog_file);
+  fseek(prog_file, 0, SEEK_END);
+  long glsl_len = ftell(prog_file) - start_pos;
+  fseek(prog_file, start_pos, SEEK_SET);
+  array<char, 100000> prog_buf;
+  assert(glsl_len < prog_buf.size());
+  int bytes_read = fread(prog_buf.data(), 1, glsl_len, prog_file);
+  fclose(prog_file);
+  assert(bytes_read == glsl_len);
+  prog_buf[glsl_len] = '\0';
+
+  out_prog_text = string(prog_buf.data());
+  out_user_unifs = user_unifs;
+  return true;
+}
+
+bool override_user_unif(vector<UserUnif>& user_unifs,
+    string const& name, string const& value) {
+  for (UserUnif& user_unif : user_unifs) {
+    if (user_unif.name != name) {
+      continue;
+    }
+    vec4 v = user_unif.cur_val;
+    int num_read = sscanf(value.c_str(), "%f,%f,%f,%f",
+        &v[0], &v[1], &v[2], &v[3]);
+    if (num_read < 1) {
+      printf("invalid value for %s: %s\n", name.c_str(), value.c_str());
+      return false;
+    }
+    user_unif.cur_val = v;
+    return true;
+  }
+  printf("no user uniform named %s\n", name.c_str());
+  return false;
+}
+
@@ -0,0 +1,134 @@
+#include "sim_worker.h"
+#include "node_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+static double steady_ms() {
+  return chrono::duration<double, milli>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SimRequest::SimRequest() :
+  target_iter(0)
+{
+}
+
+SimWorkerState::SimWorkerState() :
+  iter_num(0),
+  target_iter(0),
+  topology_version(0)
+{
+}
+
+SimWorker::SimWorker() :
+  request_pending(false),
+  stopping(false)
+{
+  worker = thread(&SimWorker::worker_loop, this);
+}
+
+SimWorker::~SimWorker() {
+  stopping.store(true);
+  {
+    // so that the worker cannot miss the notify between its check and
+    // its wait
+    lock_guard<mutex> lock(wake_mutex);
+  }
+  wake.notify_one();
+  worker.join();
+}
+
+void SimWorker::submit(SimRequest const& request) {
+  requests.write_slot() = request;
+  requests.publish();
+  request_pending.store(true);
+  {
+    lock_guard<mutex> lock(wake_mutex);
+  }
+  wake.notify_one();
+}
+
+SimWorkerState* SimWorker::take_state() {
+  return states.take() ? &states.read_slot() : nullptr;
+}
+
+void SimWorker::worker_loop() {
+  CpuMorphState cpu_state;
+  // the request being simulated, null before the first
+  SimRequest const* request = nullptr;
+  // the key that cpu_state was seeded for
+  string seeded_key;
+  vector<GLuint> seed_indices;
+  int iter_num = 0;
+  int topology_version = 0;
+  // the iterations per slice, adjusted to take about SIM_WORKER_SLICE_MS
+  int slice_iters = 1;
+  bool has_unpublished = false;
+  double last_publish_ms = steady_ms();
+  while (!stopping.load()) {
+    if (request_pending.exchange(false) && requests.take()) {
+      request = &requests.read_slot();
+      if (request->key != seeded_key || request->target_iter < iter_num) {
+        MORPH_TRACE_ZONE("sim worker reseed");
+        seed_cpu_state(cpu_state, request->controls, seed_indices);
+        seeded_key = request->key;
+        iter_num = 0;
+        topology_version += 1;
+        slice_iters = 1;
+        has_unpublished = true;
+      }
+    }
+    if (!request ||
+        (iter_num >= request->target_iter && !has_unpublished)) {
+      unique_lock<mutex> lock(wake_mutex);
+      wake.wait(lock, [&] {
+          return stopping.load() || request_pending.load();
+      });
+      continue;
+    }
+
+    if (iter_num < request->target_iter) {
+      int end_iter = iter_num + std::min(slice_iters,
+          request->target_iter - iter_num);
+      double slice_begin_ms = steady_ms();
+      run_cpu_simulation(cpu_state, request->params, iter_num, end_iter,
+          request->controls);
+      double slice_ms = steady_ms() - slice_begin_ms;
+      if (slice_ms < SIM_WORKER_SLICE_MS / 2 &&
+          end_iter - iter_num == slice_iters && slice_iters < (1 << 20)) {
+        slice_iters *= 2;
+      } else if (slice_ms > SIM_WORKER_SLICE_MS * 2 && slice_iters > 1) {
+        slice_iters /= 2;
+      }
+      iter_num = end_iter;
+      has_unpublished = true;
+      NodePool& pool = cpu_state.node_pool;
+      if (node_pool_enabled(pool) && !take_changed_tris(pool).empty()) {
+        topology_version += 1;
+      }
+    }
+
+    if (has_unpublished && (iter_num >= request->target_iter ||
+          steady_ms() - last_publish_ms >= SIM_WORKER_PUBLISH_MS)) {
+      MORPH_TRACE_ZONE("sim worker publish");
+      SimWorkerState& state = states.write_slot();
+      state.key = seeded_key;
+      state.iter_num = iter_num;
+      state.target_iter = request->target_iter;
+      state.nodes = cpu_state.buffers[cpu_state.result_buffer_index];
+      // the slot may hold the topology of an older state
+      if (state.topology_version != topology_version) {
+        NodePool const& pool = cpu_state.node_pool;
+        state.indices = node_pool_enabled(pool) ?
+          pool.indices : seed_indices;
+        state.node_ids = cpu_state.node_ids;
+        state.topology_version = topology_version;
+      }
+      states.publish();
+      has_unpublished = false;
+      last_publish_ms = steady_ms();
+    }
+  }
+}
@@ -0,0 +1,202 @@
+#include "snapshot.h"
+#include "node_pool.h"
+
+#include <cassert>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedSnapshot::MappedSnapshot()
+{
+}
+
+static uint64_t align_offset(uint64_t offset) {
+  return (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT *
+    SNAPSHOT_ALIGNMENT;
+}
+
+// Writes the section at offset, zero-padding from the current position
+static bool write_section(FILE* file, uint64_t& cur_offset,
+    uint64_t offset, const void* data, size_t num_bytes) {
+  static const char zeros[SNAPSHOT_ALIGNMENT] = {0};
+  assert(offset >= cur_offset && offset - cur_offset < SNAPSHOT_ALIGNMENT);
+  size_t pad = offset - cur_offset;
+  if (fwrite(zeros, 1, pad, file) != pad ||
+      fwrite(data, 1, num_bytes, file) != num_bytes) {
+    return false;
+  }
+  cur_offset = offset + num_bytes;
+  return true;
+}
+
+bool write_snapshot(string const& path, int iter_num,
+    int num_zygote_samples, vector<UserUnif> const& user_unifs,
+    MorphNodes const& nodes, vector<GLuint> const& indices) {
+  int num_nodes = nodes.pos_vec.size();
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.iter_num = iter_num;
+  header.num_nodes = num_nodes;
+  header.num_indices = indices.size();
+  header.num_unifs = user_unifs.size();
+  header.num_zygote_samples = num_zygote_samples;
+
+  vector<SnapshotUnif> unifs(user_unifs.size());
+  for (int i = 0; i < unifs.size(); ++i) {
+    memset(&unifs[i], 0, sizeof(SnapshotUnif));
+    strncpy(unifs[i].name, user_unifs[i].name.c_str(),
+        sizeof(unifs[i].name) - 1);
+    unifs[i].num_comps = user_unifs[i].num_comps;
+    for (int c = 0; c < 4; ++c) {
+      unifs[i].value[c] = user_unifs[i].cur_val[c];
+    }
+  }
+
+  // every MorphNode member is 16 bytes
+  uint64_t array_size = (uint64_t) num_nodes * sizeof(vec4);
+  header.unifs_offset = align_offset(sizeof(header));
+  header.pos_offset = align_offset(
+      header.unifs_offset + unifs.size() * sizeof(SnapshotUnif));
+  header.vel_offset = align_offset(header.pos_offset + array_size);
+  header.neighbors_offset = align_offset(header.vel_offset + array_size);
+  header.data_offset = align_offset(header.neighbors_offset + array_size);
+  header.indices_offset = align_offset(header.data_offset + array_size);
+  header.file_size = header.indices_offset + indices.size() * sizeof(GLuint);
+
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    printf("could not open %s for writing\n", path.c_str());
+    return false;
+  }
+  uint64_t cur_offset = 0;
+  bool ok =
+    write_section(file, cur_offset, 0, &header, sizeof(header)) &&
+    write_section(file, cur_offset, header.unifs_offset,
+        unifs.data(), unifs.size() * sizeof(SnapshotUnif)) &&
+    write_section(file, cur_offset, header.pos_offset,
+        nodes.pos_vec.data(), array_size) &&
+    write_section(file, cur_offset, header.vel_offset,
+        nodes.vel_vec.data(), array_size) &&
+    write_section(file, cur_offset, header.neighbors_offset,
+        nodes.neighbors_vec.data(), array_size) &&
+    write_section(file, cur_offset, header.data_offset,
+        nodes.data_vec.data(), array_size) &&
+    write_section(file, cur_offset, header.indices_offset,
+        indices.data(), indices.size() * sizeof(GLuint));
+  ok = fclose(file) == 0 && ok;
+  if (!ok) {
+    printf("error writing snapshot %s\n", path.c_str());
+  }
+  return ok;
+}
+
+bool map_snapshot(string const& path, MappedSnapshot& out_snapshot) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    printf("could not open snapshot %s\n", path.c_str());
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      file_stat.st_size < (off_t) sizeof(SnapshotHeader)) {
+    printf("snapshot %s is truncated\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  size_t map_size = file_stat.st_size;
+  void* map_addr = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping stays valid after the fd is closed
+  close(fd);
+  if (map_addr == MAP_FAILED) {
+    printf("could not mmap snapshot %s\n", path.c_str());
+    return false;
+  }
+
+  const char* base = (const char*) map_addr;
+  SnapshotHeader const* header = (SnapshotHeader const*) base;
+  uint64_t array_size = (uint64_t) header->num_nodes * sizeof(vec4);
+  bool is_valid =
+    memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+    header->version == SNAPSHOT_VERSION &&
+    header->num_nodes >= 0 && header->num_indices >= 0 &&
+    header->num_unifs >= 0 && header->file_size <= map_size;
+  // each {offset, size} section must be aligned and in bounds
+  vector<pair<uint64_t, uint64_t>> sections = {
+    {header->unifs_offset, header->num_unifs * sizeof(SnapshotUnif)},
+    {header->pos_offset, array_size},
+    {header->vel_offset, array_size},
+    {header->neighbors_offset, array_size},
+    {header->data_offset, array_size},
+    {header->indices_offset, header->num_indices * sizeof(GLuint)},
+  };
+  // the sum of an offset and a size could wrap, so the size is checked
+  // first
+  uint64_t file_size = header->file_size;
+  for (auto& section : sections) {
+    is_valid = is_valid && section.first % SNAPSHOT_ALIGNMENT == 0 &&
+      section.first >= sizeof(SnapshotHeader) &&
+      section.second <= file_size &&
+      section.first <= file_size - section.second;
+  }
+  if (!is_valid) {
+    printf("%s is not a version %u snapshot, or is truncated\n",
+        path.c_str(), SNAPSHOT_VERSION);
+    munmap(map_addr, map_size);
+    return false;
+  }
+  // the neighbors and indices are used to index the nodes, so each must
+  // be a node or, for a neighbor, -1 or OPEN_EDGE
+  int num_nodes = header->num_nodes;
+  ivec4 const* neighbors = (ivec4 const*) (base + header->neighbors_offset);
+  for (int i = 0; i < num_nodes && is_valid; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      int n = neighbors[i][j];
+      is_valid = is_valid && n < num_nodes && (n >= -1 || n == OPEN_EDGE);
+    }
+  }
+  GLuint const* indices = (GLuint const*) (base + header->indices_offset);
+  for (int i = 0; i < header->num_indices && is_valid; ++i) {
+    is_valid = indices[i] < (GLuint) num_nodes;
+  }
+  if (!is_valid) {
+    printf("%s has a neighbor or index that is not a node\n", path.c_str());
+    munmap(map_addr, map_size);
+    return false;
+  }
+
+  MappedSnapshot snapshot;
+  snapshot.header = header;
+  snapshot.unifs = (SnapshotUnif const*) (base + header->unifs_offset);
+  snapshot.pos = (vec4 const*) (base + header->pos_offset);
+  snapshot.vel = (vec4 const*) (base + header->vel_offset);
+  snapshot.neighbors = (ivec4 const*) (base + header->neighbors_offset);
+  snapshot.data = (vec4 const*) (base + header->data_offset);
+  snapshot.indices = (GLuint const*) (base + header->indices_offset);
+  snapshot.map_addr = map_addr;
+  snapshot.map_size = map_size;
+  out_snapshot = snapshot;
+  return true;
+}
+
+void unmap_snapshot(MappedSnapshot& snapshot) {
+  if (snapshot.map_addr) {
+    munmap(snapshot.map_addr, snapshot.map_size);
+  }
+  snapshot = MappedSnapshot();
+}
+
+MorphNodes snapshot_nodes(MappedSnapshot const& snapshot) {
+  int num_nodes = snapshot.header->num_nodes;
+  MorphNodes nodes;
+  nodes.pos_vec.assign(snapshot.pos, snapshot.pos + num_nodes);
+  nodes.vel_vec.assign(snapshot.vel, snapshot.vel + num_nodes);
+  nodes.neighbors_vec.assign(snapshot.neighbors,
+      snapshot.neighbors + num_nodes);
+  nodes.data_vec.assign(snapshot.data, snapshot.data + num_nodes);
+  return nodes;
+}
+
@@ -0,0 +1,203 @@
+#include "sweep.h"
+#include "cpu_sim.h"
+#include "morph_data.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+
+SweepDim::SweepDim() :
+  unif_index(0),
+  comp(0)
+{
+}
+
+SweepDim::SweepDim(int unif_index, int comp) :
+  unif_index(unif_index),
+  comp(comp)
+{
+}
+
+SweepConfig::SweepConfig()
+{
+}
+
+bool add_sweep_dims(SweepConfig& config, string const& spec) {
+  size_t dot_pos = spec.find('.');
+  string name = spec.substr(0, dot_pos);
+  for (int i = 0; i < config.user_unifs.size(); ++i) {
+    UserUnif const& user_unif = config.user_unifs[i];
+    if (user_unif.name != name) {
+      continue;
+    }
+    if (dot_pos == string::npos) {
+      for (int c = 0; c < user_unif.num_comps; ++c) {
+        config.dims.push_back(SweepDim(i, c));
+      }
+      return true;
+    }
+    int comp = atoi(spec.c_str() + dot_pos + 1);
+    if (comp < 0 || comp >= user_unif.num_comps) {
+      printf("%s has no component %d\n", name.c_str(), comp);
+      return false;
+    }
+    config.dims.push_back(SweepDim(i, comp));
+    return true;
+  }
+  printf("no user uniform named %s\n", name.c_str());
+  return false;
+}
+
+vector<vector<float>> gen_sweep_samples(SweepConfig const& config) {
+  int num_dims = config.dims.size();
+  vector<vector<float>> samples;
+  mt19937 rng(config.seed);
+  uniform_real_distribution<float> unit_dist(0.0f, 1.0f);
+
+  if (config.design == SWEEP_GRID) {
+    int points = std::max(config.grid_points, 1);
+    // count in base points, one digit per dim
+    vector<int> digits(num_dims, 0);
+    while (true) {
+      vector<float> sample(num_dims);
+      for (int d = 0; d < num_dims; ++d) {
+        sample[d] = points == 1 ? 0.5f : digits[d] / (float) (points - 1);
+      }
+      samples.push_back(sample);
+      int d = 0;
+      while (d < num_dims && ++digits[d] == points) {
+        digits[d] = 0;
+        ++d;
+      }
+      if (d == num_dims) {
+        break;
+      }
+    }
+  } else if (config.design == SWEEP_RANDOM) {
+    for (int i = 0; i < config.num_samples; ++i) {
+      vector<float> sample(num_dims);
+      for (int d = 0; d < num_dims; ++d) {
+        sample[d] = unit_dist(rng);
+      }
+      samples.push_back(sample);
+    }
+  } else if (config.design == SWEEP_LHS) {
+    int n = config.num_samples;
+    samples.assign(n, vector<float>(num_dims));
+    vector<int> strata(n);
+    for (int d = 0; d < num_dims; ++d) {
+      for (int i = 0; i < n; ++i) {
+        strata[i] = i;
+      }
+      shuffle(strata.begin(), strata.end(), rng);
+      for (int i = 0; i < n; ++i) {
+        samples[i][d] = (strata[i] + unit_dist(rng)) / n;
+      }
+    }
+  }
+  return samples;
+}
+
+bool run_sweep(SweepConfig const& config) {
+  vector<vector<float>> samples = gen_sweep_samples(config);
+  int num_runs = samples.size();
+
+  string index_filename = config.out_dir + "/index.csv";
+  FILE* index_file = fopen(index_filename.c_str(), "w");
+  if (!index_file) {
+    printf("could not open %s for writing\n", index_filename.c_str());
+    return false;
+  }
+  fprintf(index_file, "run");
+  for (SweepDim const& dim : config.dims) {
+    fprintf(index_file, ",%s.%d",
+        config.user_unifs[dim.unif_index].name.c_str(), dim.comp);
+  }
+  fprintf(index_file, ",sim_ms,iters,output\n");
+  fflush(index_file);
+
+  // every run starts from the same seed data
+  MorphNodes seed_nodes;
+  vector<GLuint> indices;
+  gen_morph_data(ivec2(config.num_zygote_samples), seed_nodes, indices);
+
+  // each worker runs whole simulations on one thread, which scales
+  // better than splitting every iteration across threads
+  Controls controls;
+  controls.sim_backend = SIM_BACKEND_CPU;
+  controls.num_sim_threads = 1;
+  controls.use_simd_kernels = config.use_simd_kernels;
+
+  ThreadPool workers(config.num_workers);
+  printf("sweep: %d runs on %d workers\n", num_runs, workers.num_threads());
+  atomic<int> next_run(0);
+  atomic<int> num_done(0);
+  mutex index_mutex;
+  workers.parallel_for(0, workers.num_threads(),
+    [&](int begin, int end, int thread_index) {
+      CpuMorphState cpu_state;
+      while (true) {
+        int run = next_run++;
+        if (run >= num_runs) {
+          break;
+        }
+        vector<UserUnif> user_unifs = config.user_unifs;
+        vector<float> values;
+        for (int d = 0; d < config.dims.size(); ++d) {
+          UserUnif& user_unif = user_unifs[config.dims[d].unif_index];
+          float t = samples[run][d];
+          float value = user_unif.min + t * (user_unif.max - user_unif.min);
+          user_unif.cur_val[config.dims[d].comp] = value;
+          values.push_back(value);
+        }
+        GrowthParams params(user_unifs);
+
+        auto start_time = chrono::steady_clock::now();
+        cpu_state.buffers[0] = seed_nodes;
+        int num_iters = config.num_iters;
+        if (config.run_to_convergence) {
+          ConvergenceCriteria convergence = config.convergence;
+          convergence.max_iters = config.num_iters;
+          SimResidual residual;
+          num_iters = run_cpu_to_convergence(cpu_state, params, 0,
+              convergence, controls, residual);
+        } else {
+          run_cpu_simulation(cpu_state, params, 0, num_iters, controls);
+        }
+        double sim_ms = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start_time).count();
+
+        string out_filename;
+        if (config.write_run_nodes) {
+          array<char, 100> s;
+          sprintf(s.data(), "run_%05d.csv", run);
+          out_filename = s.data();
+          string out_path = config.out_dir + "/" + out_filename;
+          FILE* out_file = fopen(out_path.c_str(), "w");
+          if (out_file) {
+            write_nodes_csv(out_file,
+                cpu_state.buffers[cpu_state.result_buffer_index]);
+            fclose(out_file);
+          } else {
+            printf("could not open %s for writing\n", out_path.c_str());
+            out_filename = "";
+          }
+        }
+
+        unique_lock<mutex> lock(index_mutex);
+        fprintf(index_file, "%d", run);
+        for (float value : values) {
+          fprintf(index_file, ",%.9g", value);
+        }
+        fprintf(index_file, ",%.3f,%d,%s\n", sim_ms, num_iters,
+            out_filename.c_str());
+        fflush(index_file);
+        printf("sweep: %d/%d done\n", ++num_done, num_runs);
+      }
+    });
+
+  fclose(index_file);
+  return true;
+}
+
@@ -0,0 +1,131 @@
+// Headless driver for parameter sweeps over the user uniforms of a
+// morph program. See sweep.h.
+
+#include "types.h"
+#include "prog_file.h"
+#include "sweep.h"
+
+#include <cstring>
+
+const char* SWEEP_USAGE_STRING = R"--(usage:
+
+morph_sweep shader_file -s spec [-s spec ..] [options]
+
+options:
+  -s spec          sweep a uniform over its [min, max] range. spec is
+                   "name" for every component or "name.i" for component i
+  -d design        grid, random or lhs (default grid)
+  -g points        grid points per dim (default 3)
+  -c count         samples for the random and lhs designs (default 16)
+  --seed seed      seed for the random and lhs designs (default 1)
+  -n samples       the zygote is samples x samples nodes (default 100)
+  -i iters         the number of iterations per run (default 100)
+  --converge d[,h] stop a run once no node moves more than d and the
+                   total heat changes by no more than h (default 1e-3)
+                   over a check interval, with -i as the most iterations
+  --check k        the iterations between convergence checks (default 10)
+  -w workers       concurrent runs, 0 for one per core (default 0)
+  -u name=x[,y..]  override the value of a uniform that is not swept
+  -o dir           the output directory, which must exist (default .)
+  --no-nodes       only write the index, not each run's final nodes
+  --no-simd        do not use the SIMD kernels
+
+ex. morph_sweep ../shaders/growth.glsl -s spring_coeffs -s cloning_coeffs.2 -d lhs -c 1000 -o sweep_out
+)--";
+
+// Returns false if the args are invalid
+bool parse_sweep_args(int argc, char** argv, SweepConfig& config) {
+  if (argc < 2) {
+    return false;
+  }
+  string prog_text;
+  if (!read_prog_file(argv[1], prog_text, config.user_unifs)) {
+    return false;
+  }
+  for (int i = 2; i < argc; ++i) {
+    string arg(argv[i]);
+    if (arg == "--no-nodes") {
+      config.write_run_nodes = false;
+      continue;
+    }
+    if (arg == "--no-simd") {
+      config.use_simd_kernels = false;
+      continue;
+    }
+    if (i + 1 == argc) {
+      printf("missing value for %s\n", arg.c_str());
+      return false;
+    }
+    const char* value = argv[++i];
+    if (arg == "-s") {
+      if (!add_sweep_dims(config, value)) {
+        return false;
+      }
+    } else if (arg == "-d") {
+      vector<const char*> design_names = {"grid", "random", "lhs"};
+      config.design = -1;
+      for (int d = 0; d < design_names.size(); ++d) {
+        if (strcmp(value, design_names[d]) == 0) {
+          config.design = d;
+        }
+      }
+      if (config.design == -1) {
+        printf("unknown design: %s\n", value);
+        return false;
+      }
+    } else if (arg == "-g") {
+      config.grid_points = atoi(value);
+    } else if (arg == "-c") {
+      config.num_samples = atoi(value);
+    } else if (arg == "--seed") {
+      config.seed = strtoul(value, nullptr, 10);
+    } else if (arg == "-n") {
+      config.num_zygote_samples = atoi(value);
+    } else if (arg == "-i") {
+      config.num_iters = atoi(value);
+    } else if (arg == "--converge") {
+      config.run_to_convergence = true;
+      ConvergenceCriteria& convergence = config.convergence;
+      if (sscanf(value, "%f,%f", &convergence.disp_tol,
+            &convergence.heat_tol) < 1) {
+        printf("expected disp_tol[,heat_tol], got: %s\n", value);
+        return false;
+      }
+    } else if (arg == "--check") {
+      config.convergence.check_interval = atoi(value);
+    } else if (arg == "-w") {
+      config.num_workers = atoi(value);
+    } else if (arg == "-o") {
+      config.out_dir = value;
+    } else if (arg == "-u") {
+      const char* eq = strchr(value, '=');
+      if (!eq) {
+        printf("expected name=value, got: %s\n", value);
+        return false;
+      }
+      if (!override_user_unif(config.user_unifs,
+            string(value, eq - value), string(eq + 1))) {
+        return false;
+      }
+    } else {
+      printf("unknown option: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  if (config.dims.empty()) {
+    printf("nothing to sweep, use -s\n");
+    return false;
+  }
+  return config.num_zygote_samples >= 2 && config.num_iters >= 0 &&
+    config.convergence.check_interval >= 1;
+}
+
+int main(int argc, char** argv) {
+  SweepConfig config;
+  if (!parse_sweep_args(argc, argv, config)) {
+    printf("%s", SWEEP_USAGE_STRING);
+    return 1;
+  }
+  return run_sweep(config) ? 0 : 1;
+}
+
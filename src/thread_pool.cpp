@@ -0,0 +1,93 @@
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int num_threads)
+{
+  if (num_threads <= 0) {
+    num_threads = std::max((int) thread::hardware_concurrency(), 1);
+  }
+  thread_count = num_threads;
+  for (int i = 1; i < thread_count; ++i) {
+    workers.push_back(thread(&ThreadPool::worker_loop, this, i));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    unique_lock<mutex> lock(job_mutex);
+    shutting_down = true;
+  }
+  job_start.notify_all();
+  for (thread& worker : workers) {
+    worker.join();
+  }
+}
+
+int ThreadPool::num_threads() const {
+  return thread_count;
+}
+
+void ThreadPool::run_range(int thread_index) {
+  // split the job into thread_count contiguous ranges
+  long len = job_end - job_begin;
+  int range_begin = job_begin + (int) (len * thread_index / thread_count);
+  int range_end = job_begin + (int) (len * (thread_index + 1) / thread_count);
+  if (range_begin < range_end) {
+    MORPH_TRACE_ZONE("parallel_for range");
+    (*job_fn)(range_begin, range_end, thread_index);
+  }
+}
+
+void ThreadPool::worker_loop(int thread_index) {
+  long seen_generation = 0;
+  while (true) {
+    {
+      unique_lock<mutex> lock(job_mutex);
+      job_start.wait(lock, [&]() {
+        return shutting_down || job_generation != seen_generation;
+      });
+      if (shutting_down) {
+        return;
+      }
+      seen_generation = job_generation;
+    }
+
+    run_range(thread_index);
+
+    {
+      unique_lock<mutex> lock(job_mutex);
+      ranges_remaining -= 1;
+      if (ranges_remaining == 0) {
+        job_done.notify_one();
+      }
+    }
+  }
+}
+
+void ThreadPool::parallel_for(int begin, int end, RangeFn const& fn) {
+  if (end <= begin) {
+    return;
+  }
+  if (thread_count == 1) {
+    fn(begin, end, 0);
+    return;
+  }
+  {
+    unique_lock<mutex> lock(job_mutex);
+    job_fn = &fn;
+    job_begin = begin;
+    job_end = end;
+    ranges_remaining = thread_count - 1;
+    job_generation += 1;
+  }
+  job_start.notify_all();
+
+  // the calling thread handles the first range
+  run_range(0);
+
+  unique_lock<mutex> lock(job_mutex);
+  job_done.wait(lock, [&]() { return ranges_remaining == 0; });
+  job_fn = nullptr;
+}
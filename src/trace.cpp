@@ -0,0 +1,118 @@
+#include "trace.h"
+
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdio>
+
+TraceBuffer::TraceBuffer() :
+  thread_index(0),
+  num_recorded(0),
+  num_written(0),
+  in_use(false)
+{
+}
+
+#ifdef MORPH_TRACING
+
+// every buffer ever registered, only added to or taken under the mutex
+static mutex trace_buffers_mutex;
+static vector<unique_ptr<TraceBuffer>> trace_buffers;
+thread_local TraceBuffer* cur_trace_buffer = nullptr;
+
+static int64_t steady_now_ns() {
+  return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the steady clock time and ticks at startup, to convert the ticks to ns.
+// They are taken before any zone can begin, as a zone only records (and
+// so registers its buffer) when it ends, and its ts must not be negative.
+static int64_t trace_origin_ns = steady_now_ns();
+static int64_t trace_origin_ticks = trace_now_ticks();
+
+// Releases the buffer of a thread when it exits. It is separate from
+// cur_trace_buffer so that the zones read a plain pointer, without the
+// check that a thread_local with a destructor needs.
+struct TraceBufferRelease {
+  ~TraceBufferRelease() {
+    if (cur_trace_buffer) {
+      cur_trace_buffer->in_use.store(false, memory_order_release);
+    }
+  }
+};
+static thread_local TraceBufferRelease trace_buffer_release;
+
+TraceBuffer* acquire_trace_buffer() {
+  unique_lock<mutex> lock(trace_buffers_mutex);
+  // touch it so that its destructor runs when the thread exits
+  (void) &trace_buffer_release;
+  // reuse the buffer of a thread that has exited, ex. of an old pool
+  TraceBuffer* found = nullptr;
+  for (auto& buffer : trace_buffers) {
+    if (!buffer->in_use.load(memory_order_acquire)) {
+      found = buffer.get();
+      break;
+    }
+  }
+  if (!found) {
+    unique_ptr<TraceBuffer> buffer(new TraceBuffer());
+    buffer->thread_index = trace_buffers.size();
+    buffer->events.resize(TRACE_BUFFER_EVENTS);
+    found = buffer.get();
+    trace_buffers.push_back(move(buffer));
+  }
+  found->in_use.store(true, memory_order_relaxed);
+  cur_trace_buffer = found;
+  return found;
+}
+
+bool write_trace_json(string const& path) {
+  FILE* file = fopen(path.c_str(), "w");
+  if (!file) {
+    printf("could not open %s for writing\n", path.c_str());
+    return false;
+  }
+  unique_lock<mutex> lock(trace_buffers_mutex);
+  // the timestamps are in us from startup
+  double us_per_tick = 1e-3;
+  int64_t elapsed_ticks = trace_now_ticks() - trace_origin_ticks;
+  if (elapsed_ticks > 0) {
+    us_per_tick = 1e-3 * (steady_now_ns() - trace_origin_ns) / elapsed_ticks;
+  }
+  fprintf(file, "{\"traceEvents\": [\n");
+  int num_events = 0;
+  for (auto& buffer : trace_buffers) {
+    fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+        "\"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+        num_events > 0 ? ",\n" : "", buffer->thread_index,
+        buffer->thread_index);
+    num_events += 1;
+    int64_t n = buffer->num_recorded.load(memory_order_acquire);
+    int64_t first = std::max(buffer->num_written, n - TRACE_BUFFER_EVENTS);
+    for (int64_t i = first; i < n; ++i) {
+      TraceEvent const& event = buffer->events[i & (TRACE_BUFFER_EVENTS - 1)];
+      fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+          "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", event.name,
+          buffer->thread_index,
+          (event.begin_ticks - trace_origin_ticks) * us_per_tick,
+          (event.end_ticks - event.begin_ticks) * us_per_tick);
+      num_events += 1;
+    }
+    buffer->num_written = n;
+  }
+  fprintf(file, "\n], \"displayTimeUnit\": \"ns\"}\n");
+  fclose(file);
+  printf("wrote %d trace events to %s\n", num_events, path.c_str());
+  return true;
+}
+
+#else
+
+bool write_trace_json(string const& path) {
+  printf("could not write %s, build with -DMORPH_TRACING=ON for traces\n",
+      path.c_str());
+  return false;
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "types.h"
+#include "sim_worker.h"
 
 Camera::Camera()
 {
@@ -48,13 +49,13 @@ RenderState::RenderState()
 MorphNode::MorphNode():
   pos(0.0),
   vel(0.0),
-  neighbors(-1.0),
+  neighbors(-1),
   data(0.0)
 {
 }
 
 MorphNode::MorphNode(vec4 pos, vec4 vel,
-    vec4 neighbors, vec4 data) :
+    ivec4 neighbors, vec4 data) :
   pos(pos),
   vel(vel),
   neighbors(neighbors),
@@ -62,6 +63,10 @@ MorphNode::MorphNode(vec4 pos, vec4 vel,
 {
 }
 
+MorphNodes::MorphNodes()
+{
+}
+
 MorphNodes::MorphNodes(size_t num_nodes) :
   pos_vec(num_nodes),
   vel_vec(num_nodes),
@@ -90,12 +95,30 @@ MorphNode MorphNodes::node_at(size_t i) const {
       neighbors_vec[i], data_vec[i]);
 }
 
+size_t MorphNodes::size() const {
+  return pos_vec.size();
+}
+
+void MorphNodes::resize(size_t num_nodes) {
+  pos_vec.resize(num_nodes);
+  vel_vec.resize(num_nodes);
+  neighbors_vec.resize(num_nodes);
+  data_vec.resize(num_nodes);
+}
+
+void MorphNodes::reserve(size_t num_nodes) {
+  pos_vec.reserve(num_nodes);
+  vel_vec.reserve(num_nodes);
+  neighbors_vec.reserve(num_nodes);
+  data_vec.reserve(num_nodes);
+}
+
 string raw_node_str(MorphNode const& node) {
   array<char, 200> s;
   sprintf(s.data(), "pos: %s, vel: %s, neighbors: %s, data: %s",
         vec4_str(node.pos).c_str(),
         vec4_str(node.vel).c_str(),
-        vec4_str(node.neighbors).c_str(),
+        ivec4_str(node.neighbors).c_str(),
         vec4_str(node.data).c_str());
   return string(s.data());
 }
@@ -105,6 +128,11 @@ MorphBuffer::MorphBuffer() :
 {
 }
 
+CompactBuffer::CompactBuffer() :
+  vao(0)
+{
+}
+
 UserUnif::UserUnif(string name, int num_comps, float min, float max,
     float drag_speed, vec4 def_val, vec4 cur_val) :
   name(name), gl_handle(-1), num_comps(num_comps), min(min), max(max),
@@ -116,7 +144,78 @@ MorphProgram::MorphProgram(string name, vector<UserUnif>& user_unifs) :
   name(name),
   gl_handle(-1),
   unif_iter_num(-1),
-  user_unifs(user_unifs)
+  user_unifs(user_unifs),
+  flux_gl_handle(0)
+{
+}
+
+NodeTiles::NodeTiles()
+{
+}
+
+int NodeTiles::tile_count() const {
+  return num_tiles[0] * num_tiles[1];
+}
+
+NodePool::NodePool() :
+  capacity(0),
+  num_dropped(0)
+{
+}
+
+ActiveSet::ActiveSet() :
+  heat_flux_valid(false),
+  num_updates(0),
+  num_skipped(0)
+{
+}
+
+CpuMorphState::CpuMorphState() :
+  result_buffer_index(0)
+{
+}
+
+SeedCache::SeedCache() :
+  zygote_samples(-1),
+  node_order(-1)
+{
+}
+
+SimCheckpoint::SimCheckpoint() :
+  iter_num(0),
+  sim_backend(SIM_BACKEND_GL),
+  num_nodes(0),
+  num_bytes(0),
+  last_use(0)
+{
+}
+
+CheckpointCache::CheckpointCache() :
+  num_bytes(0),
+  budget_bytes(0),
+  use_count(0)
+{
+}
+
+SimSession::SimSession() :
+  is_valid(false),
+  iter_num(0)
+{
+}
+
+SimResidual::SimResidual() :
+  max_disp(0.0f),
+  mean_disp(0.0f),
+  heat_change(0.0f),
+  num_new_nodes(0)
+{
+}
+
+ConvergenceCriteria::ConvergenceCriteria() :
+  check_interval(10),
+  disp_tol(1e-4f),
+  heat_tol(1e-3f),
+  max_iters(100000)
 {
 }
 
@@ -129,6 +228,96 @@ MorphState::MorphState() :
 
 Controls::Controls()
 {
+  snprintf(snapshot_path.data(), snapshot_path.size(), "morph.snap");
+  snprintf(mesh_path.data(), mesh_path.size(), "morph.ply");
+  snprintf(trace_path.data(), trace_path.size(), "morph_trace.json");
+  snprintf(frame_stats_path.data(), frame_stats_path.size(),
+      "morph_frames.csv");
+  phase_budgets_ms[FRAME_PHASE_SIM] = 16.0f;
+  phase_budgets_ms[FRAME_PHASE_UPLOAD] = 4.0f;
+  phase_budgets_ms[FRAME_PHASE_RENDER] = 8.0f;
+  phase_budgets_ms[FRAME_PHASE_UI] = 4.0f;
+}
+
+GpuBuffer::GpuBuffer() :
+  handle(0),
+  usage(GL_STATIC_DRAW),
+  capacity(0),
+  tex_buf(0),
+  tex_format(0)
+{
+}
+
+GpuBufferReserve::GpuBufferReserve(GLuint buffer, size_t num_bytes,
+    size_t keep_bytes) :
+  buffer(buffer), num_bytes(num_bytes), keep_bytes(keep_bytes)
+{
+}
+
+GpuBuffers::GpuBuffers() :
+  cur_bytes(0),
+  peak_bytes(0),
+  budget_bytes(0),
+  num_reallocs(0)
+{
+}
+
+GpuResidual::GpuResidual() :
+  prog(0),
+  unif_num_inputs(-1),
+  unif_first_pass(-1),
+  vao(0),
+  prev_pos_vbo(0),
+  prev_pos_tex_buf(0)
+{
+}
+
+GpuTimerFrame::GpuTimerFrame() :
+  frame_num(0),
+  begin_ms(0.0),
+  num_untimed(0)
+{
+}
+
+GpuTimers::GpuTimers() :
+  enabled(true),
+  frame_num(0),
+  num_in_flight(0),
+  active_pass(-1),
+  num_collected(0),
+  last_num_untimed(0),
+  num_dropped(0)
+{
+  for (auto& pass_history : history_ms) {
+    pass_history.fill(0.0f);
+  }
+}
+
+FrameTimes::FrameTimes() :
+  frame_num(0)
+{
+  ms.fill(0.0f);
+}
+
+FrameStats::FrameStats() :
+  frames(FRAME_STATS_WINDOW),
+  num_frames(0),
+  frame_open(false),
+  frame_begin_ms(0.0),
+  cur_phase(-1),
+  phase_begin_ms(0.0)
+{
+}
+
+BackgroundSim::BackgroundSim() :
+  target_iter(-1),
+  iter_num(-1),
+  topology_version(-1)
+{
+}
+
+// here, where SimWorker is complete
+BackgroundSim::~BackgroundSim() {
 }
 
 GraphicsState::GraphicsState(GLFWwindow* window,